@@ -202,12 +202,68 @@ typedef struct ir_xps_export_mpeg2
 	uint32_t mb_height;
 	uint32_t mb_stride;
 	uint8_t *qscale_values;
+	void *qscale_buf; // AVBufferRef owning qscale_values, NULL if qscale_values is av_malloc()ed
 	void *pkt; // avpacket form source stream assumed to contain full AU
 	uint32_t is_imx;
 
 
 } ir_xps_export_mpeg2;
 
+typedef struct ir_xps_export_av1
+{
+    struct av1_sequence_header
+    {
+        uint32_t    seq_profile;
+        uint32_t    seq_level_idx;
+        uint32_t    still_picture;
+        uint32_t    max_frame_width;
+        uint32_t    max_frame_height;
+        uint32_t    bit_depth;
+        uint32_t    mono_chrome;
+        uint32_t    subsampling_x;
+        uint32_t    subsampling_y;
+        uint32_t    enable_order_hint;
+        uint32_t    order_hint_bits;
+    } seq;
+
+    struct av1_frame_header
+    {
+        uint32_t    frame_type;
+        uint32_t    show_frame;
+        uint32_t    showable_frame;
+        uint32_t    error_resilient_mode;
+        uint32_t    order_hint;
+        uint32_t    primary_ref_frame;
+        uint32_t    refresh_frame_flags;
+        int32_t     ref_frame_idx[7];
+        uint32_t    frame_width;
+        uint32_t    frame_height;
+        uint32_t    base_q_idx;
+        uint32_t    tile_cols_log2;
+        uint32_t    tile_rows_log2;
+    } fh;
+
+    /**
+    ****************************************************************************
+    * @note     Reference frame buffer slots exported in ref_frame[0] (LAST) and
+    *           ref_frame[1] (ALTREF), -1 if not referenced
+    ****************************************************************************
+    */
+    int32_t     ref_slot[IRXPS_NUM_REFS];
+
+    /**
+    ****************************************************************************
+    * @note     Order hint of the frames held in ref_slot when the frame is
+    *           decoded, valid where ref_slot is not -1. Set by the decoder,
+    *           the parser state has already moved past the frame.
+    ****************************************************************************
+    */
+    uint32_t    ref_order_hint[IRXPS_NUM_REFS];
+
+    void *pkt; // avpacket form source stream assumed to contain full TU
+
+} ir_xps_export_av1;
+
 /**
 ********************************************************************************
 * @enum         IR_CONTEXT_STATE
@@ -235,6 +291,7 @@ typedef struct
     ir_xps_export_hevc hevc_meta;
     ir_xps_export_avc  avc_meta;
     ir_xps_export_mpeg2 mpeg2_meta;
+    ir_xps_export_av1  av1_meta;
 
     ir_ref ref_frame[IRXPS_NUM_REFS];
 
@@ -0,0 +1,129 @@
+/**
+********************************************************************************
+* @file         ir_xps_export_av1.h
+* @brief        Irdeto unified interface between decoder and encoder for AV1
+* @note         Meta data is taken from the headers parsed by cbs_av1, the
+*               reference frames are exported by the decoder wrapper since they
+*               live inside libaom
+* @copyright    Irdeto B.V. All rights reserved.
+********************************************************************************
+*/
+
+#ifndef _IR_XPS_EXPORT_AV1_H_
+#define _IR_XPS_EXPORT_AV1_H_
+
+#include <libavutil/frame.h>
+#include <libavutil/common.h>
+
+#include "ir_xps_common.h"
+
+/**
+********************************************************************************
+* @note         Forward declaration of AV1 related structure
+********************************************************************************
+*/
+struct CodedBitstreamAV1Context;
+struct AV1RawFrameHeader;
+
+/**
+********************************************************************************
+* @brief    Export sequence and frame header of one coded frame
+* @param    [in] priv           cbs_av1 private context the temporal unit was
+*                               read with, holds the active sequence header
+* @param    [in] fh             Header of the frame to be re-encoded, shall not
+*                               be a show_existing_frame header
+* @param    [out] xps_context   Context to be filled
+* @return   IR_XPS_EXPORT_STATUS_OK on success
+********************************************************************************
+*/
+IR_XPS_EXPORT_STATUS ir_xps_export_aom(const struct CodedBitstreamAV1Context* const priv,
+    const struct AV1RawFrameHeader* const fh, ir_xps_context* xps_context)
+{
+    IR_XPS_EXPORT_STATUS result = IR_XPS_EXPORT_STATUS_BADARG;
+
+    do
+    {
+        if (NULL == priv || NULL == priv->sequence_header)
+        {
+            break;
+        }
+
+        if (NULL == fh || fh->show_existing_frame)
+        {
+            break;
+        }
+
+        if (NULL == xps_context)
+        {
+            break;
+        }
+
+        const AV1RawSequenceHeader* seq = priv->sequence_header;
+        ir_xps_export_av1* xps = &(xps_context->av1_meta);
+
+        /**
+        ************************************************************************
+        * @note     Export sequence header data
+        ************************************************************************
+        */
+        xps->seq.seq_profile = seq->seq_profile;
+        xps->seq.seq_level_idx = seq->seq_level_idx[0];
+        xps->seq.still_picture = seq->still_picture;
+        xps->seq.max_frame_width = seq->max_frame_width_minus_1 + 1;
+        xps->seq.max_frame_height = seq->max_frame_height_minus_1 + 1;
+        xps->seq.bit_depth = priv->bit_depth;
+        xps->seq.mono_chrome = seq->color_config.mono_chrome;
+        xps->seq.subsampling_x = seq->color_config.subsampling_x;
+        xps->seq.subsampling_y = seq->color_config.subsampling_y;
+        xps->seq.enable_order_hint = seq->enable_order_hint;
+        xps->seq.order_hint_bits = seq->enable_order_hint ?
+            seq->order_hint_bits_minus_1 + 1 : 0;
+
+        /**
+        ************************************************************************
+        * @note     Export frame header data, the frame size is the one derived
+        *           by cbs_av1 for the last frame of the temporal unit
+        ************************************************************************
+        */
+        xps->fh.frame_type = fh->frame_type;
+        xps->fh.show_frame = fh->show_frame;
+        xps->fh.showable_frame = fh->showable_frame;
+        xps->fh.error_resilient_mode = fh->error_resilient_mode;
+        xps->fh.order_hint = fh->order_hint;
+        xps->fh.primary_ref_frame = fh->primary_ref_frame;
+        xps->fh.refresh_frame_flags = fh->refresh_frame_flags;
+        for (int i = 0; i < AV1_REFS_PER_FRAME; i++)
+        {
+            xps->fh.ref_frame_idx[i] = fh->ref_frame_idx[i];
+        }
+        xps->fh.frame_width = priv->upscaled_width;
+        xps->fh.frame_height = priv->frame_height;
+        xps->fh.base_q_idx = fh->base_q_idx;
+        xps->fh.tile_cols_log2 = fh->tile_cols_log2;
+        xps->fh.tile_rows_log2 = fh->tile_rows_log2;
+
+        /**
+        ************************************************************************
+        * @note     Export parsed data, intra frames do not use references
+        ************************************************************************
+        */
+        if (fh->frame_type == AV1_FRAME_KEY || fh->frame_type == AV1_FRAME_INTRA_ONLY)
+        {
+            xps->ref_slot[0] = -1;
+            xps->ref_slot[1] = -1;
+        }
+        else
+        {
+            xps->ref_slot[0] = fh->ref_frame_idx[AV1_REF_FRAME_LAST - AV1_REF_FRAME_LAST];
+            xps->ref_slot[1] = fh->ref_frame_idx[AV1_REF_FRAME_ALTREF - AV1_REF_FRAME_LAST];
+        }
+        xps_context->is_ref = fh->refresh_frame_flags != 0;
+
+        xps_context->header.state = IR_CONTEXT_STATE_READY;
+        result = IR_XPS_EXPORT_STATUS_OK;
+    } while(0);
+
+    return result;
+}
+
+#endif /*_IR_XPS_EXPORT_AV1_H_*/
@@ -18,7 +18,60 @@
 struct MpegEncContext;
 struct Picture;
 
-IR_XPS_EXPORT_STATUS ir_xps_export_mpg2(const struct MpegEncContext* const h,
+/**
+********************************************************************************
+* @brief        Complete a macroblock qscale map in one sweep: macroblocks
+*               without a coded qscale (0) take the first coded value of their
+*               row, or the value to their left, and for field pictures each
+*               pair of rows is averaged as soon as both rows are complete
+********************************************************************************
+*/
+static inline void ir_xps_mpg2_fill_qscale(uint8_t* qscale, int mb_width,
+    int mb_height, int mb_stride, int field_pic)
+{
+	uint8_t q = 0;
+
+	for (int y = 0; y < mb_height; y++)
+	{
+		uint8_t* row = qscale + y * mb_stride;
+
+		if (memchr(row, 0, mb_width))
+		{
+			int x = 0;
+
+			while (x < mb_width && row[x] == 0)
+			{
+				x++;
+			}
+			if (x < mb_width)
+			{
+				q = row[x];
+			}
+			for (x = 0; x < mb_width; x++)
+			{
+				if (row[x] == 0)
+				{
+					row[x] = q;
+				}
+				q = row[x];
+			}
+		}
+
+		if (field_pic && (y & 1))
+		{
+			uint8_t* above = row - mb_stride;
+
+			for (int x = 0; x < mb_width; x++)
+			{
+				uint8_t avg = (above[x] + row[x]) >> 1;
+				above[x] = avg;
+				row[x] = avg;
+			}
+		}
+	}
+}
+
+IR_XPS_EXPORT_STATUS ir_xps_export_mpg2(struct MpegEncContext* const h,
     ir_xps_context* xps_context)
 {
     IR_XPS_EXPORT_STATUS result = IR_XPS_EXPORT_STATUS_BADARG;
@@ -71,51 +124,30 @@ IR_XPS_EXPORT_STATUS ir_xps_export_mpg2(const struct MpegEncContext* const h,
    		xps->mb_height = h->mb_height;
    		xps->mb_width = h->mb_width;
    		xps->mb_stride = h->mb_stride;
-   		xps->qscale_values = av_malloc(h->mb_height * h->mb_stride);
-		memcpy(xps->qscale_values, h->qscale_values, h->mb_height * h->mb_stride);
-		memset(h->qscale_values, 0, h->mb_height * h->mb_stride);
-
-		for (int y = 0; y < h->mb_height; y++)
-		{
-			int q;
-
-			for (int x = 0; x < h->mb_width; x++)
-			{
-				if (xps->qscale_values[y * h->mb_stride + x] != 0)
-				{
-					q = xps->qscale_values[y * h->mb_stride + x];
-					break;
-				}
-			}
-			for (int x = 0; x < h->mb_width; x++)
-			{
-				if (xps->qscale_values[y * h->mb_stride + x] != 0)
-				{
-					break;
-				}
-				xps->qscale_values[y * h->mb_stride + x] = q;
-			}
-			for (int x = 1; x < h->mb_width; x++)
-			{
-				if (xps->qscale_values[y * h->mb_stride + x] == 0)
-				{
-					xps->qscale_values[y * h->mb_stride + x] = xps->qscale_values[y * h->mb_stride + x - 1];
-				}
-			}
-		}
-
-		if (xps->picture_structure != PICT_FRAME)
-		{	// combine 2 fields
-			for (int y = 1; y < h->mb_height; y+=2)
-			{
-				for (int x = 0; x < h->mb_width; x++)
-				{
-					int avg = (xps->qscale_values[(y - 1) * h->mb_stride + x] + xps->qscale_values[y * h->mb_stride + x]) / 2;
-					xps->qscale_values[(y - 1) * h->mb_stride + x] = avg;
-					xps->qscale_values[y * h->mb_stride + x] = avg;
-				}
-			}
-		}
+   		xps->qscale_values = NULL;
+   		xps->qscale_buf = NULL;
+
+   		/**
+   		 ********************************************************************
+   		 * @note     The map collected while decoding becomes the exported
+   		 *           one, decoding continues in a cleared buffer of the pool
+   		 ********************************************************************
+   		 */
+   		AVBufferRef* next = av_buffer_pool_get(h->qscale_values_pool);
+   		if (NULL == next)
+   		{
+   			result = IR_XPS_EXPORT_STATUS_FAIL;
+   			break;
+   		}
+   		memset(next->data, 0, h->mb_height * h->mb_stride);
+
+   		xps->qscale_buf = h->qscale_values_buf;
+   		xps->qscale_values = h->qscale_values;
+   		h->qscale_values_buf = next;
+   		h->qscale_values = next->data;
+
+   		ir_xps_mpg2_fill_qscale(xps->qscale_values, h->mb_width, h->mb_height,
+   			h->mb_stride, xps->picture_structure != PICT_FRAME);
 
          /**
          ************************************************************************
@@ -60,7 +60,12 @@ void ir_xps_context_destroy(ir_xps_context* xps_context)
             av_frame_free(&frame);
         }
 
-        if (xps_context->mpeg2_meta.qscale_values != NULL)
+        if (xps_context->mpeg2_meta.qscale_buf != NULL)
+        {
+        	AVBufferRef* buf = (AVBufferRef*) (xps_context->mpeg2_meta.qscale_buf);
+        	av_buffer_unref(&buf);
+        }
+        else if (xps_context->mpeg2_meta.qscale_values != NULL)
         {
         	av_free(xps_context->mpeg2_meta.qscale_values);
         }
@@ -86,6 +91,13 @@ void ir_xps_context_destroy(ir_xps_context* xps_context)
             av_packet_free(&pkt);
         }
 
+        if (xps_context->av1_meta.pkt != NULL)
+        {
+            AVPacket* pkt = (AVPacket*) (xps_context->av1_meta.pkt);
+            av_packet_unref(pkt);
+            av_packet_free(&pkt);
+        }
+
         free(xps_context);
     }
 }
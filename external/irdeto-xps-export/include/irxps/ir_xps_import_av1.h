@@ -0,0 +1,450 @@
+/**
+********************************************************************************
+* @file         ir_xps_import_av1.h
+* @brief        Irdeto unified interface between decoder and encoder for AV1
+* @note         libaom is used unpatched, the import only relies on its public
+*               encoder configuration, frame flags and reference controls
+* @copyright    Irdeto B.V. All rights reserved.
+********************************************************************************
+*/
+
+#ifndef _IR_XPS_IMPORT_AV1_H_
+#define _IR_XPS_IMPORT_AV1_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <aom/aom_encoder.h>
+#include <aom/aomcx.h>
+
+#include "ir_xps_common.h"
+
+/**
+********************************************************************************
+* @brief    Map a frame header base_q_idx to the 0..63 quantizer scale of the
+*           libaom configuration, inverse of the libaom quantizer_to_qindex
+*           table (q * 4, except 63 which maps to 255)
+********************************************************************************
+*/
+static unsigned int ir_xps_qindex_to_quantizer_aom(uint32_t base_q_idx)
+{
+    unsigned int quantizer = (base_q_idx + 3) / 4;
+    return quantizer > 63 ? 63 : quantizer;
+}
+
+/**
+********************************************************************************
+* @brief    Signed distance between two order hints, get_relative_dist() of
+*           the AV1 specification
+********************************************************************************
+*/
+static int32_t ir_xps_relative_dist_aom(const ir_xps_export_av1* const xps,
+    uint32_t a, uint32_t b)
+{
+    if (!xps->seq.enable_order_hint || xps->seq.order_hint_bits == 0)
+    {
+        return 0;
+    }
+
+    int32_t m = 1 << (xps->seq.order_hint_bits - 1);
+    int32_t diff = (int32_t)(a - b);
+
+    return (diff & (m - 1)) - (diff & m);
+}
+
+/**
+********************************************************************************
+* @struct   ir_xps_import_aom_state
+* @brief    Reference buffer state of a libaom encoder used for imports, kept
+*           by the caller from frame to frame
+* @note     libaom shares one buffer between all slots after a key frame, a
+*           reference loaded into one slot then shows in all of them.
+*           Buffers are told apart by ids, -1 where a slot is not known.
+********************************************************************************
+*/
+typedef struct ir_xps_import_aom_state
+{
+    int32_t     key_pending;        ///< The next frame may come out as a key frame
+    uint32_t    order_hint;         ///< Order hint of the next coded frame
+    int32_t     refresh;            ///< Slots refreshed by the configured frame, -1 if unknown
+    int32_t     slot_buffer[8];     ///< Buffer id held by each slot
+    int32_t     next_buffer;        ///< Next unused buffer id
+} ir_xps_import_aom_state;
+
+/**
+********************************************************************************
+* @brief    Initialize the state of a newly opened encoder
+********************************************************************************
+*/
+void ir_xps_import_init_aom(ir_xps_import_aom_state* const state)
+{
+    memset(state, 0, sizeof(*state));
+
+    /* The first frame of an encoder is always a key frame */
+    state->key_pending = 1;
+    state->refresh = -1;
+    for (int slot = 0; slot < 8 /* REF_FRAMES */; slot++)
+    {
+        state->slot_buffer[slot] = -1;
+    }
+}
+
+/**
+********************************************************************************
+* @brief    Configure the encoder so that the next frame matches the exported
+*           frame header and does not update any reference
+* @note     Only frames which do not refresh a reference slot can be replaced.
+*           The frames decoded after a reference frame use the CDFs, motion
+*           vectors and order hint saved with it in the slots, which a
+*           re-encoded frame cannot reproduce.
+* @param    [in,out] cfg        Active encoder configuration, the caller applies
+*                               it with aom_codec_enc_config_set()
+* @param    [in] xps_context    Context filled by ir_xps_export_aom()
+* @param    [out] flags         Frame flags for aom_codec_encode()
+* @note     Sequence level parameters cannot be changed on an open encoder,
+*           they are only validated
+* @return   IR_XPS_EXPORT_STATUS_OK on success, IR_XPS_EXPORT_STATUS_BADPRO
+*           for a frame which cannot be replaced
+********************************************************************************
+*/
+IR_XPS_EXPORT_STATUS ir_xps_import_meta_aom(aom_codec_enc_cfg_t* const cfg,
+    const ir_xps_context* const xps_context, aom_enc_frame_flags_t* const flags)
+{
+    IR_XPS_EXPORT_STATUS result = IR_XPS_EXPORT_STATUS_BADARG;
+
+    do
+    {
+        if (NULL == cfg || NULL == flags)
+        {
+            break;
+        }
+
+        if (NULL == xps_context)
+        {
+            break;
+        }
+
+        if (xps_context->header.state != IR_CONTEXT_STATE_READY)
+        {
+            break;
+        }
+
+        const ir_xps_export_av1* xps = &(xps_context->av1_meta);
+
+        if (cfg->g_profile != xps->seq.seq_profile ||
+            cfg->g_bit_depth != xps->seq.bit_depth ||
+            cfg->g_w != xps->fh.frame_width ||
+            cfg->g_h != xps->fh.frame_height)
+        {
+            result = IR_XPS_EXPORT_STATUS_BADPRO;
+            break;
+        }
+
+        /**
+        ************************************************************************
+        * @note     libaom can not be told to code a hidden frame, frames
+        *           which are only shown through show_existing_frame are not
+        *           supported
+        ************************************************************************
+        */
+        if (!xps->fh.show_frame)
+        {
+            result = IR_XPS_EXPORT_STATUS_BADPRO;
+            break;
+        }
+
+        /**
+        ************************************************************************
+        * @note     Key frames refresh every slot, they are reference frames
+        *           as well
+        ************************************************************************
+        */
+        if (xps->fh.refresh_frame_flags != 0)
+        {
+            result = IR_XPS_EXPORT_STATUS_BADPRO;
+            break;
+        }
+
+        /**
+        ************************************************************************
+        * @note     Import frame header parameters
+        ************************************************************************
+        */
+        cfg->rc_min_quantizer = ir_xps_qindex_to_quantizer_aom(xps->fh.base_q_idx);
+        cfg->rc_max_quantizer = cfg->rc_min_quantizer;
+
+        /* Only predict from the exported LAST and ALTREF frames */
+        *flags = AOM_EFLAG_NO_REF_LAST2 | AOM_EFLAG_NO_REF_LAST3 |
+                 AOM_EFLAG_NO_REF_GF | AOM_EFLAG_NO_REF_BWD |
+                 AOM_EFLAG_NO_REF_ARF2;
+        if (xps->ref_slot[1] < 0 || xps->ref_slot[1] == xps->ref_slot[0])
+        {
+            *flags |= AOM_EFLAG_NO_REF_ARF;
+        }
+
+        /* The re-encoded frame must leave the decoder state untouched, as
+         * the replaced one did */
+        *flags |= AOM_EFLAG_NO_UPD_LAST | AOM_EFLAG_NO_UPD_GF |
+                  AOM_EFLAG_NO_UPD_ARF | AOM_EFLAG_NO_UPD_ENTROPY;
+
+        /**
+        ************************************************************************
+        * @note     The decoder only holds the pictures of the encoder
+        *           references, not the CDFs and motion vectors libaom stored
+        *           with its own frames
+        ************************************************************************
+        */
+        *flags |= AOM_EFLAG_SET_PRIMARY_REF_NONE | AOM_EFLAG_NO_REF_FRAME_MVS;
+
+        if (xps->fh.error_resilient_mode)
+        {
+            *flags |= AOM_EFLAG_ERROR_RESILIENT;
+        }
+
+        result = IR_XPS_EXPORT_STATUS_OK;
+    } while(0);
+
+    return result;
+}
+
+/**
+********************************************************************************
+* @brief    Check whether the encoder must code a priming frame before the
+*           references of an inter frame can be loaded, and configure it
+* @param    [in] encoder        Encoder the priming frame is coded with
+* @param    [in,out] state      Reference buffer state of the encoder
+* @param    [in] xps_context    Context filled by ir_xps_export_aom()
+* @param    [out] prime         Set if the caller must code ref_frame[0] as a
+*                               priming frame which is not output, and call
+*                               this function again after it
+* @note     A priming frame is needed as long as the encoder may still code
+*           a key frame, and while the ALTREF slot shares its buffer with the
+*           LAST slot. The priming frame then refreshes only the ALTREF slot.
+* @return   IR_XPS_EXPORT_STATUS_OK on success
+********************************************************************************
+*/
+IR_XPS_EXPORT_STATUS ir_xps_import_prime_aom(aom_codec_ctx_t* const encoder,
+    ir_xps_import_aom_state* const state, const ir_xps_context* const xps_context,
+    int32_t* const prime)
+{
+    IR_XPS_EXPORT_STATUS result = IR_XPS_EXPORT_STATUS_BADARG;
+
+    do
+    {
+        if (NULL == encoder || NULL == state || NULL == prime)
+        {
+            break;
+        }
+
+        if (NULL == xps_context)
+        {
+            break;
+        }
+
+        const ir_xps_export_av1* xps = &(xps_context->av1_meta);
+        int32_t last = xps->ref_slot[0];
+        int32_t altref = xps->ref_slot[1];
+
+        if (last < 0 || last >= 8)
+        {
+            break;
+        }
+
+        aom_svc_ref_frame_config_t config;
+        memset(&config, 0, sizeof(config));
+        config.reference[0] = 1;
+        for (int i = 0; i < 7 /* INTER_REFS_PER_FRAME */; i++)
+        {
+            config.ref_idx[i] = last;
+        }
+
+        state->refresh = 0;
+        if (altref >= 0 && altref < 8 && altref != last &&
+            (state->slot_buffer[altref] < 0 ||
+             state->slot_buffer[altref] == state->slot_buffer[last]))
+        {
+            /* libaom only refreshes slots which are also referenced */
+            config.ref_idx[6] = altref;
+            config.refresh[altref] = 1;
+            state->refresh = 1 << altref;
+        }
+
+        result = IR_XPS_EXPORT_STATUS_OK;
+
+        *prime = state->key_pending || state->refresh;
+        if (!*prime)
+        {
+            break;
+        }
+
+        if (aom_codec_control(encoder, AV1E_SET_SVC_REF_FRAME_CONFIG, &config) != AOM_CODEC_OK)
+        {
+            result = IR_XPS_EXPORT_STATUS_FAIL;
+            break;
+        }
+    } while(0);
+
+    return result;
+}
+
+/**
+********************************************************************************
+* @brief    Load the exported reference frames into the reference buffers of
+*           the encoder and map them to LAST and ALTREF
+* @param    [in] encoder        Encoder primed by ir_xps_import_prime_aom()
+* @param    [in,out] state      Reference buffer state of the encoder
+* @param    [in] xps_context    Context with the data pointers of the
+*                               reference frames set by the caller
+* @param    [in] layout         Image describing format and size of the input
+* @param    [in,out] flags      Frame flags from ir_xps_import_meta_aom()
+* @note     The encoder references are placed in the slots the exported frame
+*           refers to, the frame header then carries the same ref_frame_idx.
+*           ALTREF is not used when the decoder would derive another sign
+*           bias for it than the encoder, which only knows past frames.
+* @return   IR_XPS_EXPORT_STATUS_OK on success
+********************************************************************************
+*/
+IR_XPS_EXPORT_STATUS ir_xps_import_ref_aom(aom_codec_ctx_t* const encoder,
+    ir_xps_import_aom_state* const state, const ir_xps_context* const xps_context,
+    const aom_image_t* const layout, aom_enc_frame_flags_t* const flags)
+{
+    IR_XPS_EXPORT_STATUS result = IR_XPS_EXPORT_STATUS_BADARG;
+
+    do
+    {
+        if (NULL == encoder || NULL == state || NULL == layout || NULL == flags)
+        {
+            break;
+        }
+
+        if (NULL == xps_context)
+        {
+            break;
+        }
+
+        const ir_xps_export_av1* xps = &(xps_context->av1_meta);
+        int32_t last = xps->ref_slot[0];
+        int32_t altref = xps->ref_slot[1];
+
+        if (last < 0 || last >= 8 ||
+            xps_context->ref_frame[0].data[0] == NULL ||
+            xps_context->ref_frame[0].height != layout->h)
+        {
+            break;
+        }
+
+        if (altref < 0 || altref >= 8 || altref == last ||
+            state->slot_buffer[altref] < 0 ||
+            state->slot_buffer[altref] == state->slot_buffer[last] ||
+            xps_context->ref_frame[1].data[0] == NULL ||
+            xps_context->ref_frame[1].height != layout->h)
+        {
+            *flags |= AOM_EFLAG_NO_REF_ARF;
+        }
+        else if ((ir_xps_relative_dist_aom(xps, xps->ref_order_hint[0], state->order_hint) > 0) !=
+                 (ir_xps_relative_dist_aom(xps, xps->ref_order_hint[1], state->order_hint) > 0))
+        {
+            *flags |= AOM_EFLAG_NO_REF_ARF;
+        }
+
+        result = IR_XPS_EXPORT_STATUS_OK;
+
+        for (int k = 0; k < IRXPS_NUM_REFS; k++)
+        {
+            const ir_ref* src = &(xps_context->ref_frame[k]);
+            av1_ref_frame_t ref;
+
+            if (k > 0 && (*flags & AOM_EFLAG_NO_REF_ARF))
+            {
+                break;
+            }
+
+            memset(&ref, 0, sizeof(ref));
+            ref.idx = xps->ref_slot[k];
+            ref.img = *layout;
+            for (int i = 0; i < IRXPS_NUM_PLANES; i++)
+            {
+                ref.img.planes[i] = src->data[i];
+                ref.img.stride[i] = src->linesize[i];
+            }
+
+            if (aom_codec_control(encoder, AV1_SET_REFERENCE, &ref) != AOM_CODEC_OK)
+            {
+                result = IR_XPS_EXPORT_STATUS_FAIL;
+                break;
+            }
+        }
+        if (result != IR_XPS_EXPORT_STATUS_OK)
+        {
+            break;
+        }
+
+        /* Every reference name maps to LAST but ALTREF, nothing is refreshed */
+        aom_svc_ref_frame_config_t config;
+        memset(&config, 0, sizeof(config));
+        config.reference[0] = 1;
+        config.reference[6] = !(*flags & AOM_EFLAG_NO_REF_ARF);
+        for (int i = 0; i < 7 /* INTER_REFS_PER_FRAME */; i++)
+        {
+            config.ref_idx[i] = last;
+        }
+        if (config.reference[6])
+        {
+            config.ref_idx[6] = altref;
+        }
+        state->refresh = 0;
+
+        if (aom_codec_control(encoder, AV1E_SET_SVC_REF_FRAME_CONFIG, &config) != AOM_CODEC_OK)
+        {
+            result = IR_XPS_EXPORT_STATUS_FAIL;
+            break;
+        }
+    } while(0);
+
+    return result;
+}
+
+/**
+********************************************************************************
+* @brief    Account for a frame coded by the encoder
+* @param    [in,out] state      Reference buffer state of the encoder
+* @param    [in] flags          Frame flags the frame was coded with
+* @param    [in] key            Set if the frame came out as a key frame
+* @note     Frames which were not configured by ir_xps_import_prime_aom() or
+*           ir_xps_import_ref_aom() leave the slots unknown
+********************************************************************************
+*/
+void ir_xps_import_update_aom(ir_xps_import_aom_state* const state,
+    aom_enc_frame_flags_t flags, int32_t key)
+{
+    if (key)
+    {
+        /* libaom codes the frame after a forced key frame as one as well */
+        state->key_pending = !!(flags & AOM_EFLAG_FORCE_KF);
+        state->order_hint = 1;
+        for (int slot = 0; slot < 8 /* REF_FRAMES */; slot++)
+        {
+            state->slot_buffer[slot] = state->next_buffer;
+        }
+        state->next_buffer++;
+    }
+    else
+    {
+        state->key_pending = 0;
+        state->order_hint++;
+        for (int slot = 0; slot < 8 /* REF_FRAMES */; slot++)
+        {
+            if (state->refresh < 0)
+            {
+                state->slot_buffer[slot] = -1;
+            }
+            else if (state->refresh & (1 << slot))
+            {
+                state->slot_buffer[slot] = state->next_buffer;
+            }
+        }
+        state->next_buffer++;
+    }
+    state->refresh = -1;
+}
+
+#endif /*_IR_XPS_IMPORT_AV1_H_*/
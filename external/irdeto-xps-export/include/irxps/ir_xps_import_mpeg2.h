@@ -51,6 +51,47 @@ static int find_element(uint8_t **ptr, uint8_t *end_ptr, int *len,
 }
 
 
+/**
+********************************************************************************
+* @brief        Convert an imported quantiser matrix into the encoder tables
+*               unless they already hold it for the current q_scale_type, a
+*               chroma matrix equal to its luma counterpart copies the luma
+*               tables instead of converting again
+********************************************************************************
+*/
+static void ir_xps_import_matrix_mpg2(MpegEncContext* const s, int idx,
+		int (*qmat)[64], uint16_t (*qmat16)[2][64], const uint16_t* matrix,
+		int bias, int qmin, int intra)
+{
+	static const int luma_idx[4] = { 0, 1, 0, 1 };
+	int (* const luma_qmat[2])[64] = { s->q_intra_matrix, s->q_inter_matrix };
+	uint16_t (* const luma_qmat16[2])[2][64] = { s->q_intra_matrix16,
+			s->q_inter_matrix16 };
+	int key = s->q_scale_type + 1;
+	int luma = luma_idx[idx];
+	int size = 32 - qmin;
+
+	if (s->irdeto_quant_key[idx] == key &&
+		!memcmp(s->irdeto_quant_matrix[idx], matrix, sizeof(s->irdeto_quant_matrix[idx])))
+	{
+		return;
+	}
+
+	if (luma != idx && qmat != luma_qmat[luma] && s->irdeto_quant_key[luma] == key &&
+		!memcmp(s->irdeto_quant_matrix[luma], matrix, sizeof(s->irdeto_quant_matrix[luma])))
+	{
+		memcpy(qmat + qmin, luma_qmat[luma] + qmin, size * sizeof(*qmat));
+		memcpy(qmat16 + qmin, luma_qmat16[luma] + qmin, size * sizeof(*qmat16));
+	}
+	else
+	{
+		ff_convert_matrix(s, qmat, qmat16, matrix, bias, qmin, 31, intra);
+	}
+
+	memcpy(s->irdeto_quant_matrix[idx], matrix, sizeof(s->irdeto_quant_matrix[idx]));
+	s->irdeto_quant_key[idx] = key;
+}
+
 IR_XPS_EXPORT_STATUS ir_xps_import_meta_mpg2(AVCodecContext * const avctx,
     const ir_xps_context* const xps_context)
 {
@@ -96,18 +137,14 @@ IR_XPS_EXPORT_STATUS ir_xps_import_meta_mpg2(AVCodecContext * const avctx,
 		s->q_scale_type = xps->q_scale_type;
 
 		/* Q matrices */
-		ff_convert_matrix(s, s->q_intra_matrix, s->q_intra_matrix16,
-				          xps->intra_quantiser_matrix, s->intra_quant_bias, avctx->qmin,
-	                      31, 1);
-	    ff_convert_matrix(s, s->q_inter_matrix, s->q_inter_matrix16,
-	    				  xps->non_intra_quantiser_matrix, s->inter_quant_bias, avctx->qmin,
-	                      31, 0);
-	    ff_convert_matrix(s, s->q_chroma_intra_matrix, s->q_chroma_intra_matrix16,
-	    		          xps->chroma_intra_quantiser_matrix, s->intra_quant_bias, avctx->qmin,
-	                      31, 1);
-	    ff_convert_matrix(s, s->q_chroma_inter_matrix, s->q_chroma_inter_matrix16,
-	    		          xps->chroma_non_intra_quantiser_matrix, s->inter_quant_bias, avctx->qmin,
-   	                      31, 0);
+		ir_xps_import_matrix_mpg2(s, 0, s->q_intra_matrix, s->q_intra_matrix16,
+				xps->intra_quantiser_matrix, s->intra_quant_bias, avctx->qmin, 1);
+		ir_xps_import_matrix_mpg2(s, 1, s->q_inter_matrix, s->q_inter_matrix16,
+				xps->non_intra_quantiser_matrix, s->inter_quant_bias, avctx->qmin, 0);
+		ir_xps_import_matrix_mpg2(s, 2, s->q_chroma_intra_matrix, s->q_chroma_intra_matrix16,
+				xps->chroma_intra_quantiser_matrix, s->intra_quant_bias, avctx->qmin, 1);
+		ir_xps_import_matrix_mpg2(s, 3, s->q_chroma_inter_matrix, s->q_chroma_inter_matrix16,
+				xps->chroma_non_intra_quantiser_matrix, s->inter_quant_bias, avctx->qmin, 0);
 
 	    /* qscale values */
 		memcpy(s->qscale_values, xps->qscale_values, xps->mb_stride * xps->mb_height);
@@ -17,6 +17,7 @@
  */
 
 #include "libavutil/common.h"
+#include "libavutil/ir_wm_info.h"
 #include "libavutil/opt.h"
 
 #include "bsf.h"
@@ -46,6 +47,8 @@ typedef struct AV1MetadataContext {
 
     AVRational tick_rate;
     int num_ticks_per_picture;
+
+    int wm_info_export;
 } AV1MetadataContext;
 
 
@@ -114,6 +117,91 @@ static int av1_metadata_update_sequence_header(AVBSFContext *bsf,
     return 0;
 }
 
+static int av1_read_leb128(const uint8_t **p, const uint8_t *end, uint64_t *value)
+{
+    int i;
+
+    *value = 0;
+    for (i = 0; i < 8 && *p < end; i++) {
+        uint8_t byte = *(*p)++;
+        *value |= (uint64_t)(byte & 0x7f) << (7 * i);
+        if (!(byte & 0x80))
+            return 0;
+    }
+    return AVERROR_INVALIDDATA;
+}
+
+/**
+ * Locate the payload of an Irdeto WM info metadata OBU in the raw unit
+ * data, i.e. the bytes following metadata_type without the trailing bits.
+ */
+static int av1_metadata_wm_info_payload(const CodedBitstreamUnit *unit,
+                                        const uint8_t **payload, size_t *size)
+{
+    const uint8_t *p = unit->data, *end = p + unit->data_size;
+    uint64_t obu_size, metadata_type;
+    int has_size;
+
+    if (unit->data_size < 2)
+        return AVERROR_INVALIDDATA;
+    has_size = p[0] & 0x02;
+    p += 1 + !!(p[0] & 0x04);
+
+    if (has_size) {
+        if (av1_read_leb128(&p, end, &obu_size) < 0 || obu_size > end - p)
+            return AVERROR_INVALIDDATA;
+        end = p + obu_size;
+    }
+    if (av1_read_leb128(&p, end, &metadata_type) < 0 ||
+        metadata_type != AV1_METADATA_TYPE_WM_INFO)
+        return AVERROR_INVALIDDATA;
+
+    while (end > p && !end[-1])
+        end--;
+    if (end > p && end[-1] == 0x80)
+        end--;
+
+    if (av_wm_info_parse_sei(p, end - p, NULL, NULL) < 0)
+        return AVERROR_INVALIDDATA;
+
+    *payload = p;
+    *size    = end - p;
+    return 0;
+}
+
+static int av1_metadata_export_wm_info(AVBSFContext *bsf, AVPacket *pkt,
+                                       CodedBitstreamFragment *frag)
+{
+    const uint8_t *payload;
+    uint8_t *sd;
+    size_t size;
+    int sd_size, i;
+
+    for (i = 0; i < frag->nb_units; i++) {
+        AV1RawOBU *obu = frag->units[i].content;
+
+        if (frag->units[i].type != AV1_OBU_METADATA ||
+            obu->obu.metadata.metadata_type != AV1_METADATA_TYPE_WM_INFO)
+            continue;
+        if (av1_metadata_wm_info_payload(&frag->units[i], &payload, &size) < 0) {
+            av_log(bsf, AV_LOG_WARNING, "Invalid WM info metadata OBU.\n");
+            continue;
+        }
+
+        // Side data forwarded from the encoder is replaced by what is
+        // actually in the bitstream
+        sd = av_packet_get_side_data(pkt, AV_PKT_IRDETO_SEI_PAYLOAD, &sd_size);
+        if (!sd || sd_size != size)
+            sd = av_packet_new_side_data(pkt, AV_PKT_IRDETO_SEI_PAYLOAD, size);
+        if (!sd)
+            return AVERROR(ENOMEM);
+        memcpy(sd, payload, size);
+        break;
+    }
+
+    return 0;
+}
+
 static int av1_metadata_filter(AVBSFContext *bsf, AVPacket *out)
 {
     AV1MetadataContext *ctx = bsf->priv_data;
@@ -168,6 +256,12 @@ static int av1_metadata_filter(AVBSFContext *bsf, AVPacket *out)
     if (err < 0)
         goto fail;
 
+    if (ctx->wm_info_export) {
+        err = av1_metadata_export_wm_info(bsf, out, frag);
+        if (err < 0)
+            goto fail;
+    }
+
     err = 0;
 fail:
     ff_cbs_fragment_uninit(ctx->cbc, frag);
@@ -273,6 +367,10 @@ static const AVOption av1_metadata_options[] = {
         OFFSET(num_ticks_per_picture), AV_OPT_TYPE_INT,
         { .i64 = -1 }, -1, INT_MAX, FLAGS },
 
+    { "wm_info_export", "Export Irdeto WM info metadata OBUs as packet side data",
+        OFFSET(wm_info_export), AV_OPT_TYPE_BOOL,
+        { .i64 = 0 }, 0, 1, FLAGS },
+
     { NULL }
 };
 
@@ -936,6 +936,11 @@ typedef struct RcOverride{
  * Show all frames before the first keyframe
  */
 #define AV_CODEC_FLAG2_SHOW_ALL       (1 << 22)
+/**
+ * Export Irdeto watermark info payloads through frame side data
+ * (AV_FRAME_DATA_IR_SEI_PAYLOAD)
+ */
+#define AV_CODEC_FLAG2_EXPORT_IR_SEI  (1 << 27)
 /**
  * Export motion vectors through frame side data
  */
@@ -1387,6 +1392,23 @@ enum AVPacketSideDataType {
      */
     AV_PKT_IRDETO_PPS,
 
+    /* *
+     * Irdeto initial epoch time, forwarded by the encoder from
+     * AV_FRAME_DATA_IR_EPOCH_TIME. The data is the AVIrdetoEpoch structure
+     * defined in libavutil/ir_wm_info.h
+     */
+    AV_PKT_IRDETO_EPOCH_TIME,
+
+    /* *
+     * Irdeto watermark info SEI payload (uuid followed by the V2/V3/DASH-IF
+     * body, as produced by av_wm_info_alloc_sei()). It is inserted into the
+     * bitstream by the irdeto_wm_info bitstream filter, exported from AV1
+     * metadata OBUs by the av1_metadata bitstream filter and passed on to
+     * decoded frames as AV_FRAME_DATA_IR_SEI_PAYLOAD with
+     * AV_CODEC_FLAG2_EXPORT_IR_SEI
+     */
+    AV_PKT_IRDETO_SEI_PAYLOAD,
+
 //  /**
 //   * @brief Uncompressed Y buffer after reencoded.
 //   * @note  This is the decoded and uncompressed Y component of the reencoded frame,
@@ -355,8 +355,10 @@ typedef struct AV1RawMetadataTimecode {
 
 typedef struct AV1RawMetadataWmInfo {
     uint8_t  uuid[16];
+    uint8_t  version;
+    uint8_t  tmid_length_div128; // Irdeto V3 only
     uint8_t  bit_value;
-    uint32_t bit_position;
+    uint64_t bit_position;
 } AV1RawMetadataWmInfo;
 
 typedef struct AV1RawPadding {
@@ -1754,15 +1754,54 @@ static int FUNC(metadata_wm_info)(CodedBitstreamContext *ctx, RWContext *rw,
     if (is_irdeto)
     {
         HEADER("Watermarking Info (Irdeto Format)");
-        fixed(8, version, 2);
-        fixed(8, flags, 0);
-        fb(31, bit_position);
-        fb(1, bit_value);
+        fc(8, version, 2, 3);
+
+        if (current->version == 2)
+        {
+            fixed(8, flags, 0);
+            fb(31, bit_position);
+            fb(1, bit_value);
+        }
+        else
+        {
+            // 64-bit sequence_id is split into 15/4/15/15/15 bit fields
+            // separated by emulation prevention bits
+            uint32_t sequence_id[5];
+#ifdef WRITE
+            sequence_id[0] =  current->bit_position        & 0x7FFF;
+            sequence_id[1] = (current->bit_position >> 15) & 0x000F;
+            sequence_id[2] = (current->bit_position >> 19) & 0x7FFF;
+            sequence_id[3] = (current->bit_position >> 34) & 0x7FFF;
+            sequence_id[4] = (current->bit_position >> 49) & 0x7FFF;
+#endif
+            fb(7, tmid_length_div128);
+            fb(1, bit_value);
+            fixed(1, emulation_1, 1);
+            xf(15, sequence_id_0_14, sequence_id[0], 0, MAX_UINT_BITS(15), 0);
+            fixed(1, emulation_2, 1);
+            fixed(1, firstpart, 1);
+            fixed(1, lastpart, 1);
+            fixed(1, reserved, 0);
+            xf(4, sequence_id_15_18, sequence_id[1], 0, MAX_UINT_BITS(4), 0);
+            fixed(1, emulation_3, 1);
+            xf(15, sequence_id_19_33, sequence_id[2], 0, MAX_UINT_BITS(15), 0);
+            fixed(1, emulation_4, 1);
+            xf(15, sequence_id_34_48, sequence_id[3], 0, MAX_UINT_BITS(15), 0);
+            fixed(1, emulation_5, 1);
+            xf(15, sequence_id_49_63, sequence_id[4], 0, MAX_UINT_BITS(15), 0);
+#ifdef READ
+            current->bit_position = (uint64_t) sequence_id[0]        |
+                                    (uint64_t) sequence_id[1] << 15  |
+                                    (uint64_t) sequence_id[2] << 19  |
+                                    (uint64_t) sequence_id[3] << 34  |
+                                    (uint64_t) sequence_id[4] << 49;
+#endif
+        }
     }
     else if (is_dash_if)
     {
         HEADER("Watermarking Info (DASH-IF Format)");
-        fixed(8, version, 1);
+        fc(8, version, 1, 1);
         fb(8, bit_value);
         fixed(1, emulation_1, 1);
         fb(15, bit_position);
@@ -1705,7 +1705,14 @@ int ff_decode_frame_props(AVCodecContext *avctx, AVFrame *frame)
         { AV_PKT_DATA_MASTERING_DISPLAY_METADATA, AV_FRAME_DATA_MASTERING_DISPLAY_METADATA },
         { AV_PKT_DATA_CONTENT_LIGHT_LEVEL,        AV_FRAME_DATA_CONTENT_LIGHT_LEVEL },
         { AV_PKT_DATA_A53_CC,                     AV_FRAME_DATA_A53_CC },
+        { AV_PKT_IRDETO_SEI_PAYLOAD,              AV_FRAME_DATA_IR_SEI_PAYLOAD },
     };
+    int nb_sd = FF_ARRAY_ELEMS(sd);
+
+    /* the Irdeto payload, last in the list, would otherwise end up on frames
+     * that get watermarked again */
+    if (!(avctx->flags2 & AV_CODEC_FLAG2_EXPORT_IR_SEI))
+        nb_sd--;
 
     if (pkt) {
         frame->pts = pkt->pts;
@@ -1718,7 +1725,7 @@ FF_ENABLE_DEPRECATION_WARNINGS
         frame->pkt_duration = pkt->duration;
         frame->pkt_size     = pkt->size;
 
-        for (i = 0; i < FF_ARRAY_ELEMS(sd); i++) {
+        for (i = 0; i < nb_sd; i++) {
             int size;
             uint8_t *packet_sd = av_packet_get_side_data(pkt, sd[i].packet, &size);
             if (packet_sd) {
@@ -256,6 +256,52 @@ end:
     return ret;
 }
 
+/**
+********************************************************************************
+* @brief  Latch Irdeto initial epoch time from the input frame
+********************************************************************************
+*/
+static void ir_epoch_from_frame(AVCodecContext *avctx, const AVFrame *frame)
+{
+    AVCodecInternal *avci = avctx->internal;
+    AVFrameSideData *sd;
+
+    if (!frame)
+        return;
+
+    sd = av_frame_get_side_data(frame, AV_FRAME_DATA_IR_EPOCH_TIME);
+    if (!sd || sd->size < sizeof(AVIrdetoEpoch))
+        return;
+
+    if (memcmp(&avci->ir_epoch, sd->data, sizeof(AVIrdetoEpoch))) {
+        memcpy(&avci->ir_epoch, sd->data, sizeof(AVIrdetoEpoch));
+        avci->ir_epoch_pending = 1;
+    }
+}
+
+/**
+********************************************************************************
+* @brief  Forward Irdeto initial epoch time to the output packet once
+********************************************************************************
+*/
+static int ir_epoch_to_packet(AVCodecContext *avctx, AVPacket *avpkt, int got_packet)
+{
+    AVCodecInternal *avci = avctx->internal;
+    uint8_t *sd;
+
+    if (!avci->ir_epoch_pending || !got_packet)
+        return 0;
+
+    sd = av_packet_new_side_data(avpkt, AV_PKT_IRDETO_EPOCH_TIME, sizeof(AVIrdetoEpoch));
+    if (!sd)
+        return AVERROR(ENOMEM);
+
+    memcpy(sd, &avci->ir_epoch, sizeof(AVIrdetoEpoch));
+    avci->ir_epoch_pending = 0;
+
+    return 0;
+}
+
 int attribute_align_arg avcodec_encode_video2(AVCodecContext *avctx,
                                               AVPacket *avpkt,
                                               const AVFrame *frame,
@@ -267,14 +313,20 @@ int attribute_align_arg avcodec_encode_video2(AVCodecContext *avctx,
 
     *got_packet_ptr = 0;
 
+    ir_epoch_from_frame(avctx, frame);
+
     if (!avctx->codec->encode2) {
         av_log(avctx, AV_LOG_ERROR, "This encoder requires using the avcodec_send_frame() API.\n");
         return AVERROR(ENOSYS);
     }
 
     if(CONFIG_FRAME_THREAD_ENCODER &&
-       avctx->internal->frame_thread_encoder && (avctx->active_thread_type&FF_THREAD_FRAME))
-        return ff_thread_video_encode_frame(avctx, avpkt, frame, got_packet_ptr);
+       avctx->internal->frame_thread_encoder && (avctx->active_thread_type&FF_THREAD_FRAME)) {
+        ret = ff_thread_video_encode_frame(avctx, avpkt, frame, got_packet_ptr);
+        if (ret >= 0)
+            ret = ir_epoch_to_packet(avctx, avpkt, *got_packet_ptr);
+        return ret;
+    }
 
     if ((avctx->flags&AV_CODEC_FLAG_PASS1) && avctx->stats_out)
         avctx->stats_out[0] = '\0';
@@ -332,6 +384,9 @@ int attribute_align_arg avcodec_encode_video2(AVCodecContext *avctx,
 
         if (frame)
             avctx->frame_number++;
+
+        if (!ret)
+            ret = ir_epoch_to_packet(avctx, avpkt, *got_packet_ptr);
     }
 
     if (ret < 0 || !*got_packet_ptr)
@@ -28,6 +28,7 @@
 
 #include "libavutil/buffer.h"
 #include "libavutil/channel_layout.h"
+#include "libavutil/ir_wm_info.h"
 #include "libavutil/mathematics.h"
 #include "libavutil/pixfmt.h"
 #include "avcodec.h"
@@ -218,6 +219,13 @@ typedef struct AVCodecInternal {
 
     /* to prevent infinite loop on errors when draining */
     int nb_draining_errors;
+
+    /**
+     * Irdeto initial epoch time taken from AV_FRAME_DATA_IR_EPOCH_TIME,
+     * it is forwarded as AV_PKT_IRDETO_EPOCH_TIME with the next output packet.
+     */
+    AVIrdetoEpoch ir_epoch;
+    int ir_epoch_pending;
 } AVCodecInternal;
 
 struct AVCodecDefault {
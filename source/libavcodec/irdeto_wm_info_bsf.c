@@ -0,0 +1,486 @@
+/*
+ * Copyright (c) 2023 Irdeto B.V.
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Insert/update Irdeto watermark info (V2/V3/DASH-IF user data unregistered
+ * SEI for H.264/H.265, WM_INFO metadata OBU for AV1) at packet level.
+ *
+ * The payload is taken from AV_PKT_IRDETO_SEI_PAYLOAD packet side data or,
+ * when sei_type is set, generated from the packet timestamps. Packets which
+ * do not get a payload are passed through untouched.
+ */
+
+#include "libavutil/common.h"
+#include "libavutil/ir_wm_info.h"
+#include "libavutil/opt.h"
+
+#include "av1.h"
+#include "bsf.h"
+#include "cbs.h"
+#include "cbs_av1.h"
+#include "cbs_h264.h"
+#include "cbs_h265.h"
+#include "h264.h"
+#include "h264_sei.h"
+#include "hevc.h"
+#include "hevc_sei.h"
+
+#define WM_INFO_MAX_PAYLOAD_SIZE 64
+
+typedef struct IrdetoWmInfoContext {
+    const AVClass *class;
+
+    CodedBitstreamContext *cbc;
+    CodedBitstreamFragment access_unit;
+
+    int sei_type;
+    int variant;
+    int bitlen;
+    int wmtime;
+    int keyframes;
+
+    int64_t epoch_time;
+    int64_t pts_initial;        ///< first pts (in ms), start of the MSN count
+    int64_t sequence_id;
+
+    uint8_t payload[WM_INFO_MAX_PAYLOAD_SIZE];
+    size_t  payload_size;
+} IrdetoWmInfoContext;
+
+// Only the units that are looked at or that the SEI syntax depends on are
+// decomposed, slices and frames are passed through as they are
+static const CodedBitstreamUnitType wm_info_decompose_h264[] = {
+    H264_NAL_SPS, H264_NAL_PPS, H264_NAL_SEI,
+};
+
+static const CodedBitstreamUnitType wm_info_decompose_h265[] = {
+    HEVC_NAL_VPS, HEVC_NAL_SPS, HEVC_NAL_PPS, HEVC_NAL_SEI_PREFIX,
+};
+
+static const CodedBitstreamUnitType wm_info_decompose_av1[] = {
+    AV1_OBU_TEMPORAL_DELIMITER, AV1_OBU_SEQUENCE_HEADER, AV1_OBU_METADATA,
+};
+
+static int is_wm_info_payload(const uint8_t *data, size_t size)
+{
+    return av_wm_info_parse_sei(data, size, NULL, NULL) >= 0;
+}
+
+/**
+********************************************************************************
+* @brief  Pick the WM info payload for the packet: side data first, then
+*         payload generated from the timestamps when the sequence changes
+* @note   Returns the payload, NULL if nothing has to be inserted
+********************************************************************************
+*/
+static const uint8_t *wm_info_get_payload(AVBSFContext *bsf, const AVPacket *pkt, size_t *size)
+{
+    IrdetoWmInfoContext *ctx = bsf->priv_data;
+    AVIrdetoWatermark wm_info = { 0 };
+    uint8_t *sd;
+    int sd_size, ret;
+    int64_t pts, sequence_id;
+
+    sd = av_packet_get_side_data(pkt, AV_PKT_IRDETO_EPOCH_TIME, &sd_size);
+    if (sd && sd_size >= sizeof(AVIrdetoEpoch))
+        ctx->epoch_time = ((const AVIrdetoEpoch *)sd)->epoch_time;
+
+    sd = av_packet_get_side_data(pkt, AV_PKT_IRDETO_SEI_PAYLOAD, &sd_size);
+    if (sd && sd_size > 16) {
+        *size = sd_size;
+        return sd;
+    }
+
+    if (ctx->sei_type == AV_WM_SEI_NONE || ctx->wmtime <= 0 || pkt->pts == AV_NOPTS_VALUE)
+        return NULL;
+
+    // The same Media Sequence Number as the WM filter and the segmenters
+    pts = av_rescale_q(pkt->pts, bsf->time_base_in, (AVRational){ 1, 1000 });
+    if (ctx->pts_initial == AV_NOPTS_VALUE)
+        ctx->pts_initial = pts;
+    sequence_id = av_wm_info_get_msn(ctx->epoch_time, pts - ctx->pts_initial, ctx->wmtime);
+
+    if (sequence_id == ctx->sequence_id &&
+        !(ctx->keyframes && (pkt->flags & AV_PKT_FLAG_KEY)))
+        return NULL;
+
+    if (sequence_id != ctx->sequence_id) {
+        wm_info.bitlen      = ctx->bitlen;
+        wm_info.bitval      = ctx->variant;
+        wm_info.bitpos      = sequence_id;
+        wm_info.watermarked = 1;
+
+        // V2 and DASH-IF carry the TMID bit position rather than the sequence
+        if (ctx->sei_type != AV_WM_SEI_IRDETO_V3 && ctx->bitlen > 0)
+            wm_info.bitpos %= ctx->bitlen;
+
+        ctx->payload_size = sizeof(ctx->payload);
+        ret = av_wm_info_alloc_sei(&wm_info, ctx->sei_type, ctx->payload, &ctx->payload_size);
+        if (ret < 0) {
+            av_log(bsf, AV_LOG_WARNING, "Failed to generate WM info payload.\n");
+            ctx->payload_size = 0;
+            return NULL;
+        }
+
+        ctx->sequence_id = sequence_id;
+    }
+
+    *size = ctx->payload_size;
+    return ctx->payload_size ? ctx->payload : NULL;
+}
+
+static int wm_info_update_h264(AVBSFContext *bsf, CodedBitstreamFragment *au,
+                               const uint8_t *data, size_t size)
+{
+    IrdetoWmInfoContext *ctx = bsf->priv_data;
+    H264RawSEIPayload payload = {
+        .payload_type = H264_SEI_TYPE_USER_DATA_UNREGISTERED,
+    };
+    H264RawSEIUserDataUnregistered *udu = &payload.payload.user_data_unregistered;
+    int err, i, j;
+
+    // Drop WM info already present in the access unit
+    for (i = 0; i < au->nb_units; i++) {
+        H264RawSEI *sei;
+        if (au->units[i].type != H264_NAL_SEI)
+            continue;
+        sei = au->units[i].content;
+
+        for (j = 0; j < sei->payload_count; j++) {
+            H264RawSEIUserDataUnregistered *old;
+            uint8_t buf[WM_INFO_MAX_PAYLOAD_SIZE];
+            size_t len;
+
+            if (sei->payload[j].payload_type != H264_SEI_TYPE_USER_DATA_UNREGISTERED)
+                continue;
+            old = &sei->payload[j].payload.user_data_unregistered;
+
+            // cbs keeps the uuid apart from the body, glue them back for parsing
+            len = FFMIN(old->data_length, sizeof(buf) - 16);
+            memcpy(buf, old->uuid_iso_iec_11578, 16);
+            if (len)
+                memcpy(buf + 16, old->data, len);
+            if (!is_wm_info_payload(buf, 16 + len))
+                continue;
+
+            err = ff_cbs_h264_delete_sei_message(ctx->cbc, au, &au->units[i], j);
+            if (err < 0)
+                return err;
+            // Renumbering might have happened, start again at
+            // the same NAL unit position.
+            --i;
+            break;
+        }
+    }
+
+    memcpy(udu->uuid_iso_iec_11578, data, 16);
+    udu->data        = (uint8_t *)data + 16;
+    udu->data_length = size - 16;
+
+    return ff_cbs_h264_add_sei_message(ctx->cbc, au, &payload);
+}
+
+static int wm_info_update_h265(AVBSFContext *bsf, CodedBitstreamFragment *au,
+                               const uint8_t *data, size_t size, H265RawSEI *sei)
+{
+    IrdetoWmInfoContext *ctx = bsf->priv_data;
+    int err, i, j;
+
+    // Drop WM info already present in the access unit
+    for (i = 0; i < au->nb_units; i++) {
+        H265RawSEI *old;
+        if (au->units[i].type != HEVC_NAL_SEI_PREFIX)
+            continue;
+        old = au->units[i].content;
+
+        for (j = 0; j < old->payload_count; j++) {
+            H265RawSEIPayload *p = &old->payload[j];
+
+            if (p->payload_type != HEVC_SEI_TYPE_USER_DATA_UNREGISTERED ||
+                !is_wm_info_payload(p->payload.other.data, p->payload.other.data_length))
+                continue;
+
+            if (old->payload_count == 1) {
+                err = ff_cbs_delete_unit(ctx->cbc, au, i);
+                if (err < 0)
+                    return err;
+                --i;
+                break;
+            }
+
+            av_buffer_unref(&p->payload.other.data_ref);
+            --old->payload_count;
+            memmove(old->payload + j, old->payload + j + 1,
+                    (old->payload_count - j) * sizeof(*old->payload));
+            --j;
+        }
+    }
+
+    // Prefix SEI goes after the parameter sets, before the first VCL NAL unit
+    for (i = 0; i < au->nb_units; i++) {
+        if (au->units[i].type <= HEVC_NAL_RSV_VCL31)
+            break;
+    }
+
+    *sei = (H265RawSEI) {
+        .nal_unit_header = {
+            .nal_unit_type         = HEVC_NAL_SEI_PREFIX,
+            .nuh_layer_id          = 0,
+            .nuh_temporal_id_plus1 = 1,
+        },
+        .payload[0] = {
+            .payload_type = HEVC_SEI_TYPE_USER_DATA_UNREGISTERED,
+            .payload_size = size,
+            .payload.other = {
+                .data        = (uint8_t *)data,
+                .data_length = size,
+            },
+        },
+        .payload_count = 1,
+    };
+
+    return ff_cbs_insert_unit_content(ctx->cbc, au, i, HEVC_NAL_SEI_PREFIX, sei, NULL);
+}
+
+static int wm_info_update_av1(AVBSFContext *bsf, CodedBitstreamFragment *frag,
+                              const uint8_t *data, size_t size, AV1RawOBU *obu)
+{
+    IrdetoWmInfoContext *ctx = bsf->priv_data;
+    AVIrdetoWatermark wm_info;
+    AVIrdetoSeiType type;
+    AV1RawMetadataWmInfo *wm;
+    int err, i;
+
+    err = av_wm_info_parse_sei(data, size, &wm_info, &type);
+    if (err < 0) {
+        av_log(bsf, AV_LOG_WARNING, "Unsupported WM info payload for AV1, skipped.\n");
+        return 0;
+    }
+
+    // Drop WM info already present in the temporal unit
+    for (i = 0; i < frag->nb_units; i++) {
+        AV1RawOBU *old = frag->units[i].content;
+        if (frag->units[i].type != AV1_OBU_METADATA ||
+            old->obu.metadata.metadata_type != AV1_METADATA_TYPE_WM_INFO)
+            continue;
+
+        err = ff_cbs_delete_unit(ctx->cbc, frag, i);
+        if (err < 0)
+            return err;
+        --i;
+    }
+
+    // Metadata goes after the temporal delimiter and sequence header
+    for (i = 0; i < frag->nb_units; i++) {
+        if (frag->units[i].type != AV1_OBU_TEMPORAL_DELIMITER &&
+            frag->units[i].type != AV1_OBU_SEQUENCE_HEADER)
+            break;
+    }
+
+    *obu = (AV1RawOBU) {
+        .header = {
+            .obu_type           = AV1_OBU_METADATA,
+            .obu_has_size_field = 1,
+        },
+        .obu.metadata.metadata_type = AV1_METADATA_TYPE_WM_INFO,
+    };
+
+    wm = &obu->obu.metadata.metadata.wm_info;
+    memcpy(wm->uuid, data, 16);
+    wm->version            = data[16];
+    wm->tmid_length_div128 = wm_info.bitlen / 128;
+    wm->bit_value          = wm_info.bitval;
+    wm->bit_position       = wm_info.bitpos;
+
+    return ff_cbs_insert_unit_content(ctx->cbc, frag, i, AV1_OBU_METADATA, obu, NULL);
+}
+
+static int irdeto_wm_info_filter(AVBSFContext *bsf, AVPacket *out)
+{
+    IrdetoWmInfoContext *ctx = bsf->priv_data;
+    CodedBitstreamFragment *frag = &ctx->access_unit;
+    AVPacket *in = NULL;
+    const uint8_t *payload;
+    size_t payload_size = 0;
+    H265RawSEI h265_sei;
+    AV1RawOBU av1_obu;
+    int err;
+
+    err = ff_bsf_get_packet(bsf, &in);
+    if (err < 0)
+        return err;
+
+    payload = wm_info_get_payload(bsf, in, &payload_size);
+    if (!payload) {
+        av_packet_move_ref(out, in);
+        av_packet_free(&in);
+        return 0;
+    }
+
+    err = ff_cbs_read_packet(ctx->cbc, frag, in);
+    if (err < 0) {
+        av_log(bsf, AV_LOG_ERROR, "Failed to read packet.\n");
+        goto fail;
+    }
+
+    switch (bsf->par_in->codec_id) {
+    case AV_CODEC_ID_H264:
+        err = wm_info_update_h264(bsf, frag, payload, payload_size);
+        break;
+    case AV_CODEC_ID_HEVC:
+        err = wm_info_update_h265(bsf, frag, payload, payload_size, &h265_sei);
+        break;
+    case AV_CODEC_ID_AV1:
+        err = wm_info_update_av1(bsf, frag, payload, payload_size, &av1_obu);
+        break;
+    default:
+        err = AVERROR_BUG;
+        break;
+    }
+    if (err < 0) {
+        av_log(bsf, AV_LOG_ERROR, "Failed to insert WM info.\n");
+        goto fail;
+    }
+
+    err = ff_cbs_write_packet(ctx->cbc, out, frag);
+    if (err < 0) {
+        av_log(bsf, AV_LOG_ERROR, "Failed to write packet.\n");
+        goto fail;
+    }
+
+    err = av_packet_copy_props(out, in);
+    if (err < 0)
+        goto fail;
+
+    err = 0;
+fail:
+    ff_cbs_fragment_uninit(ctx->cbc, frag);
+
+    if (err < 0)
+        av_packet_unref(out);
+    av_packet_free(&in);
+
+    return err;
+}
+
+static int irdeto_wm_info_init(AVBSFContext *bsf)
+{
+    IrdetoWmInfoContext *ctx = bsf->priv_data;
+    CodedBitstreamFragment *frag = &ctx->access_unit;
+    int err;
+
+    ctx->epoch_time  = -1;
+    ctx->pts_initial = AV_NOPTS_VALUE;
+    ctx->sequence_id = -1;
+
+    if (ctx->sei_type == AV_WM_SEI_IRDETO_V3 &&
+        (ctx->bitlen < 128 || ctx->bitlen > 8192 || ctx->bitlen % 128)) {
+        av_log(bsf, AV_LOG_ERROR, "Irdeto V3 requires bitlen to be a multiple "
+               "of 128 in range [128, 8192].\n");
+        return AVERROR(EINVAL);
+    }
+
+    err = ff_cbs_init(&ctx->cbc, bsf->par_in->codec_id, bsf);
+    if (err < 0)
+        return err;
+
+    switch (bsf->par_in->codec_id) {
+    case AV_CODEC_ID_H264:
+        ctx->cbc->decompose_unit_types    = (CodedBitstreamUnitType *)wm_info_decompose_h264;
+        ctx->cbc->nb_decompose_unit_types = FF_ARRAY_ELEMS(wm_info_decompose_h264);
+        break;
+    case AV_CODEC_ID_HEVC:
+        ctx->cbc->decompose_unit_types    = (CodedBitstreamUnitType *)wm_info_decompose_h265;
+        ctx->cbc->nb_decompose_unit_types = FF_ARRAY_ELEMS(wm_info_decompose_h265);
+        break;
+    case AV_CODEC_ID_AV1:
+        ctx->cbc->decompose_unit_types    = (CodedBitstreamUnitType *)wm_info_decompose_av1;
+        ctx->cbc->nb_decompose_unit_types = FF_ARRAY_ELEMS(wm_info_decompose_av1);
+        break;
+    }
+
+    if (bsf->par_in->extradata) {
+        err = ff_cbs_read_extradata(ctx->cbc, frag, bsf->par_in);
+        if (err < 0)
+            av_log(bsf, AV_LOG_ERROR, "Failed to read extradata.\n");
+    }
+
+    ff_cbs_fragment_uninit(ctx->cbc, frag);
+    return err;
+}
+
+static void irdeto_wm_info_close(AVBSFContext *bsf)
+{
+    IrdetoWmInfoContext *ctx = bsf->priv_data;
+    ff_cbs_close(&ctx->cbc);
+}
+
+#define OFFSET(x) offsetof(IrdetoWmInfoContext, x)
+#define FLAGS (AV_OPT_FLAG_VIDEO_PARAM|AV_OPT_FLAG_BSF_PARAM)
+static const AVOption irdeto_wm_info_options[] = {
+    { "sei_type", "Generate WM info of this format when no side data is attached",
+        OFFSET(sei_type), AV_OPT_TYPE_INT,
+        { .i64 = AV_WM_SEI_NONE }, AV_WM_SEI_NONE, AV_WM_SEI_DASH_IF, FLAGS, "sei_type" },
+    { "none",      NULL, 0, AV_OPT_TYPE_CONST,
+        { .i64 = AV_WM_SEI_NONE      }, .flags = FLAGS, .unit = "sei_type" },
+    { "irdeto_v2", NULL, 0, AV_OPT_TYPE_CONST,
+        { .i64 = AV_WM_SEI_IRDETO_V2 }, .flags = FLAGS, .unit = "sei_type" },
+    { "irdeto_v3", NULL, 0, AV_OPT_TYPE_CONST,
+        { .i64 = AV_WM_SEI_IRDETO_V3 }, .flags = FLAGS, .unit = "sei_type" },
+    { "dash_if",   NULL, 0, AV_OPT_TYPE_CONST,
+        { .i64 = AV_WM_SEI_DASH_IF   }, .flags = FLAGS, .unit = "sei_type" },
+
+    { "variant", "Variant (bit value) of the stream",
+        OFFSET(variant), AV_OPT_TYPE_INT,
+        { .i64 = 0 }, 0, 255, FLAGS },
+    { "bitlen", "TMID length (in bits)",
+        OFFSET(bitlen), AV_OPT_TYPE_INT,
+        { .i64 = 0 }, 0, 8192, FLAGS },
+    { "wmtime", "WM segment duration (in ms)",
+        OFFSET(wmtime), AV_OPT_TYPE_INT,
+        { .i64 = 0 }, 0, INT_MAX, FLAGS },
+    { "keyframes", "Repeat generated WM info on every keyframe",
+        OFFSET(keyframes), AV_OPT_TYPE_BOOL,
+        { .i64 = 0 }, 0, 1, FLAGS },
+
+    { NULL }
+};
+
+static const AVClass irdeto_wm_info_class = {
+    .class_name = "irdeto_wm_info_bsf",
+    .item_name  = av_default_item_name,
+    .option     = irdeto_wm_info_options,
+    .version    = LIBAVUTIL_VERSION_INT,
+};
+
+static const enum AVCodecID irdeto_wm_info_codec_ids[] = {
+    AV_CODEC_ID_H264, AV_CODEC_ID_HEVC, AV_CODEC_ID_AV1, AV_CODEC_ID_NONE,
+};
+
+const AVBitStreamFilter ff_irdeto_wm_info_bsf = {
+    .name           = "irdeto_wm_info",
+    .priv_data_size = sizeof(IrdetoWmInfoContext),
+    .priv_class     = &irdeto_wm_info_class,
+    .init           = &irdeto_wm_info_init,
+    .close          = &irdeto_wm_info_close,
+    .filter         = &irdeto_wm_info_filter,
+    .codec_ids      = irdeto_wm_info_codec_ids,
+};
@@ -26,17 +26,74 @@
 #include <aom/aom_decoder.h>
 #include <aom/aomdx.h>
 
+#include "libavutil/buffer.h"
 #include "libavutil/common.h"
 #include "libavutil/imgutils.h"
+#include "libavutil/ir_wm_info.h"
+#include "libavutil/opt.h"
 
+#include "av1.h"
 #include "avcodec.h"
+#include "cbs.h"
+#include "cbs_av1.h"
 #include "internal.h"
 #include "profiles.h"
 
+#include <irxps/ir_xps_export_av1.h>
+
 typedef struct AV1DecodeContext {
+    const AVClass *class;
     struct aom_codec_ctx decoder;
+    AVBufferPool *pool;
+    size_t pool_size;
+
+    int enable_irdeto_exports;
+    CodedBitstreamContext *cbc;
+    CodedBitstreamFragment td;
 } AV1DecodeContext;
 
+static const CodedBitstreamUnitType xps_decompose_unit_types[] = {
+    AV1_OBU_SEQUENCE_HEADER,
+    AV1_OBU_FRAME_HEADER,
+    AV1_OBU_FRAME,
+    AV1_OBU_REDUNDANT_FRAME_HEADER,
+};
+
+static int get_frame_buffer(void *priv, size_t min_size, aom_codec_frame_buffer_t *fb)
+{
+    AV1DecodeContext *ctx = priv;
+    AVBufferRef *buf;
+
+    if (min_size > ctx->pool_size) {
+        av_buffer_pool_uninit(&ctx->pool);
+        /* According to the libaom docs the buffer must be zeroed out. That is
+         * done on allocation only, reused buffers hold what libaom wrote. */
+        ctx->pool = av_buffer_pool_init(min_size, av_buffer_allocz);
+        if (!ctx->pool) {
+            ctx->pool_size = 0;
+            return AVERROR(ENOMEM);
+        }
+        ctx->pool_size = min_size;
+    }
+
+    buf = av_buffer_pool_get(ctx->pool);
+    if (!buf)
+        return AVERROR(ENOMEM);
+
+    fb->priv = buf;
+    fb->size = ctx->pool_size;
+    fb->data = buf->data;
+
+    return 0;
+}
+
+static int release_frame_buffer(void *priv, aom_codec_frame_buffer_t *fb)
+{
+    AVBufferRef *buf = fb->priv;
+    av_buffer_unref(&buf);
+    return 0;
+}
+
 static av_cold int aom_init(AVCodecContext *avctx,
                             const struct aom_codec_iface *iface)
 {
@@ -55,9 +112,36 @@ static av_cold int aom_init(AVCodecContext *avctx,
         return AVERROR(EINVAL);
     }
 
+    /* Let libaom decode into pooled buffers that can be handed out without
+     * a copy, like libvpxdec the frames do not come from get_buffer2(). */
+    if (aom_codec_set_frame_buffer_functions(&ctx->decoder, get_frame_buffer,
+                                             release_frame_buffer, ctx) != AOM_CODEC_OK)
+        av_log(avctx, AV_LOG_WARNING, "Failed to set frame buffer functions: %s\n",
+               aom_codec_error(&ctx->decoder));
+
+    if (ctx->enable_irdeto_exports) {
+        int ret = ff_cbs_init(&ctx->cbc, AV_CODEC_ID_AV1, avctx);
+        if (ret < 0)
+            return ret;
+        /* only the headers are needed, tile data is left alone */
+        ctx->cbc->decompose_unit_types    = (CodedBitstreamUnitType *)xps_decompose_unit_types;
+        ctx->cbc->nb_decompose_unit_types = FF_ARRAY_ELEMS(xps_decompose_unit_types);
+    }
+
     return 0;
 }
 
+static void copy_row_16_to_8(uint8_t *av_restrict dst,
+                             const uint16_t *av_restrict src, int w)
+{
+    int x;
+
+    /* non-aliasing pointers and a counted loop, so the compiler narrows
+     * a full vector per iteration */
+    for (x = 0; x < w; x++)
+        dst[x] = src[x];
+}
+
 static void image_copy_16_to_8(AVFrame *pic, struct aom_image *img)
 {
     const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(pic->format);
@@ -66,19 +150,247 @@ static void image_copy_16_to_8(AVFrame *pic, struct aom_image *img)
     for (i = 0; i < desc->nb_components; i++) {
         int w = img->d_w;
         int h = img->d_h;
-        int x, y;
+        int y;
 
         if (i) {
             w = (w + img->x_chroma_shift) >> img->x_chroma_shift;
             h = (h + img->y_chroma_shift) >> img->y_chroma_shift;
         }
 
-        for (y = 0; y < h; y++) {
-            uint16_t *src = (uint16_t *)(img->planes[i] + y * img->stride[i]);
-            uint8_t *dst = pic->data[i] + y * pic->linesize[i];
-            for (x = 0; x < w; x++)
-                *dst++ = *src++;
+        for (y = 0; y < h; y++)
+            copy_row_16_to_8(pic->data[i] + y * pic->linesize[i],
+                             (const uint16_t *)(img->planes[i] + y * img->stride[i]), w);
+    }
+}
+
+/**
+ * Reference the pool buffer img was decoded into instead of copying it.
+ * Returns 1 on success, 0 if the image does not live in one of our buffers
+ * (e.g. film grain was applied into a libaom internal image) and a negative
+ * error code on failure.
+ */
+static int wrap_image(AVCodecContext *avctx, AVFrame *picture,
+                      struct aom_image *img)
+{
+    AVBufferRef *buf = img->fb_priv;
+    int i, nb_planes = av_pix_fmt_count_planes(avctx->pix_fmt);
+    int ret;
+
+    if (!buf || ((img->fmt & AOM_IMG_FMT_HIGHBITDEPTH) && img->bit_depth == 8))
+        return 0;
+    for (i = 0; i < nb_planes; i++)
+        if (img->planes[i] < buf->data || img->planes[i] >= buf->data + buf->size)
+            return 0;
+
+    picture->buf[0] = av_buffer_ref(buf);
+    if (!picture->buf[0])
+        return AVERROR(ENOMEM);
+    for (i = 0; i < nb_planes; i++) {
+        picture->data[i]     = img->planes[i];
+        picture->linesize[i] = img->stride[i];
+    }
+    picture->width  = avctx->width;
+    picture->height = avctx->height;
+    picture->format = avctx->pix_fmt;
+
+    if ((ret = ff_decode_frame_props(avctx, picture)) < 0)
+        return ret;
+
+    return 1;
+}
+
+/**
+ * Attach the Irdeto WM info metadata libaom parsed for img, unless the
+ * payload already came with the packet side data.
+ */
+static int export_wm_info(AVFrame *picture, struct aom_image *img)
+{
+    size_t i;
+
+    if (av_frame_get_side_data(picture, AV_FRAME_DATA_IR_SEI_PAYLOAD))
+        return 0;
+
+    for (i = 0; i < aom_img_num_metadata(img); i++) {
+        const aom_metadata_t *md = aom_img_get_metadata(img, i);
+        AVFrameSideData *sd;
+
+        if (!md || md->type != AV1_METADATA_TYPE_WM_INFO ||
+            av_wm_info_parse_sei(md->payload, md->sz, NULL, NULL) < 0)
+            continue;
+
+        sd = av_frame_new_side_data(picture, AV_FRAME_DATA_IR_SEI_PAYLOAD, md->sz);
+        if (!sd)
+            return AVERROR(ENOMEM);
+        memcpy(sd->data, md->payload, md->sz);
+        break;
+    }
+
+    return 0;
+}
+
+/**
+ * Copy the reference buffer in slot of the decoder into ref_frame[k] of the
+ * export context. A missing reference is not an error, it is left empty.
+ */
+static int xps_export_ref(AVCodecContext *avctx, ir_xps_context *xps,
+                          int k, int slot)
+{
+    AV1DecodeContext *ctx = avctx->priv_data;
+    av1_ref_frame_t ref   = { .idx = slot };
+    AVFrame *dst;
+    int ret;
+
+    if (k > 0 && slot == xps->av1_meta.ref_slot[0] && xps->ref_frame[0].avframe) {
+        dst = av_frame_clone(xps->ref_frame[0].avframe);
+        if (!dst)
+            return AVERROR(ENOMEM);
+        goto done;
+    }
+
+    if (avctx->pix_fmt == AV_PIX_FMT_NONE ||
+        aom_codec_control(&ctx->decoder, AV1_GET_REFERENCE, &ref) != AOM_CODEC_OK) {
+        av_log(avctx, AV_LOG_WARNING, "Reference slot %d not available for export\n", slot);
+        return 0;
+    }
+
+    dst = av_frame_alloc();
+    if (!dst)
+        return AVERROR(ENOMEM);
+    dst->format = avctx->pix_fmt;
+    dst->width  = ref.img.d_w;
+    dst->height = ref.img.d_h;
+    if ((ret = av_frame_get_buffer(dst, 32)) < 0) {
+        av_frame_free(&dst);
+        return ret;
+    }
+
+    if ((ref.img.fmt & AOM_IMG_FMT_HIGHBITDEPTH) && ref.img.bit_depth == 8) {
+        image_copy_16_to_8(dst, &ref.img);
+    } else {
+        const uint8_t *planes[4] = { ref.img.planes[0], ref.img.planes[1], ref.img.planes[2] };
+        const int      stride[4] = { ref.img.stride[0], ref.img.stride[1], ref.img.stride[2] };
+
+        av_image_copy(dst->data, dst->linesize, planes, stride,
+                      dst->format, dst->width, dst->height);
+    }
+
+done:
+    for (int i = 0; i < IRXPS_NUM_PLANES; i++)
+        xps->ref_frame[k].linesize[i] = dst->linesize[i];
+    xps->ref_frame[k].height = dst->height;
+    xps->ref_frame[k].avframe = dst;
+    return 0;
+}
+
+/**
+ * Export the headers of the frame coded in the temporal unit avpkt and the
+ * references it predicts from, as far as they are still in the decoder
+ * before avpkt is decoded. post_slots receives the reference slots which are
+ * overwritten earlier in the same temporal unit, to be exported once it is
+ * decoded.
+ */
+static ir_xps_context *xps_export(AVCodecContext *avctx, const AVPacket *avpkt,
+                                  int post_slots[IRXPS_NUM_REFS])
+{
+    AV1DecodeContext *ctx = avctx->priv_data;
+    CodedBitstreamFragment *td = &ctx->td;
+    const CodedBitstreamAV1Context *priv = ctx->cbc->priv_data;
+    const AV1RawFrameHeader *fh = NULL;
+    ir_xps_context *xps = NULL;
+    uint32_t order_hints[AV1_NUM_REF_FRAMES];
+    int earlier = 0, i, k, ret;
+
+    for (k = 0; k < IRXPS_NUM_REFS; k++)
+        post_slots[k] = -1;
+
+    /* the parser updates its reference state while reading the unit */
+    for (i = 0; i < AV1_NUM_REF_FRAMES; i++)
+        order_hints[i] = priv->ref[i].order_hint;
+
+    ret = ff_cbs_read_packet(ctx->cbc, td, avpkt);
+    if (ret < 0) {
+        av_log(avctx, AV_LOG_WARNING, "Failed to parse temporal unit for export\n");
+        goto end;
+    }
+
+    /* the last coded frame of the temporal unit is the one shown */
+    for (i = 0; i < td->nb_units; i++) {
+        const AV1RawOBU *obu = td->units[i].content;
+        const AV1RawFrameHeader *cur;
+
+        if (td->units[i].type == AV1_OBU_FRAME)
+            cur = &obu->obu.frame.header;
+        else if (td->units[i].type == AV1_OBU_FRAME_HEADER)
+            cur = &obu->obu.frame_header;
+        else
+            continue;
+        if (cur->show_existing_frame)
+            continue;
+        if (fh) {
+            earlier |= fh->refresh_frame_flags;
+            for (k = 0; k < AV1_NUM_REF_FRAMES; k++)
+                if (fh->refresh_frame_flags & (1 << k))
+                    order_hints[k] = fh->order_hint;
+        }
+        fh = cur;
+    }
+    if (!fh)
+        goto end;
+
+    xps = ir_xps_context_create();
+    if (!xps)
+        goto end;
+
+    if (ir_xps_export_aom(priv, fh, xps) != IR_XPS_EXPORT_STATUS_OK) {
+        av_log(avctx, AV_LOG_ERROR, "Failed to export metadata\n");
+        ir_xps_context_destroy(xps);
+        xps = NULL;
+        goto end;
+    }
+
+    for (k = 0; k < IRXPS_NUM_REFS; k++) {
+        int slot = xps->av1_meta.ref_slot[k];
+
+        if (slot < 0)
+            continue;
+        xps->av1_meta.ref_order_hint[k] = order_hints[slot];
+        if (!(earlier & (1 << slot))) {
+            if (xps_export_ref(avctx, xps, k, slot) < 0)
+                break;
+        } else if (!(fh->refresh_frame_flags & (1 << slot))) {
+            post_slots[k] = slot;
+        } else {
+            av_log(avctx, AV_LOG_WARNING, "Reference slot %d is overwritten "
+                   "within the temporal unit, not exported\n", slot);
+        }
+    }
+
+    xps->av1_meta.pkt = av_packet_clone(avpkt);
+
+end:
+    ff_cbs_fragment_uninit(ctx->cbc, td);
+    return xps;
+}
+
+/**
+ * Hand the export context out with the frame, the same way the native
+ * decoders do.
+ */
+static void xps_attach(AVCodecContext *avctx, AVFrame *frame, ir_xps_context *xps)
+{
+    if (avctx->opaque != NULL) {
+        ir_xps_context *ir = avctx->opaque;
+        if (IR_XPS_EXPORT_STATUS_OK != ir_xps_vc(ir)) {
+            frame->opaque = NULL;
+            ir_xps_context_destroy(xps);
+        } else {
+            /* the caller's context takes over what xps references */
+            frame->opaque = avctx->opaque;
+            memcpy(frame->opaque, xps, sizeof(ir_xps_context));
+            free(xps);
         }
+    } else {
+        frame->opaque = xps;
     }
 }
 
@@ -161,7 +473,12 @@ static int aom_decode(AVCodecContext *avctx, void *data, int *got_frame,
     AVFrame *picture      = data;
     const void *iter      = NULL;
     struct aom_image *img;
-    int ret;
+    ir_xps_context *xps   = NULL;
+    int post_slots[IRXPS_NUM_REFS];
+    int ret, wrapped, k;
+
+    if (ctx->enable_irdeto_exports)
+        xps = xps_export(avctx, avpkt, post_slots);
 
     if (aom_codec_decode(&ctx->decoder, avpkt->data, avpkt->size, NULL) !=
         AOM_CODEC_OK) {
@@ -172,20 +489,29 @@ static int aom_decode(AVCodecContext *avctx, void *data, int *got_frame,
         if (detail)
             av_log(avctx, AV_LOG_ERROR, "  Additional information: %s\n",
                    detail);
-        return AVERROR_INVALIDDATA;
+        ret = AVERROR_INVALIDDATA;
+        goto fail;
+    }
+
+    if (xps) {
+        for (k = 0; k < IRXPS_NUM_REFS; k++)
+            if (post_slots[k] >= 0 &&
+                (ret = xps_export_ref(avctx, xps, k, post_slots[k])) < 0)
+                goto fail;
     }
 
     if ((img = aom_codec_get_frame(&ctx->decoder, &iter))) {
         if (img->d_w > img->w || img->d_h > img->h) {
             av_log(avctx, AV_LOG_ERROR, "Display dimensions %dx%d exceed storage %dx%d\n",
                    img->d_w, img->d_h, img->w, img->h);
-            return AVERROR_EXTERNAL;
+            ret = AVERROR_EXTERNAL;
+            goto fail;
         }
 
         if ((ret = set_pix_fmt(avctx, img)) < 0) {
             av_log(avctx, AV_LOG_ERROR, "Unsupported output colorspace (%d) / bit_depth (%d)\n",
                    img->fmt, img->bit_depth);
-            return ret;
+            goto fail;
         }
 
         if ((int)img->d_w != avctx->width || (int)img->d_h != avctx->height) {
@@ -193,10 +519,12 @@ static int aom_decode(AVCodecContext *avctx, void *data, int *got_frame,
                    avctx->width, avctx->height, img->d_w, img->d_h);
             ret = ff_set_dimensions(avctx, img->d_w, img->d_h);
             if (ret < 0)
-                return ret;
+                goto fail;
         }
-        if ((ret = ff_get_buffer(avctx, picture, 0)) < 0)
-            return ret;
+        if ((ret = wrapped = wrap_image(avctx, picture, img)) < 0)
+            goto fail;
+        if (!wrapped && (ret = ff_get_buffer(avctx, picture, 0)) < 0)
+            goto fail;
 
 #ifdef AOM_CTRL_AOMD_GET_FRAME_FLAGS
         {
@@ -221,24 +549,41 @@ static int aom_decode(AVCodecContext *avctx, void *data, int *got_frame,
                   INT_MAX);
         ff_set_sar(avctx, picture->sample_aspect_ratio);
 
-        if ((img->fmt & AOM_IMG_FMT_HIGHBITDEPTH) && img->bit_depth == 8)
+        if ((avctx->flags2 & AV_CODEC_FLAG2_EXPORT_IR_SEI) &&
+            (ret = export_wm_info(picture, img)) < 0)
+            goto fail;
+
+        if (!wrapped && (img->fmt & AOM_IMG_FMT_HIGHBITDEPTH) && img->bit_depth == 8)
             image_copy_16_to_8(picture, img);
-        else {
+        else if (!wrapped) {
             const uint8_t *planes[4] = { img->planes[0], img->planes[1], img->planes[2] };
             const int      stride[4] = { img->stride[0], img->stride[1], img->stride[2] };
 
             av_image_copy(picture->data, picture->linesize, planes,
                           stride, avctx->pix_fmt, img->d_w, img->d_h);
         }
+
+        if (xps) {
+            xps_attach(avctx, picture, xps);
+            xps = NULL;
+        }
         *got_frame = 1;
     }
+    ir_xps_context_destroy(xps);
     return avpkt->size;
+
+fail:
+    ir_xps_context_destroy(xps);
+    return ret;
 }
 
 static av_cold int aom_free(AVCodecContext *avctx)
 {
     AV1DecodeContext *ctx = avctx->priv_data;
     aom_codec_destroy(&ctx->decoder);
+    av_buffer_pool_uninit(&ctx->pool);
+    ff_cbs_fragment_uninit(ctx->cbc, &ctx->td);
+    ff_cbs_close(&ctx->cbc);
     return 0;
 }
 
@@ -247,6 +592,20 @@ static av_cold int av1_init(AVCodecContext *avctx)
     return aom_init(avctx, aom_codec_av1_dx());
 }
 
+#define OFFSET(x) offsetof(AV1DecodeContext, x)
+#define VD AV_OPT_FLAG_VIDEO_PARAM | AV_OPT_FLAG_DECODING_PARAM
+static const AVOption options[] = {
+    { "irdeto_exports", "Enable irdeto exports through opaque field", OFFSET(enable_irdeto_exports), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, VD },
+    { NULL },
+};
+
+static const AVClass class_aom = {
+    .class_name = "libaom-av1 decoder",
+    .item_name  = av_default_item_name,
+    .option     = options,
+    .version    = LIBAVUTIL_VERSION_INT,
+};
+
 AVCodec ff_libaom_av1_decoder = {
     .name           = "libaom-av1",
     .long_name      = NULL_IF_CONFIG_SMALL("libaom AV1"),
@@ -258,5 +617,6 @@ AVCodec ff_libaom_av1_decoder = {
     .decode         = aom_decode,
     .capabilities   = AV_CODEC_CAP_AUTO_THREADS | AV_CODEC_CAP_DR1,
     .profiles       = NULL_IF_CONFIG_SMALL(ff_av1_profiles),
+    .priv_class     = &class_aom,
     .wrapper_name   = "libaom",
 };
@@ -27,18 +27,30 @@
 #include <aom/aom_encoder.h>
 #include <aom/aomcx.h>
 
+#include "config.h"
+
+#if HAVE_SYS_RESOURCE_H
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
 #include "libavutil/avassert.h"
 #include "libavutil/base64.h"
 #include "libavutil/common.h"
+#include "libavutil/cpu.h"
 #include "libavutil/mathematics.h"
 #include "libavutil/opt.h"
 #include "libavutil/pixdesc.h"
+#include "libavutil/time.h"
 
 #include "av1.h"
 #include "avcodec.h"
 #include "internal.h"
 #include "profiles.h"
 
+#include "irxps/ir_xps_common.h"
+#include "irxps/ir_xps_import_av1.h"
+
 /*
  * Extention for AV1 OBU metadata types defined as OBU_METADATA_TYPE enum
  * inside <aom/aom_codec.h> header file
@@ -132,8 +144,16 @@ typedef struct AOMEncoderContext {
     int enable_dist_wtd_comp;
     int enable_dual_filter;
     char *aom_params;
-    void *sei_payload;
+    uint8_t *sei_payload;       ///< WM info payload currently attached to rawimg
     int payload_size;
+    int wm_info_insert;         ///< aom_metadata_insert_flags_t of the WM info
+    int enable_irdeto_exports;
+    int auto_parallel;
+    int64_t enc_frames;         ///< encode calls timed for the auto-parallel report
+    int64_t enc_wall_us;
+    int64_t enc_cpu_us;
+    aom_codec_enc_cfg_t enccfg; ///< active configuration, updated by the irdeto import
+    ir_xps_import_aom_state irdeto_state; ///< reference buffers of the encoder
 } AOMContext;
 
 static const char *const ctlidstr[] = {
@@ -403,8 +423,14 @@ static av_cold int aom_free(AVCodecContext *avctx)
     }
 #endif
 
-    if (ctx->sei_payload) av_free(ctx->sei_payload);
-    ctx->sei_payload  = NULL;
+    if (ctx->auto_parallel && ctx->enc_frames && ctx->enc_wall_us)
+        av_log(avctx, AV_LOG_INFO, "%"PRId64" frames, %.2f ms per frame, "
+               "effective parallelism %.2f\n", ctx->enc_frames,
+               ctx->enc_wall_us / 1000.0 / ctx->enc_frames,
+               (double)ctx->enc_cpu_us / ctx->enc_wall_us);
+
+    aom_img_remove_metadata(&ctx->rawimg);
+    av_freep(&ctx->sei_payload);
     ctx->payload_size = 0;
 
     aom_codec_destroy(&ctx->encoder);
@@ -660,6 +686,59 @@ static int choose_tiling(AVCodecContext *avctx,
     return 0;
 }
 
+/**
+ * Derive the thread count, the tiling and row-mt from the frame size and
+ * the number of CPUs, leaving alone whatever the user set explicitly.
+ * One thread per 256x256 area is used at most, tiles are at least 256
+ * pixels wide and high and there are no more of them than threads.
+ */
+static av_cold void choose_parallelism(AVCodecContext *avctx,
+                                       aom_codec_enc_cfg_t *enccfg)
+{
+    AOMContext *ctx = avctx->priv_data;
+    int threads = avctx->thread_count;
+
+    if (!threads)
+        threads = FFMIN(av_cpu_count(),
+                        FFMAX(1, avctx->width * avctx->height / (256 * 256)));
+    threads = FFMIN(threads, 64);
+    enccfg->g_threads = threads;
+
+    if (!ctx->tile_cols && !ctx->tile_rows &&
+        ctx->tile_cols_log2 < 0 && ctx->tile_rows_log2 < 0) {
+        int cols_log2 = 0, rows_log2 = 0;
+
+        while (cols_log2 < 6 && (avctx->width >> (cols_log2 + 1)) >= 256 &&
+               (2 << cols_log2) <= threads)
+            cols_log2++;
+        while (rows_log2 < 6 && (avctx->height >> (rows_log2 + 1)) >= 256 &&
+               (2 << (cols_log2 + rows_log2)) <= threads)
+            rows_log2++;
+        ctx->tile_cols_log2 = cols_log2;
+        ctx->tile_rows_log2 = rows_log2;
+    }
+
+    if (ctx->row_mt < 0)
+        ctx->row_mt = threads > 1;
+
+    av_log(avctx, AV_LOG_VERBOSE, "auto-parallel: %d threads, "
+           "tile_cols_log2 %d, tile_rows_log2 %d, row-mt %d\n",
+           threads, ctx->tile_cols_log2, ctx->tile_rows_log2, ctx->row_mt);
+}
+
+static int64_t cpu_time_us(void)
+{
+#if HAVE_GETRUSAGE
+    struct rusage rusage;
+
+    getrusage(RUSAGE_SELF, &rusage);
+    return (rusage.ru_utime.tv_sec + rusage.ru_stime.tv_sec) * 1000000LL +
+           rusage.ru_utime.tv_usec + rusage.ru_stime.tv_usec;
+#else
+    return av_gettime_relative();
+#endif
+}
+
 static av_cold int aom_init(AVCodecContext *avctx,
                             const aom_codec_iface_t *iface)
 {
@@ -705,6 +784,8 @@ static av_cold int aom_init(AVCodecContext *avctx,
     enccfg.g_timebase.den = avctx->time_base.den;
     enccfg.g_threads      =
         FFMIN(avctx->thread_count ? avctx->thread_count : av_cpu_count(), 64);
+    if (ctx->auto_parallel)
+        choose_parallelism(avctx, &enccfg);
 
     if (ctx->lag_in_frames >= 0)
         enccfg.g_lag_in_frames = ctx->lag_in_frames;
@@ -830,6 +911,14 @@ static av_cold int aom_init(AVCodecContext *avctx,
     if (res < 0)
         return res;
 
+    if (ctx->enable_irdeto_exports) {
+        // Every frame is coded on its own against imported references, it
+        // must come out immediately and never turn into a key frame or an
+        // alternate reference by itself.
+        enccfg.g_lag_in_frames = 0;
+        enccfg.kf_mode = AOM_KF_DISABLED;
+    }
+
     if (ctx->still_picture) {
         // Set the maximum number of frames to 1. This will let libaom set
         // still_picture and reduced_still_picture_header to 1 in the Sequence
@@ -850,6 +939,8 @@ static av_cold int aom_init(AVCodecContext *avctx,
         return AVERROR(EINVAL);
     }
     dump_enc_cfg(avctx, &enccfg, AV_LOG_VERBOSE);
+    ctx->enccfg = enccfg;
+    ir_xps_import_init_aom(&ctx->irdeto_state);
 
     // codec control failures are currently treated only as warnings
     av_log(avctx, AV_LOG_DEBUG, "aom_codec_control\n");
@@ -1222,12 +1313,106 @@ static int queue_frames(AVCodecContext *avctx, AVPacket *pkt_out)
     return size;
 }
 
+/**
+ * Set up the encoder to re-encode the picture described by the export
+ * context of a libaom-av1 decoder as a single frame against the exported
+ * references.
+ */
+static int import_xps(AVCodecContext *avctx, ir_xps_context *xps_context,
+                      int64_t timestamp, aom_enc_frame_flags_t *flags)
+{
+    AOMContext *ctx = avctx->priv_data;
+    aom_codec_enc_cfg_t cfg = ctx->enccfg;
+    IR_XPS_EXPORT_STATUS result;
+    int i, k;
+
+    result = ir_xps_import_meta_aom(&cfg, xps_context, flags);
+    if (result != IR_XPS_EXPORT_STATUS_OK) {
+        av_log(avctx, AV_LOG_ERROR, "Failed to import metadata: %d, only shown "
+               "non-reference frames of the same format can be re-encoded\n", result);
+        return AVERROR(EINVAL);
+    }
+
+    if (cfg.rc_min_quantizer != ctx->enccfg.rc_min_quantizer ||
+        cfg.rc_max_quantizer != ctx->enccfg.rc_max_quantizer) {
+        if (aom_codec_enc_config_set(&ctx->encoder, &cfg) != AOM_CODEC_OK) {
+            log_encoder_error(avctx, "Failed to reconfigure encoder");
+            return AVERROR(EINVAL);
+        }
+        ctx->enccfg = cfg;
+    }
+
+    for (k = 0; k < IRXPS_NUM_REFS; k++) {
+        AVFrame *ref = xps_context->ref_frame[k].avframe;
+        if (!ref)
+            continue;
+        for (i = 0; i < IRXPS_NUM_PLANES; i++) {
+            xps_context->ref_frame[k].data[i] = ref->data[i];
+            xps_context->ref_frame[k].linesize[i] = ref->linesize[i];
+        }
+        xps_context->ref_frame[k].height = ref->height;
+    }
+
+    if (!xps_context->ref_frame[0].avframe) {
+        av_log(avctx, AV_LOG_ERROR, "No reference frame exported for inter frame\n");
+        return AVERROR(EINVAL);
+    }
+
+    // libaom only allocates reference buffers once it coded a frame and
+    // shares them between slots after a key frame. Code frames which are not
+    // output until the next frame is no key frame and the ALTREF slot holds
+    // its own buffer.
+    for (i = 0; ; i++) {
+        aom_image_t img = ctx->rawimg;
+        const aom_codec_cx_pkt_t *pkt;
+        const void *iter = NULL;
+        int32_t prime, key = 0;
+
+        result = ir_xps_import_prime_aom(&ctx->encoder, &ctx->irdeto_state,
+                                         xps_context, &prime);
+        if (result != IR_XPS_EXPORT_STATUS_OK) {
+            av_log(avctx, AV_LOG_ERROR, "Failed to prime the encoder: %d\n", result);
+            return AVERROR(EINVAL);
+        }
+        if (!prime)
+            break;
+        if (i == 4) {
+            av_log(avctx, AV_LOG_ERROR, "Encoder keeps coding key frames\n");
+            return AVERROR_EXTERNAL;
+        }
+
+        for (k = 0; k < IRXPS_NUM_PLANES; k++) {
+            img.planes[k] = xps_context->ref_frame[0].data[k];
+            img.stride[k] = xps_context->ref_frame[0].linesize[k];
+        }
+        if (aom_codec_encode(&ctx->encoder, &img, timestamp - avctx->ticks_per_frame,
+                             avctx->ticks_per_frame, 0) != AOM_CODEC_OK) {
+            log_encoder_error(avctx, "Error priming the encoder");
+            return AVERROR_INVALIDDATA;
+        }
+        while ((pkt = aom_codec_get_cx_data(&ctx->encoder, &iter)))
+            if (pkt->kind == AOM_CODEC_CX_FRAME_PKT)
+                key |= !!(pkt->data.frame.flags & AOM_FRAME_IS_KEY);
+        ir_xps_import_update_aom(&ctx->irdeto_state, 0, key);
+    }
+
+    result = ir_xps_import_ref_aom(&ctx->encoder, &ctx->irdeto_state, xps_context,
+                                   &ctx->rawimg, flags);
+    if (result != IR_XPS_EXPORT_STATUS_OK) {
+        av_log(avctx, AV_LOG_ERROR, "Failed to import reference frames: %d\n", result);
+        return AVERROR(EINVAL);
+    }
+
+    return 0;
+}
+
 static int aom_encode(AVCodecContext *avctx, AVPacket *pkt,
                       const AVFrame *frame, int *got_packet)
 {
     AOMContext *ctx = avctx->priv_data;
     aom_image_t *rawimg = NULL;
     int64_t timestamp = 0;
+    int64_t wall_start = 0, cpu_start = 0;
     int res, coded_size;
     aom_enc_frame_flags_t flags = 0;
 
@@ -1255,31 +1440,47 @@ static int aom_encode(AVCodecContext *avctx, AVPacket *pkt,
         if (frame->pict_type == AV_PICTURE_TYPE_I)
             flags |= AOM_EFLAG_FORCE_KF;
 
-        aom_img_remove_metadata(rawimg);
+        if (ctx->enable_irdeto_exports && frame->opaque) {
+            ir_xps_context *xps_context = (ir_xps_context *) frame->opaque;
 
-        side_data = av_frame_get_side_data(frame, AV_FRAME_DATA_IR_SEI_PAYLOAD);
-        if ((side_data) && (side_data->data) && (side_data->size > 0))
-        {
-            // The encoder requires to provide metadata with every frame, SEI payload will be cached
-            if (NULL == ctx->sei_payload)
-            {
-                ctx->sei_payload  = av_mallocz(side_data->size);
-                ctx->payload_size = side_data->size;
+            if (IR_XPS_EXPORT_STATUS_OK == ir_xps_vc(xps_context) &&
+                xps_context->header.state == IR_CONTEXT_STATE_READY) {
+                res = import_xps(avctx, xps_context, timestamp, &flags);
+                if (res < 0)
+                    return res;
             }
+        }
 
-            // Update SEI payload data
-            // It is not needed to reallocate memory buffer because payload data should have the same size
-            if ((ctx->sei_payload) && (ctx->payload_size == side_data->size))
-            {
-                memcpy(ctx->sei_payload, side_data->data, side_data->size);
+        // The encoder takes the WM info metadata from the image with every
+        // frame. It stays attached to rawimg between frames and is only
+        // replaced when the payload changes.
+        side_data = av_frame_get_side_data(frame, AV_FRAME_DATA_IR_SEI_PAYLOAD);
+        if (side_data && side_data->data && side_data->size > 0 &&
+            (side_data->size != ctx->payload_size ||
+             memcmp(ctx->sei_payload, side_data->data, side_data->size))) {
+            res = av_reallocp(&ctx->sei_payload, side_data->size);
+            if (res < 0) {
+                ctx->payload_size = 0;
+                return res;
+            }
+            memcpy(ctx->sei_payload, side_data->data, side_data->size);
+            ctx->payload_size = side_data->size;
+
+            aom_img_remove_metadata(rawimg);
+            if (aom_img_add_metadata(rawimg, OBU_METADATA_TYPE_WM_INFO,
+                                     ctx->sei_payload, ctx->payload_size,
+                                     ctx->wm_info_insert) < 0) {
+                av_log(avctx, AV_LOG_ERROR, "Failed to attach WM info metadata\n");
+                av_freep(&ctx->sei_payload);
+                ctx->payload_size = 0;
+                return AVERROR(ENOMEM);
             }
         }
+    }
 
-        if (ctx->sei_payload)
-        {
-            // Add metadata
-            aom_img_add_metadata(rawimg, OBU_METADATA_TYPE_WM_INFO, (const uint8_t *) ctx->sei_payload, ctx->payload_size, AOM_MIF_KEY_FRAME);
-        }
+    if (ctx->auto_parallel) {
+        wall_start = av_gettime_relative();
+        cpu_start  = cpu_time_us();
     }
 
     res = aom_codec_encode(&ctx->encoder, rawimg, timestamp, avctx->ticks_per_frame, flags);
@@ -1288,10 +1489,28 @@ static int aom_encode(AVCodecContext *avctx, AVPacket *pkt,
         return AVERROR_INVALIDDATA;
     }
 
+    if (ctx->auto_parallel && frame) {
+        int64_t wall = av_gettime_relative() - wall_start;
+        int64_t cpu  = cpu_time_us() - cpu_start;
+
+        // the CPU time is the one of the whole process, parallelism is an
+        // upper bound when other components run concurrently
+        av_log(avctx, AV_LOG_VERBOSE, "frame %"PRId64": %.2f ms, parallelism %.2f\n",
+               ctx->enc_frames, wall / 1000.0, wall ? (double)cpu / wall : 0.0);
+        ctx->enc_frames++;
+        ctx->enc_wall_us += wall;
+        ctx->enc_cpu_us  += cpu;
+    }
+
     coded_size = queue_frames(avctx, pkt);
     if (coded_size < 0)
         return coded_size;
 
+    // the irdeto mode codes without lag, the packet is the one of the frame
+    if (ctx->enable_irdeto_exports && frame && coded_size > 0)
+        ir_xps_import_update_aom(&ctx->irdeto_state, flags,
+                                 !!(pkt->flags & AV_PKT_FLAG_KEY));
+
     if (!frame && avctx->flags & AV_CODEC_FLAG_PASS1) {
         size_t b64_size = AV_BASE64_SIZE(ctx->twopass_stats.sz);
 
@@ -1412,6 +1631,10 @@ static const AVOption options[] = {
     { "tile-columns",     "Log2 of number of tile columns to use", OFFSET(tile_cols_log2), AV_OPT_TYPE_INT, {.i64 = -1}, -1, 6, VE},
     { "tile-rows",        "Log2 of number of tile rows to use",    OFFSET(tile_rows_log2), AV_OPT_TYPE_INT, {.i64 = -1}, -1, 6, VE},
     { "row-mt",           "Enable row based multi-threading",      OFFSET(row_mt),         AV_OPT_TYPE_BOOL, {.i64 = -1}, -1, 1, VE},
+    { "wm-info-insert",   "Frames the WM info metadata is written to", OFFSET(wm_info_insert), AV_OPT_TYPE_INT, {.i64 = AOM_MIF_KEY_FRAME}, AOM_MIF_KEY_FRAME, AOM_MIF_ANY_FRAME, VE, "wm_info_insert"},
+    { "keyframe",         "Key frames only",                       0, AV_OPT_TYPE_CONST, {.i64 = AOM_MIF_KEY_FRAME}, 0, 0, VE, "wm_info_insert"},
+    { "frame",            "Every frame",                           0, AV_OPT_TYPE_CONST, {.i64 = AOM_MIF_ANY_FRAME}, 0, 0, VE, "wm_info_insert"},
+    { "auto-parallel",    "Derive threads, tiles and row-mt from the frame size and CPU count, and report encode times", OFFSET(auto_parallel), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, VE},
     { "enable-cdef",      "Enable CDEF filtering",                 OFFSET(enable_cdef),    AV_OPT_TYPE_BOOL, {.i64 = -1}, -1, 1, VE},
     { "enable-global-motion",  "Enable global motion",             OFFSET(enable_global_motion), AV_OPT_TYPE_BOOL, {.i64 = -1}, -1, 1, VE},
     { "enable-intrabc",  "Enable intra block copy prediction mode", OFFSET(enable_intrabc), AV_OPT_TYPE_BOOL, {.i64 = -1}, -1, 1, VE},
@@ -1452,6 +1675,7 @@ static const AVOption options[] = {
     { "enable-masked-comp",           "Enable masked compound",                            OFFSET(enable_masked_comp),           AV_OPT_TYPE_BOOL, {.i64 = -1}, -1, 1, VE},
     { "enable-interintra-comp",       "Enable interintra compound",                        OFFSET(enable_interintra_comp),       AV_OPT_TYPE_BOOL, {.i64 = -1}, -1, 1, VE},
     { "enable-smooth-interintra",     "Enable smooth interintra mode",                     OFFSET(enable_smooth_interintra),     AV_OPT_TYPE_BOOL, {.i64 = -1}, -1, 1, VE},
+    { "irdeto_exports", "Enable irdeto exports through opaque field", OFFSET(enable_irdeto_exports), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, VE },
     { "aom-params",                   "Set libaom options using a :-separated list of key=value pairs", OFFSET(aom_params), AV_OPT_TYPE_STRING, { 0 }, 0, 0, VE },
     { NULL },
 };
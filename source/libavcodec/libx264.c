@@ -37,11 +37,21 @@
 #include "avcodec.h"
 #include "internal.h"
 #include "ir_preserve_nonvcl.h"
+#if CONFIG_SEGMENT_THREAD_ENCODER
+#include "segment_thread_encoder.h"
+#endif
 
 #if defined(_MSC_VER)
 #define X264_API_IMPORTS 1
 #endif
 
+/* Extra SEI kept alive while its picture is inside the encoder */
+typedef struct X264SeiSlot {
+    x264_sei_payload_t payloads[2];  ///< A/53 closed captions, Irdeto WM info
+    uint8_t           *data[2];
+    unsigned int       data_size[2];
+} X264SeiSlot;
+
 typedef struct X264Context {
     AVClass        *class;
     x264_param_t    params;
@@ -95,9 +105,19 @@ typedef struct X264Context {
 
     char *x264_params;
 
+    int segments;
+    int segment_frames;
+#if CONFIG_SEGMENT_THREAD_ENCODER
+    SegmentThreadContext *segment_enc;
+#endif
+
     int enable_irdeto_exports;
     int irdeto_pps_id;
     int irdeto_non_vcl;
+
+    X264SeiSlot *sei_slots;
+    int          nb_sei_slots;
+    unsigned int sei_slot_idx;
 } X264Context;
 
 static void X264_log(void *p, int level, const char *fmt, va_list args)
@@ -339,6 +359,41 @@ static void adjust_params_for_watermarking(
 
 static av_cold int X264_close(AVCodecContext *ctx);
 
+/**
+ * x264 keeps a pointer to extra_sei of a picture until that picture is
+ * encoded, so the payloads live in a ring of slots deeper than the encoder
+ * delay instead of being allocated and released by x264 for every frame.
+ */
+static X264SeiSlot *X264_next_sei_slot(AVCodecContext *ctx)
+{
+    X264Context *x4 = ctx->priv_data;
+
+    if (!x4->sei_slots) {
+        int nb_slots = x264_encoder_maximum_delayed_frames(x4->enc) + 2;
+        x4->sei_slots = av_mallocz_array(nb_slots, sizeof(*x4->sei_slots));
+        if (!x4->sei_slots)
+            return NULL;
+        x4->nb_sei_slots = nb_slots;
+    }
+
+    return &x4->sei_slots[x4->sei_slot_idx++ % x4->nb_sei_slots];
+}
+
+static int X264_add_sei(X264SeiSlot *slot, int idx, int type, const void *data, int size)
+{
+    av_fast_malloc(&slot->data[idx], &slot->data_size[idx], size);
+    if (!slot->data[idx])
+        return AVERROR(ENOMEM);
+
+    memcpy(slot->data[idx], data, size);
+
+    slot->payloads[idx].payload_size = size;
+    slot->payloads[idx].payload      = slot->data[idx];
+    slot->payloads[idx].payload_type = type;
+
+    return 0;
+}
+
 static int X264_frame(AVCodecContext *ctx, AVPacket *pkt, const AVFrame *frame,
                       int *got_packet)
 {
@@ -348,6 +403,11 @@ static int X264_frame(AVCodecContext *ctx, AVPacket *pkt, const AVFrame *frame,
     x264_picture_t pic_out = {0};
     int pict_type;
 
+#if CONFIG_SEGMENT_THREAD_ENCODER
+    if (x4->segment_enc)
+        return ff_segment_thread_encode_frame(x4->segment_enc, pkt, frame, got_packet);
+#endif
+
     x264_picture_init( &x4->pic );
 
     if(x4->enable_irdeto_exports && frame) {
@@ -389,6 +449,8 @@ static int X264_frame(AVCodecContext *ctx, AVPacket *pkt, const AVFrame *frame,
 
     if (frame) {
         AVFrameSideData *side_data;
+        X264SeiSlot *sei_slot = NULL;
+        int sei_num = 0;
 
         for (i = 0; i < x4->pic.img.i_plane; i++) {
             x4->pic.img.plane[i]    = frame->data[i];
@@ -428,52 +490,33 @@ static int X264_frame(AVCodecContext *ctx, AVPacket *pkt, const AVFrame *frame,
             if (ret < 0) {
                 av_log(ctx, AV_LOG_ERROR, "Not enough memory for closed captions, skipping\n");
             } else if (sei_data) {
-                x4->pic.extra_sei.payloads = av_mallocz(sizeof(x4->pic.extra_sei.payloads[0]));
-                if (x4->pic.extra_sei.payloads == NULL) {
+                sei_slot = X264_next_sei_slot(ctx);
+                if (!sei_slot || X264_add_sei(sei_slot, sei_num, 4, sei_data, sei_size) < 0)
                     av_log(ctx, AV_LOG_ERROR, "Not enough memory for closed captions, skipping\n");
-                    av_free(sei_data);
-                } else {
-                    x4->pic.extra_sei.sei_free = av_free;
-
-                    x4->pic.extra_sei.payloads[0].payload_size = sei_size;
-                    x4->pic.extra_sei.payloads[0].payload = sei_data;
-                    x4->pic.extra_sei.num_payloads = 1;
-                    x4->pic.extra_sei.payloads[0].payload_type = 4;
-                }
+                else
+                    sei_num++;
+                av_free(sei_data);
             }
         }
 
         side_data = av_frame_get_side_data(frame, AV_FRAME_DATA_IR_SEI_PAYLOAD);
         if ((side_data) && (side_data->data) && (side_data->size > 0))
         {
-            // Add one more extra SEI
-            void *sei_payload = av_mallocz(side_data->size);
-            if (sei_payload)
-            {
-                int payloads_num = (x4->pic.extra_sei.num_payloads > 0 && x4->pic.extra_sei.payloads) ? x4->pic.extra_sei.num_payloads + 1 : 1;
-                x264_sei_payload_t *new_payloads = (x264_sei_payload_t *) av_realloc((payloads_num > 1) ? x4->pic.extra_sei.payloads : NULL, payloads_num * sizeof(x264_sei_payload_t));
-
-                if (new_payloads)
-                {
-                    memcpy(sei_payload, side_data->data, side_data->size);
-
-                    x4->pic.extra_sei.payloads     = new_payloads;
-                    x4->pic.extra_sei.num_payloads = payloads_num;
-                    x4->pic.extra_sei.sei_free     = av_free;
-
-                    x4->pic.extra_sei.payloads[payloads_num - 1].payload_size = side_data->size;
-                    x4->pic.extra_sei.payloads[payloads_num - 1].payload      = sei_payload;
-                    x4->pic.extra_sei.payloads[payloads_num - 1].payload_type = 5; // SEI type 5: unregistered user data
-                }
-                else
-                {
-                    av_free(sei_payload);
-                }
-            }
+            // Add one more extra SEI, type 5: unregistered user data
+            if (!sei_slot)
+                sei_slot = X264_next_sei_slot(ctx);
+            if (sei_slot && X264_add_sei(sei_slot, sei_num, 5, side_data->data, side_data->size) >= 0)
+                sei_num++;
 
             // Forced IDR frame
             x4->pic.i_type = X264_TYPE_IDR;
         }
+
+        if (sei_num > 0) {
+            x4->pic.extra_sei.payloads     = sei_slot->payloads;
+            x4->pic.extra_sei.num_payloads = sei_num;
+            x4->pic.extra_sei.sei_free     = NULL;
+        }
     }
 
     do {
@@ -564,9 +607,21 @@ static av_cold int X264_close(AVCodecContext *avctx)
 {
     X264Context *x4 = avctx->priv_data;
 
+#if CONFIG_SEGMENT_THREAD_ENCODER
+    ff_segment_thread_encoder_free(&x4->segment_enc);
+#endif
+
     av_freep(&avctx->extradata);
     av_freep(&x4->sei);
 
+    if (x4->sei_slots) {
+        for (int i = 0; i < x4->nb_sei_slots; i++) {
+            av_freep(&x4->sei_slots[i].data[0]);
+            av_freep(&x4->sei_slots[i].data[1]);
+        }
+        av_freep(&x4->sei_slots);
+    }
+
     if (x4->enc) {
         x264_encoder_close(x4->enc);
         x4->enc = NULL;
@@ -1019,6 +1074,40 @@ static av_cold int X264_init(AVCodecContext *avctx)
     cpb_props->buffer_size = x4->params.rc.i_vbv_buffer_size * 1000;
     cpb_props->max_bitrate = x4->params.rc.i_vbv_max_bitrate * 1000;
     cpb_props->avg_bitrate = x4->params.rc.i_bitrate * 1000;
+
+    if (x4->segments) {
+#if CONFIG_SEGMENT_THREAD_ENCODER
+        int segment_frames = x4->segment_frames;
+
+        if (x4->enable_irdeto_exports || x4->params.rc.b_stat_write || x4->params.rc.b_stat_read ||
+            avctx->flags & (AV_CODEC_FLAG_PASS1 | AV_CODEC_FLAG_PASS2)) {
+            av_log(avctx, AV_LOG_ERROR,
+                   "Segment encoding is not supported with irdeto exports or 2-pass\n");
+            return AVERROR(EINVAL);
+        }
+        if (!segment_frames) {
+            if (x4->params.i_keyint_max == X264_KEYINT_MAX_INFINITE) {
+                av_log(avctx, AV_LOG_ERROR,
+                       "segment_frames is required with an infinite keyint\n");
+                return AVERROR(EINVAL);
+            }
+            segment_frames = x4->params.i_keyint_max;
+        }
+
+        /* The instance opened above only provided the headers, the frames
+           go to one instance per segment */
+        x264_encoder_close(x4->enc);
+        x4->enc = NULL;
+        av_freep(&x4->sei);
+        x4->sei_size = 0;
+
+        return ff_segment_thread_encoder_init(avctx, &x4->segment_enc,
+                                              x4->segments, segment_frames);
+#else
+        av_log(avctx, AV_LOG_ERROR, "Segment encoding requires threads\n");
+        return AVERROR(ENOSYS);
+#endif
+    }
     return 0;
 }
 
@@ -1174,6 +1263,8 @@ static const AVOption options[] = {
     { "sc_threshold", "Scene change threshold",                           OFFSET(scenechange_threshold), AV_OPT_TYPE_INT, { .i64 = -1 }, INT_MIN, INT_MAX, VE },
     { "noise_reduction", "Noise reduction",                               OFFSET(noise_reduction), AV_OPT_TYPE_INT, { .i64 = -1 }, INT_MIN, INT_MAX, VE },
     { "x264-params",  "Override the x264 configuration using a :-separated list of key=value parameters", OFFSET(x264_params), AV_OPT_TYPE_STRING, { 0 }, 0, 0, VE },
+    { "segments",     "Number of closed segments encoded in parallel",   OFFSET(segments),       AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 64, VE },
+    { "segment_frames", "Frames per segment (0 = keyint)",               OFFSET(segment_frames), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, INT_MAX, VE },
     { "irdeto_exports", "Enable irdeto exports through opaque field", OFFSET(enable_irdeto_exports), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, VE },
     { "irdeto_pps_id", "Id of PPS",                                   OFFSET(irdeto_pps_id),         AV_OPT_TYPE_INT, {.i64 = 15}, 1, 63, VE },
     { "irdeto_non_vcl", "Enable preservation of non-VCL NALUs",       OFFSET(irdeto_non_vcl),        AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, VE },
@@ -36,6 +36,9 @@
 #include "avcodec.h"
 #include "internal.h"
 #include "ir_preserve_nonvcl.h"
+#if CONFIG_SEGMENT_THREAD_ENCODER
+#include "segment_thread_encoder.h"
+#endif
 
 typedef struct libx265Context {
     const AVClass *class;
@@ -52,6 +55,12 @@ typedef struct libx265Context {
     char *profile;
     char *x265_opts;
 
+    int segments;
+    int segment_frames;
+#if CONFIG_SEGMENT_THREAD_ENCODER
+    SegmentThreadContext *segment_enc;
+#endif
+
     int enable_irdeto_exports;
     int irdeto_pps_id;
     int irdeto_non_vcl;
@@ -76,6 +85,10 @@ static av_cold int libx265_encode_close(AVCodecContext *avctx)
 {
     libx265Context *ctx = avctx->priv_data;
 
+#if CONFIG_SEGMENT_THREAD_ENCODER
+    ff_segment_thread_encoder_free(&ctx->segment_enc);
+#endif
+
     ctx->api->param_free(ctx->params);
 
     if (ctx->encoder)
@@ -444,6 +457,15 @@ static av_cold int libx265_encode_init(AVCodecContext *avctx)
         }
     }
 
+    /* The instances would all write, or all read, the same stats file */
+    if (ctx->segments &&
+        (ctx->enable_irdeto_exports || ctx->params->rc.bStatWrite || ctx->params->rc.bStatRead ||
+         avctx->flags & (AV_CODEC_FLAG_PASS1 | AV_CODEC_FLAG_PASS2))) {
+        av_log(avctx, AV_LOG_ERROR,
+               "Segment encoding is not supported with irdeto exports or 2-pass\n");
+        return AVERROR(EINVAL);
+    }
+
     /* Don't open encoder in case of watermark usage, encoder will be opened during libx265_encode_frame */
     if (ctx->enable_irdeto_exports) {
         return 0;
@@ -479,6 +501,36 @@ static av_cold int libx265_encode_init(AVCodecContext *avctx)
         memset(avctx->extradata + avctx->extradata_size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
     }
 
+    if (ctx->segments) {
+#if CONFIG_SEGMENT_THREAD_ENCODER
+        int segment_frames = ctx->segment_frames;
+
+        if (!segment_frames) {
+            if (ctx->params->keyframeMax <= 0 || ctx->params->keyframeMax == INT_MAX) {
+                av_log(avctx, AV_LOG_ERROR,
+                       "segment_frames is required with an infinite keyint\n");
+                return AVERROR(EINVAL);
+            }
+            segment_frames = ctx->params->keyframeMax;
+        }
+
+        /* The dts of the segments are rebuilt from the reordering depth */
+        avctx->has_b_frames = ctx->params->bframes ?
+                              ctx->params->bBPyramid ? 2 : 1 : 0;
+
+        /* The instance opened above only provided the headers, the frames
+           go to one instance per segment */
+        ctx->api->encoder_close(ctx->encoder);
+        ctx->encoder = NULL;
+
+        return ff_segment_thread_encoder_init(avctx, &ctx->segment_enc,
+                                              ctx->segments, segment_frames);
+#else
+        av_log(avctx, AV_LOG_ERROR, "Segment encoding requires threads\n");
+        return AVERROR(ENOSYS);
+#endif
+    }
+
     return 0;
 }
 
@@ -488,6 +540,7 @@ static int libx265_encode_frame(AVCodecContext *avctx, AVPacket *pkt,
     libx265Context *ctx = avctx->priv_data;
     x265_picture x265pic;
     x265_picture x265pic_out = { 0 };
+    x265_sei_payload sei_payload;
     x265_nal *nal;
     uint8_t *dst;
     int pict_type;
@@ -496,6 +549,11 @@ static int libx265_encode_frame(AVCodecContext *avctx, AVPacket *pkt,
     int ret;
     int i;
 
+#if CONFIG_SEGMENT_THREAD_ENCODER
+    if (ctx->segment_enc)
+        return ff_segment_thread_encode_frame(ctx->segment_enc, pkt, pic, got_packet);
+#endif
+
     if (ctx->enable_irdeto_exports && pic) {
         if (ctx->encoder) {
             av_log(avctx, AV_LOG_ERROR, "Encoder can only be used once, re-instantiate ffmpeg for watermarking.\n");
@@ -545,29 +603,14 @@ static int libx265_encode_frame(AVCodecContext *avctx, AVPacket *pkt,
         side_data = av_frame_get_side_data(pic, AV_FRAME_DATA_IR_SEI_PAYLOAD);
         if ((side_data) && (side_data->data) && (side_data->size > 0))
         {
-            // Add one more extra SEI
-            void *sei_payload = av_mallocz(side_data->size);
-            if (sei_payload)
-            {
-                int payloads_num = (x265pic.userSEI.numPayloads > 0 && x265pic.userSEI.payloads) ? x265pic.userSEI.numPayloads + 1 : 1;
-                x265_sei_payload *new_payloads = (x265_sei_payload *) av_realloc((payloads_num > 1) ? x265pic.userSEI.payloads : NULL, payloads_num * sizeof(x265_sei_payload));
-
-                if (new_payloads)
-                {
-                    memcpy(sei_payload, side_data->data, side_data->size);
-
-                    x265pic.userSEI.payloads    = new_payloads;
-                    x265pic.userSEI.numPayloads = payloads_num;
-
-                    x265pic.userSEI.payloads[payloads_num - 1].payloadSize = side_data->size;
-                    x265pic.userSEI.payloads[payloads_num - 1].payload     = sei_payload;
-                    x265pic.userSEI.payloads[payloads_num - 1].payloadType = USER_DATA_UNREGISTERED;
-                }
-                else
-                {
-                    av_free(sei_payload);
-                }
-            }
+            // x265 copies user SEI into its own frame inside encoder_encode(),
+            // so the payload is passed straight from the side data without a copy
+            sei_payload.payloadSize = side_data->size;
+            sei_payload.payload     = side_data->data;
+            sei_payload.payloadType = USER_DATA_UNREGISTERED;
+
+            x265pic.userSEI.payloads    = &sei_payload;
+            x265pic.userSEI.numPayloads = 1;
 
             // Forced IDR frame
             x265pic.sliceType = X265_TYPE_IDR;
@@ -585,19 +628,6 @@ static int libx265_encode_frame(AVCodecContext *avctx, AVPacket *pkt,
             return AVERROR_EXTERNAL;
     }
 
-    if (x265pic.userSEI.numPayloads > 0)
-    {
-        if (! x265pic.userSEI.payloads)
-            return AVERROR_EXTERNAL;
-
-        for (i = 0; i < x265pic.userSEI.numPayloads; i++)
-            av_free(x265pic.userSEI.payloads[i].payload);
-
-        av_free(x265pic.userSEI.payloads);
-
-        x265pic.userSEI.numPayloads = 0;
-        x265pic.userSEI.payloads = NULL;
-    }
 
     if (!nnal)
         return 0;
@@ -784,6 +814,8 @@ static const AVOption options[] = {
     { "tune",           "set the x265 tune parameter",                                                 OFFSET(tune),                  AV_OPT_TYPE_STRING, { 0 },          0,       0, VE },
     { "profile",        "set the x265 profile",                                                        OFFSET(profile),               AV_OPT_TYPE_STRING, { 0 },          0,       0, VE },
     { "x265-params",    "set the x265 configuration using a :-separated list of key=value parameters", OFFSET(x265_opts),             AV_OPT_TYPE_STRING, { 0 },          0,       0, VE },
+    { "segments",       "number of closed segments encoded in parallel",                               OFFSET(segments),              AV_OPT_TYPE_INT,    { .i64 =  0 },  0,      64, VE },
+    { "segment_frames", "frames per segment (0 = keyint)",                                             OFFSET(segment_frames),        AV_OPT_TYPE_INT,    { .i64 =  0 },  0, INT_MAX, VE },
     { "irdeto_exports", "Enable irdeto exports through opaque field",                                  OFFSET(enable_irdeto_exports), AV_OPT_TYPE_BOOL,   { .i64 =  0 },  0,       1, VE },
     { "irdeto_pps_id",  "Id of PPS",                                                                   OFFSET(irdeto_pps_id),         AV_OPT_TYPE_INT,    { .i64 = 15 },  1,      63, VE },
     { "irdeto_non_vcl", "Enable preservation of non-VCL NALUs",                                        OFFSET(irdeto_non_vcl),        AV_OPT_TYPE_BOOL,   { .i64 =  0 },  0,       1, VE },
@@ -1097,6 +1097,7 @@ static av_cold int mpeg_decode_init(AVCodecContext *avctx)
     s->repeat_field                = 0;
     s->mpeg_enc_ctx.codec_id       = avctx->codec->id;
     avctx->color_range             = AVCOL_RANGE_MPEG;
+    avctx->internal->allocate_progress = 1;
     return 0;
 }
 
@@ -1120,6 +1121,24 @@ static int mpeg_decode_update_thread_context(AVCodecContext *avctx,
     if (!ctx->mpeg_enc_ctx_allocated)
         memcpy(s + 1, s1 + 1, sizeof(Mpeg1Context) - sizeof(MpegEncContext));
 
+    /* sequence level state is only coded in some packets, e.g. with I-frames */
+    memcpy(s->intra_matrix,        s1->intra_matrix,        sizeof(s->intra_matrix));
+    memcpy(s->chroma_intra_matrix, s1->chroma_intra_matrix, sizeof(s->chroma_intra_matrix));
+    memcpy(s->inter_matrix,        s1->inter_matrix,        sizeof(s->inter_matrix));
+    memcpy(s->chroma_inter_matrix, s1->chroma_inter_matrix, sizeof(s->chroma_inter_matrix));
+    s->aspect_ratio_info     = s1->aspect_ratio_info;
+    s->frame_rate_index      = s1->frame_rate_index;
+    s->bit_rate              = s1->bit_rate;
+
+    ctx->save_aspect          = ctx_from->save_aspect;
+    ctx->save_width           = ctx_from->save_width;
+    ctx->save_height          = ctx_from->save_height;
+    ctx->save_progressive_seq = ctx_from->save_progressive_seq;
+    ctx->frame_rate_ext       = ctx_from->frame_rate_ext;
+    ctx->sync                 = ctx_from->sync;
+    ctx->tmpgexs              = ctx_from->tmpgexs;
+    ctx->extradata_decoded    = ctx_from->extradata_decoded;
+
     if (!(s->pict_type == AV_PICTURE_TYPE_B || s->low_delay))
         s->picture_number++;
 
@@ -1609,6 +1628,100 @@ static void mpeg_decode_picture_coding_extension(Mpeg1Context *s1)
     ff_dlog(s->avctx, "progressive_frame=%d\n", s->progressive_frame);
 }
 
+static void mpeg_xps_free(void *opaque, uint8_t *data)
+{
+    ir_xps_context_destroy((ir_xps_context *)data);
+}
+
+/**
+ * Attach an empty export context to the picture about to be decoded. It is
+ * refcounted so that frame threads holding the picture through
+ * ff_mpeg_ref_picture() see the export done by the decoding thread.
+ */
+static int mpeg_xps_alloc(MpegEncContext *s)
+{
+    Picture *pic = s->current_picture_ptr;
+    ir_xps_context *ctx = ir_xps_context_create();
+
+    av_buffer_unref(&pic->xps_buf);
+    if (!ctx)
+        return AVERROR(ENOMEM);
+    pic->xps_buf = av_buffer_create((uint8_t *)ctx, sizeof(*ctx),
+                                    mpeg_xps_free, NULL, 0);
+    if (!pic->xps_buf) {
+        ir_xps_context_destroy(ctx);
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+/**
+ * Fill the export context of the current picture, before its decoding is
+ * reported complete to other frame threads.
+ */
+static void mpeg_xps_export(MpegEncContext *s)
+{
+    ir_xps_context *ctx;
+    IR_XPS_EXPORT_STATUS result;
+
+    if (!s->current_picture_ptr->xps_buf)
+        return;
+    ctx = (ir_xps_context *)s->current_picture_ptr->xps_buf->data;
+    if (ctx->header.state == IR_CONTEXT_STATE_READY)
+        return;
+
+    /* the exported references must be complete when handed out, for I- and
+     * P-frames next_picture is the current picture */
+    if (HAVE_THREADS && (s->avctx->active_thread_type & FF_THREAD_FRAME)) {
+        if (s->last_picture_ptr && s->last_picture_ptr->f->buf[0] &&
+            s->last_picture_ptr != s->current_picture_ptr)
+            ff_thread_await_progress(&s->last_picture_ptr->tf, INT_MAX, 0);
+        if (s->next_picture_ptr && s->next_picture_ptr->f->buf[0] &&
+            s->next_picture_ptr != s->current_picture_ptr)
+            ff_thread_await_progress(&s->next_picture_ptr->tf, INT_MAX, 0);
+    }
+
+    result = ir_xps_export_mpg2(s, ctx);
+    if (IR_XPS_EXPORT_STATUS_OK != result)
+        av_log(s->avctx, AV_LOG_ERROR, "Failed to export metadata: %d\n", result);
+}
+
+/**
+ * Create the export context handed out with an output frame. It holds its
+ * own references so that the consumer can release it with
+ * ir_xps_context_destroy() independently of the decoder.
+ */
+static ir_xps_context *mpeg_xps_clone(MpegEncContext *s, Picture *pic)
+{
+    ir_xps_context *dst = ir_xps_context_create();
+    ir_xps_export_mpeg2 *xps;
+    int k;
+
+    if (!dst || !pic->xps_buf)
+        return dst;
+
+    /* a reference picture may have been exported by another frame thread,
+     * its export is complete once it reports full progress */
+    if (HAVE_THREADS && (s->avctx->active_thread_type & FF_THREAD_FRAME) &&
+        pic->reference)
+        ff_thread_await_progress(&pic->tf, INT_MAX, 0);
+
+    memcpy(dst, pic->xps_buf->data, sizeof(*dst));
+    xps = &dst->mpeg2_meta;
+    if (xps->qscale_buf) {
+        xps->qscale_buf = av_buffer_ref(xps->qscale_buf);
+        if (!xps->qscale_buf)
+            xps->qscale_values = NULL;
+    }
+    if (xps->pkt)
+        xps->pkt = av_packet_clone(xps->pkt);
+    for (k = 0; k < IRXPS_NUM_REFS; k++) {
+        if (dst->ref_frame[k].avframe)
+            dst->ref_frame[k].avframe = av_frame_clone(dst->ref_frame[k].avframe);
+    }
+    return dst;
+}
+
 static int mpeg_field_start(MpegEncContext *s, const uint8_t *buf, int buf_size)
 {
     AVCodecContext *avctx = s->avctx;
@@ -1673,6 +1786,9 @@ static int mpeg_field_start(MpegEncContext *s, const uint8_t *buf, int buf_size)
             s1->has_afd = 0;
         }
 
+        if (s->enable_irdeto_exports && (ret = mpeg_xps_alloc(s)) < 0)
+            return ret;
+
         if (HAVE_THREADS && (avctx->active_thread_type & FF_THREAD_FRAME))
             ff_thread_finish_setup(avctx);
     } else { // second field
@@ -2075,34 +2191,10 @@ static int slice_end(AVCodecContext *avctx, AVFrame *pict)
 
         ff_er_frame_end(&s->er);
 
-        ff_mpv_frame_end(s);
-
         if (s->enable_irdeto_exports)
-        {
-#if 0
-        	static cnt = 0;
-        	char str[100];
-        	sprintf(str, "qscale%d.txt", cnt++);
-        	FILE *tmp = fopen(str, "wt");
-        	fprintf(tmp, "\n******************************\n");
-        	for (int y = 0; y < s->mb_height; y++)
-        	{
-        		for (int x = 0; x < s->mb_width; x++)
-        		{
-        			ir_xps_export_mpeg2* xps = &(s->current_picture_ptr->xps_context.mpeg2_meta);
-        			//fprintf(tmp, "%d", xps->qscale_values[y * s->mb_stride + x]);
-        			fprintf(tmp, "%d ", s->qscale_values[y * s->mb_stride + x]);
-        		}
-        		fprintf(tmp, "\n%d");
-        	}
-        	fclose(tmp);
-#endif
-        	IR_XPS_EXPORT_STATUS result = ir_xps_export_mpg2(s, &s->current_picture_ptr->xps_context);
-        	if (IR_XPS_EXPORT_STATUS_OK != result)
-        	{
-        		av_log(s->avctx, AV_LOG_ERROR, "Failed to export metadata: %d\n", result);
-        	}
-        }
+            mpeg_xps_export(s);
+
+        ff_mpv_frame_end(s);
 
         if (s->pict_type == AV_PICTURE_TYPE_B || s->low_delay) {
             int ret = av_frame_ref(pict, s->current_picture_ptr->f);
@@ -2110,14 +2202,8 @@ static int slice_end(AVCodecContext *avctx, AVFrame *pict)
                 return ret;
             ff_print_debug_info(s, s->current_picture_ptr, pict);
             ff_mpv_export_qp_table(s, pict, s->current_picture_ptr, FF_QSCALE_TYPE_MPEG2);
-            if (s->current_picture_ptr)
-            {
-            	if (s->enable_irdeto_exports)
-       	        {
-            		pict->opaque = ir_xps_context_create();
-            		memcpy(pict->opaque, &s->current_picture_ptr->xps_context, sizeof(ir_xps_context));
-       	        }
-            }
+            if (s->enable_irdeto_exports)
+                pict->opaque = mpeg_xps_clone(s, s->current_picture_ptr);
         } else {
             if (avctx->active_thread_type & FF_THREAD_FRAME)
                 s->picture_number++;
@@ -2129,13 +2215,8 @@ static int slice_end(AVCodecContext *avctx, AVFrame *pict)
                     return ret;
                 ff_print_debug_info(s, s->last_picture_ptr, pict);
                 ff_mpv_export_qp_table(s, pict, s->last_picture_ptr, FF_QSCALE_TYPE_MPEG2);
-
                 if (s->enable_irdeto_exports)
-                {
-					pict->opaque = ir_xps_context_create();
-					ir_xps_context*ir_ctx = pict->opaque;
-					memcpy(pict->opaque, &s->last_picture_ptr->xps_context, sizeof(ir_xps_context));
-                }
+                    pict->opaque = mpeg_xps_clone(s, s->last_picture_ptr);
             }
         }
         return 1;
@@ -2862,7 +2943,7 @@ static int mpeg_decode_frame(AVCodecContext *avctx, void *data,
 
     	// Copy pkt ptr to context so that we can export it later as a clone.
     	// Note:  Do not clone here to avoid memory leak when decoder gets destroyed.
-    	// Fixme: should be thread safe in this particular case.
+    	// Each frame thread has its own context, so the pointer is per picture.
     	s2->pkt_strm = avpkt;
 		picture->opaque = NULL;
     }
@@ -2875,10 +2956,7 @@ static int mpeg_decode_frame(AVCodecContext *avctx, void *data,
                 return ret;
 
             if (s2->enable_irdeto_exports)
-            {
-				picture->opaque = ir_xps_context_create();
-				memcpy(picture->opaque, &s2->next_picture_ptr->xps_context, sizeof(ir_xps_context));
-            }
+                picture->opaque = mpeg_xps_clone(s2, s2->next_picture_ptr);
 
             s2->next_picture_ptr = NULL;
 
@@ -3016,9 +3094,10 @@ AVCodec ff_mpeg2video_decoder = {
     .decode         = mpeg_decode_frame,
     .capabilities   = AV_CODEC_CAP_DRAW_HORIZ_BAND | AV_CODEC_CAP_DR1 |
                       AV_CODEC_CAP_TRUNCATED | AV_CODEC_CAP_DELAY |
-                      AV_CODEC_CAP_SLICE_THREADS,
+                      AV_CODEC_CAP_SLICE_THREADS | AV_CODEC_CAP_FRAME_THREADS,
     .caps_internal  = FF_CODEC_CAP_SKIP_FRAME_FILL_PARAM,
     .flush          = flush,
+    .update_thread_context = ONLY_IF_THREADS_ENABLED(mpeg_decode_update_thread_context),
     .max_lowres     = 3,
     .profiles       = NULL_IF_CONFIG_SMALL(ff_mpeg2_video_profiles),
     .priv_class     = &mpeg2_class,
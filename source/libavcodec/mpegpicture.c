@@ -25,6 +25,7 @@
 #include "libavutil/pixdesc.h"
 
 #include "avcodec.h"
+#include "internal.h"
 #include "motion_est.h"
 #include "mpegpicture.h"
 #include "mpegutils.h"
@@ -89,21 +90,58 @@ fail:
     return AVERROR(ENOMEM);
 }
 
+/**
+ * Allocate the pixels of an encoder frame with fixed strides, so that input
+ * frames with those strides can be referenced instead of copied.
+ */
+static int alloc_frame_strides(AVCodecContext *avctx, AVFrame *f,
+                               int chroma_y_shift, int linesize, int uvlinesize)
+{
+    /* room for the bottom edge drawn below pictures of odd heights */
+    int h       = FFALIGN(avctx->height, 32);
+    int size[3] = { linesize * h,
+                    uvlinesize * (h >> chroma_y_shift),
+                    uvlinesize * (h >> chroma_y_shift) };
+    int i;
+
+    f->buf[0] = av_buffer_alloc(size[0] + size[1] + size[2] + 16 + STRIDE_ALIGN - 1);
+    if (!f->buf[0])
+        return AVERROR(ENOMEM);
+
+    f->data[0] = (uint8_t *)FFALIGN((uintptr_t)f->buf[0]->data, STRIDE_ALIGN);
+    for (i = 0; i < 3; i++) {
+        if (i)
+            f->data[i] = f->data[i - 1] + size[i - 1];
+        f->linesize[i] = i ? uvlinesize : linesize;
+    }
+    f->extended_data = f->data;
+    f->width         = avctx->width;
+    f->height        = avctx->height;
+    f->format        = avctx->pix_fmt;
+
+    return 0;
+}
+
 /**
  * Allocate a frame buffer
  */
 static int alloc_frame_buffer(AVCodecContext *avctx,  Picture *pic,
                               MotionEstContext *me, ScratchpadContext *sc,
+                              int edges_needed,
                               int chroma_x_shift, int chroma_y_shift,
                               int linesize, int uvlinesize)
 {
-    int edges_needed = av_codec_is_encoder(avctx->codec);
     int r, ret;
 
     pic->tf.f = pic->f;
-    if (avctx->codec_id != AV_CODEC_ID_WMV3IMAGE &&
-        avctx->codec_id != AV_CODEC_ID_VC1IMAGE  &&
-        avctx->codec_id != AV_CODEC_ID_MSS2) {
+    if (!edges_needed && linesize && uvlinesize &&
+        av_codec_is_encoder(avctx->codec) &&
+        av_pix_fmt_count_planes(avctx->pix_fmt) == 3) {
+        r = alloc_frame_strides(avctx, pic->f, chroma_y_shift,
+                                linesize, uvlinesize);
+    } else if (avctx->codec_id != AV_CODEC_ID_WMV3IMAGE &&
+               avctx->codec_id != AV_CODEC_ID_VC1IMAGE  &&
+               avctx->codec_id != AV_CODEC_ID_MSS2) {
         if (edges_needed) {
             pic->f->width  = avctx->width  + 2 * EDGE_WIDTH;
             pic->f->height = avctx->height + 2 * EDGE_WIDTH;
@@ -229,7 +267,7 @@ static int alloc_picture_tables(AVCodecContext *avctx, Picture *pic, int encodin
  * The pixels are allocated/set by calling get_buffer() if shared = 0
  */
 int ff_alloc_picture(AVCodecContext *avctx, Picture *pic, MotionEstContext *me,
-                     ScratchpadContext *sc, int shared, int encoding,
+                     ScratchpadContext *sc, int shared, int encoding, int edges,
                      int chroma_x_shift, int chroma_y_shift, int out_format,
                      int mb_stride, int mb_width, int mb_height, int b8_stride,
                      ptrdiff_t *linesize, ptrdiff_t *uvlinesize)
@@ -246,7 +284,7 @@ int ff_alloc_picture(AVCodecContext *avctx, Picture *pic, MotionEstContext *me,
         pic->shared = 1;
     } else {
         av_assert0(!pic->f->buf[0]);
-        if (alloc_frame_buffer(avctx, pic, me, sc,
+        if (alloc_frame_buffer(avctx, pic, me, sc, edges,
                                chroma_x_shift, chroma_y_shift,
                                *linesize, *uvlinesize) < 0)
             return -1;
@@ -306,6 +344,7 @@ void ff_mpeg_unref_picture(AVCodecContext *avctx, Picture *pic)
         av_frame_unref(pic->f);
 
     av_buffer_unref(&pic->hwaccel_priv_buf);
+    av_buffer_unref(&pic->xps_buf);
 
     if (pic->needs_realloc)
         ff_free_picture_tables(pic);
@@ -384,6 +423,14 @@ int ff_mpeg_ref_picture(AVCodecContext *avctx, Picture *dst, Picture *src)
         dst->hwaccel_picture_private = dst->hwaccel_priv_buf->data;
     }
 
+    if (src->xps_buf) {
+        dst->xps_buf = av_buffer_ref(src->xps_buf);
+        if (!dst->xps_buf) {
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
+    }
+
     dst->field_picture           = src->field_picture;
     dst->mb_var_sum              = src->mb_var_sum;
     dst->mc_mb_var_sum           = src->mc_mb_var_sum;
@@ -91,16 +91,18 @@ typedef struct Picture {
 
     uint64_t encoding_error[AV_NUM_DATA_POINTERS];
 
-    ir_xps_context xps_context;
+    AVBufferRef *xps_buf;       ///< ir_xps_context exported for this picture, shared between frame threads
 
 } Picture;
 
 /**
  * Allocate a Picture.
  * The pixels are allocated/set by calling get_buffer() if shared = 0.
+ * Encoders pass edges = 0 to get pictures without the EDGE_WIDTH border,
+ * with the strides in linesize/uvlinesize once those are set.
  */
 int ff_alloc_picture(AVCodecContext *avctx, Picture *pic, MotionEstContext *me,
-                     ScratchpadContext *sc, int shared, int encoding,
+                     ScratchpadContext *sc, int shared, int encoding, int edges,
                      int chroma_x_shift, int chroma_y_shift, int out_format,
                      int mb_stride, int mb_width, int mb_height, int b8_stride,
                      ptrdiff_t *linesize, ptrdiff_t *uvlinesize);
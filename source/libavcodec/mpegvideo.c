@@ -349,7 +349,7 @@ av_cold void ff_mpv_idct_init(MpegEncContext *s)
 
 static int alloc_picture(MpegEncContext *s, Picture *pic, int shared)
 {
-    return ff_alloc_picture(s->avctx, pic, &s->me, &s->sc, shared, 0,
+    return ff_alloc_picture(s->avctx, pic, &s->me, &s->sc, shared, 0, 0,
                             s->chroma_x_shift, s->chroma_y_shift, s->out_format,
                             s->mb_stride, s->mb_width, s->mb_height, s->b8_stride,
                             &s->linesize, &s->uvlinesize);
@@ -804,8 +804,13 @@ static int init_context_frame(MpegEncContext *s)
 
     if (s->enable_irdeto_exports)
     {
-    	FF_ALLOCZ_OR_GOTO(s->avctx, s->qscale_values, mb_array_size, fail);
-   	    memset(s->qscale_values, 0, mb_array_size);
+    	s->qscale_values_pool = av_buffer_pool_init(mb_array_size, av_buffer_allocz);
+    	if (!s->qscale_values_pool)
+    	    goto fail;
+    	s->qscale_values_buf = av_buffer_pool_get(s->qscale_values_pool);
+    	if (!s->qscale_values_buf)
+    	    goto fail;
+    	s->qscale_values = s->qscale_values_buf->data;
     }
     return ff_mpeg_er_init(s);
 fail:
@@ -892,6 +897,8 @@ static void clear_context(MpegEncContext *s)
     if (s->enable_irdeto_exports)
     {
     	s->qscale_values = NULL;
+    	s->qscale_values_buf = NULL;
+    	s->qscale_values_pool = NULL;
     }
 }
 
@@ -1060,7 +1067,9 @@ static void free_context_frame(MpegEncContext *s)
 
     if (s->enable_irdeto_exports)
     {
-    	av_freep(&s->qscale_values);
+    	av_buffer_unref(&s->qscale_values_buf);
+    	av_buffer_pool_uninit(&s->qscale_values_pool);
+    	s->qscale_values = NULL;
     }
 }
 
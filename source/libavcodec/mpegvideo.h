@@ -587,6 +587,10 @@ typedef struct MpegEncContext {
     int qscale_strm;
     AVPacket *pkt_strm;
     uint8_t *qscale_values;
+    AVBufferRef *qscale_values_buf;     ///< backs qscale_values, handed over to the picture on export
+    AVBufferPool *qscale_values_pool;
+    uint16_t irdeto_quant_matrix[4][64];///< imported matrices behind q_{,chroma_}{intra,inter}_matrix{,16}
+    int irdeto_quant_key[4];            ///< q_scale_type + 1 of that conversion, 0 if the tables hold none
     int slice_count;
     uint8_t is_imx;
 
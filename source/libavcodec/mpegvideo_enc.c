@@ -1158,7 +1158,9 @@ static int get_intra_count(MpegEncContext *s, uint8_t *src,
 
 static int alloc_picture(MpegEncContext *s, Picture *pic, int shared)
 {
+    /* the irdeto re-encode has no unrestricted MVs and draws no edges */
     return ff_alloc_picture(s->avctx, pic, &s->me, &s->sc, shared, 1,
+                            !s->enable_irdeto_exports,
                             s->chroma_x_shift, s->chroma_y_shift, s->out_format,
                             s->mb_stride, s->mb_width, s->mb_height, s->b8_stride,
                             &s->linesize, &s->uvlinesize);
@@ -1174,11 +1176,6 @@ static int load_input_picture(MpegEncContext *s, const AVFrame *pic_arg)
     int flush_offset = 1;
     int direct = 1;
 
-    if (s->enable_irdeto_exports) {
-    	// duplicate frame to avoid issues.
-    	direct = 0;
-    }
-
     if (pic_arg) {
         pts = pic_arg->pts;
         display_picture_number = s->input_picture_number++;
@@ -1210,6 +1207,21 @@ static int load_input_picture(MpegEncContext *s, const AVFrame *pic_arg)
             }
         }
 
+        if (s->enable_irdeto_exports && !s->linesize &&
+            pic_arg->buf[0] &&
+            !(s->width & 15) && !(s->height & 15) &&
+            pic_arg->linesize[0] > 0 &&
+            !(pic_arg->linesize[0] & (STRIDE_ALIGN-1)) &&
+            pic_arg->linesize[1] > 0 &&
+            !(pic_arg->linesize[1] & (STRIDE_ALIGN-1)) &&
+            pic_arg->linesize[1] == pic_arg->linesize[2]) {
+            /* the single picture re-encode allocates its pictures with the
+             * strides of its first input, so that the inputs, usually frames
+             * of the decoder, can be referenced */
+            s->linesize   = pic_arg->linesize[0];
+            s->uvlinesize = pic_arg->linesize[1];
+        }
+
         if (!pic_arg->buf[0] ||
             pic_arg->linesize[0] != s->linesize ||
             pic_arg->linesize[1] != s->uvlinesize ||
@@ -1267,12 +1279,10 @@ static int load_input_picture(MpegEncContext *s, const AVFrame *pic_arg)
                         && FFALIGN(s->height, 32) - s->height > 16)
                         vpad = 32;
 
-                    if (s->enable_irdeto_exports)  {
-                    	/* Adding offset without valid rc causes me issues */
-                    } else {
-						if (!s->avctx->rc_buffer_size)
-							dst += INPLACE_OFFSET;
-                    }
+                    /* the irdeto re-encode always reconstructs into a separate
+                     * picture, see select_input_picture() */
+                    if (!s->enable_irdeto_exports && !s->avctx->rc_buffer_size)
+                        dst += INPLACE_OFFSET;
 
                     if (src_stride == dst_stride)
                         memcpy(dst, src, src_stride * h);
@@ -1712,7 +1722,8 @@ static void frame_end(MpegEncContext *s)
 {
     if (s->unrestricted_mv &&
         s->current_picture.reference &&
-        !s->intra_only) {
+        !s->intra_only &&
+        !s->enable_irdeto_exports) {
         const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(s->avctx->pix_fmt);
         int hshift = desc->log2_chroma_w;
         int vshift = desc->log2_chroma_h;
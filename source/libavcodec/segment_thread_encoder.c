@@ -0,0 +1,520 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Segment parallel encoding: closed segments of the input are encoded
+ * concurrently by independent instances of an encoder and stitched back
+ * into one stream.
+ */
+
+#include "segment_thread_encoder.h"
+
+#include "libavutil/common.h"
+#include "libavutil/cpu.h"
+#include "libavutil/fifo.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/internal.h"
+#include "libavutil/opt.h"
+#include "libavutil/thread.h"
+#include "avcodec.h"
+#include "internal.h"
+
+#define MAX_THREADS 64
+/* size of the raw frames queued for the instances, beyond it the caller waits */
+#define MAX_QUEUE_SIZE (1 << 30)
+
+typedef struct Segment {
+    struct Segment *next;
+    int64_t index;
+    AVFifoBuffer *frames;       ///< AVFrame *, queued by the caller
+    AVFifoBuffer *packets;      ///< AVPacket *, queued by the worker
+    int eof;                    ///< every frame of the segment is queued
+    int done;                   ///< the instance of the segment is drained
+    int ret;
+} Segment;
+
+typedef struct Worker {
+    SegmentThreadContext *s;
+    pthread_t thread;
+    Segment *segment;           ///< segment being encoded, NULL when idle
+} Worker;
+
+struct SegmentThreadContext {
+    AVCodecContext *avctx;
+    int segment_frames;
+    int child_threads;
+
+    Worker workers[MAX_THREADS];
+    int nb_workers;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t input_cond;  ///< new segment, new frame or exit, for the workers
+    pthread_cond_t output_cond; ///< new packet or segment done, for the caller
+    int exit;
+
+    Segment *head;              ///< oldest segment with packets left to return
+    Segment *tail;              ///< segment receiving the input frames
+    int64_t nb_segments;
+    int tail_frames;
+    int flushing;
+    int nb_queued;              ///< frames queued in all segments
+    int max_queued;
+
+    AVFifoBuffer *pts;          ///< input pts in display order, for the dts
+    int64_t first_pts;
+    int64_t frame_duration;
+    int64_t nb_in;
+    int64_t nb_out;
+};
+
+static int fifo_push(AVFifoBuffer *f, const void *data, int size)
+{
+    if (av_fifo_space(f) < size) {
+        int ret = av_fifo_grow(f, FFMAX(av_fifo_size(f), size));
+        if (ret < 0)
+            return ret;
+    }
+    av_fifo_generic_write(f, (void *)data, size, NULL);
+    return 0;
+}
+
+static void *fifo_pop(AVFifoBuffer *f)
+{
+    void *p = NULL;
+
+    if (av_fifo_size(f) >= (int)sizeof(p))
+        av_fifo_generic_read(f, &p, sizeof(p), NULL);
+    return p;
+}
+
+static void segment_free(Segment **pseg)
+{
+    Segment *seg = *pseg;
+    AVFrame *frame;
+    AVPacket *pkt;
+
+    if (!seg)
+        return;
+
+    if (seg->frames) {
+        while ((frame = fifo_pop(seg->frames)))
+            av_frame_free(&frame);
+        av_fifo_freep(&seg->frames);
+    }
+    if (seg->packets) {
+        while ((pkt = fifo_pop(seg->packets)))
+            av_packet_free(&pkt);
+        av_fifo_freep(&seg->packets);
+    }
+    av_freep(pseg);
+}
+
+static int open_instance(SegmentThreadContext *s, Segment *seg, AVCodecContext **pchild)
+{
+    AVCodecContext *avctx = s->avctx, *child;
+    int ret;
+
+    child = avcodec_alloc_context3(avctx->codec);
+    if (!child)
+        return AVERROR(ENOMEM);
+
+    if ((ret = av_opt_copy(child, avctx)) < 0 ||
+        (ret = av_opt_copy(child->priv_data, avctx->priv_data)) < 0)
+        goto fail;
+    ret = av_opt_set_int(child->priv_data, "segments", 0, 0);
+    if (ret < 0 && ret != AVERROR_OPTION_NOT_FOUND)
+        goto fail;
+
+    child->width               = avctx->width;
+    child->height              = avctx->height;
+    child->pix_fmt             = avctx->pix_fmt;
+    child->time_base           = avctx->time_base;
+    child->framerate           = avctx->framerate;
+    child->ticks_per_frame     = avctx->ticks_per_frame;
+    child->sample_aspect_ratio = avctx->sample_aspect_ratio;
+    child->thread_count        = s->child_threads;
+
+    ret = avcodec_open2(child, avctx->codec, NULL);
+    if (ret < 0)
+        goto fail;
+
+    *pchild = child;
+    return 0;
+
+fail:
+    av_log(avctx, AV_LOG_ERROR, "Cannot open the encoder of segment %"PRId64"\n", seg->index);
+    avcodec_free_context(&child);
+    return ret;
+}
+
+static int queue_packet(SegmentThreadContext *s, Segment *seg, AVPacket *pkt)
+{
+    AVPacket *out;
+    int ret;
+
+    ret = av_packet_make_refcounted(pkt);
+    if (ret < 0 || !(out = av_packet_alloc())) {
+        av_packet_unref(pkt);
+        return ret < 0 ? ret : AVERROR(ENOMEM);
+    }
+    av_packet_move_ref(out, pkt);
+
+    pthread_mutex_lock(&s->mutex);
+    ret = fifo_push(seg->packets, &out, sizeof(out));
+    pthread_cond_broadcast(&s->output_cond);
+    pthread_mutex_unlock(&s->mutex);
+
+    if (ret < 0)
+        av_packet_free(&out);
+    return ret;
+}
+
+static int receive_packets(SegmentThreadContext *s, Segment *seg, AVCodecContext *child)
+{
+    AVPacket pkt;
+    int ret;
+
+    av_init_packet(&pkt);
+    pkt.data = NULL;
+    pkt.size = 0;
+
+    while ((ret = avcodec_receive_packet(child, &pkt)) >= 0) {
+        ret = queue_packet(s, seg, &pkt);
+        if (ret < 0)
+            return ret;
+    }
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+static int encode_segment(SegmentThreadContext *s, Segment *seg)
+{
+    AVCodecContext *child = NULL;
+    AVFrame *frame;
+    int ret;
+
+    ret = open_instance(s, seg, &child);
+
+    while (ret >= 0) {
+        pthread_mutex_lock(&s->mutex);
+        while (!s->exit && !seg->eof && !av_fifo_size(seg->frames))
+            pthread_cond_wait(&s->input_cond, &s->mutex);
+        frame = s->exit ? NULL : fifo_pop(seg->frames);
+        if (frame) {
+            s->nb_queued--;
+            pthread_cond_broadcast(&s->output_cond);
+        }
+        if (s->exit)
+            ret = AVERROR_EXIT;
+        pthread_mutex_unlock(&s->mutex);
+
+        /* A NULL frame past the end of the segment drains the instance */
+        ret = ret < 0 ? ret : avcodec_send_frame(child, frame);
+        if (ret >= 0)
+            ret = receive_packets(s, seg, child);
+        if (!frame)
+            break;
+        av_frame_free(&frame);
+    }
+
+    avcodec_free_context(&child);
+    return ret;
+}
+
+static void * attribute_align_arg worker(void *arg)
+{
+    Worker *w = arg;
+    SegmentThreadContext *s = w->s;
+
+    pthread_mutex_lock(&s->mutex);
+    while (1) {
+        Segment *seg;
+        AVFrame *frame;
+        int ret;
+
+        while (!s->exit && !w->segment)
+            pthread_cond_wait(&s->input_cond, &s->mutex);
+        if (s->exit)
+            break;
+        seg = w->segment;
+        pthread_mutex_unlock(&s->mutex);
+
+        ret = encode_segment(s, seg);
+
+        pthread_mutex_lock(&s->mutex);
+        /* Frames left after a failure are not waited for */
+        while ((frame = fifo_pop(seg->frames))) {
+            av_frame_free(&frame);
+            s->nb_queued--;
+        }
+        seg->ret  = ret;
+        seg->done = 1;
+        w->segment = NULL;
+        pthread_cond_broadcast(&s->output_cond);
+    }
+    pthread_mutex_unlock(&s->mutex);
+
+    return NULL;
+}
+
+static int start_segment(SegmentThreadContext *s)
+{
+    Worker *w = &s->workers[s->nb_segments % s->nb_workers];
+    Segment *seg;
+
+    seg = av_mallocz(sizeof(*seg));
+    if (!seg)
+        return AVERROR(ENOMEM);
+    seg->frames  = av_fifo_alloc(s->segment_frames * sizeof(AVFrame *));
+    seg->packets = av_fifo_alloc(16 * sizeof(AVPacket *));
+    if (!seg->frames || !seg->packets) {
+        segment_free(&seg);
+        return AVERROR(ENOMEM);
+    }
+    seg->index = s->nb_segments++;
+
+    pthread_mutex_lock(&s->mutex);
+    if (s->tail) {
+        s->tail->eof = 1;
+        pthread_cond_broadcast(&s->input_cond);
+    }
+
+    /* Waiting for the worker to finish its previous segment bounds the
+       queued input to nb_threads segments */
+    while (w->segment)
+        pthread_cond_wait(&s->output_cond, &s->mutex);
+
+    if (s->tail)
+        s->tail->next = seg;
+    else
+        s->head = seg;
+    s->tail = seg;
+    s->tail_frames = 0;
+
+    w->segment = seg;
+    pthread_cond_broadcast(&s->input_cond);
+    pthread_mutex_unlock(&s->mutex);
+
+    return 0;
+}
+
+static int output_packet(SegmentThreadContext *s, AVPacket *pkt, int *got_packet)
+{
+    AVCodecContext *avctx = s->avctx;
+    AVPacket *out = NULL;
+    int ret = 0;
+
+    pthread_mutex_lock(&s->mutex);
+    while (s->head) {
+        Segment *seg = s->head;
+
+        if ((out = fifo_pop(seg->packets)))
+            break;
+        if (seg->done) {
+            if (seg->ret < 0) {
+                ret = seg->ret;
+                break;
+            }
+            s->head = seg->next;
+            if (s->tail == seg)
+                s->tail = NULL;
+            segment_free(&seg);
+            continue;
+        }
+        /* Only block once there is no more input to give */
+        if (!s->flushing)
+            break;
+        pthread_cond_wait(&s->output_cond, &s->mutex);
+    }
+    pthread_mutex_unlock(&s->mutex);
+
+    if (!out)
+        return ret;
+
+    av_packet_move_ref(pkt, out);
+    av_packet_free(&out);
+
+    /* Every instance starts its dts over before its first pts, so they are
+       rebuilt from the input pts delayed by the reordering depth */
+    if (s->nb_out < avctx->has_b_frames)
+        pkt->dts = s->first_pts - (avctx->has_b_frames - s->nb_out) * s->frame_duration;
+    else
+        av_fifo_generic_read(s->pts, &pkt->dts, sizeof(pkt->dts), NULL);
+    s->nb_out++;
+
+    *got_packet = 1;
+    return 0;
+}
+
+int ff_segment_thread_encode_frame(SegmentThreadContext *s, AVPacket *pkt,
+                                   const AVFrame *frame, int *got_packet)
+{
+    int ret;
+
+    *got_packet = 0;
+
+    if (frame) {
+        AVFrame *ref;
+
+        if (!s->tail || s->tail_frames == s->segment_frames) {
+            ret = start_segment(s);
+            if (ret < 0)
+                return ret;
+        }
+
+        if (!s->nb_in)
+            s->first_pts = frame->pts;
+        else if (s->nb_in == 1 && frame->pts > s->first_pts)
+            s->frame_duration = frame->pts - s->first_pts;
+        ret = fifo_push(s->pts, &frame->pts, sizeof(frame->pts));
+        if (ret < 0)
+            return ret;
+        s->nb_in++;
+
+        ref = av_frame_clone(frame);
+        if (!ref)
+            return AVERROR(ENOMEM);
+
+        pthread_mutex_lock(&s->mutex);
+        /* The instance of the tail takes its frames as long as it has some,
+           so waiting for it cannot block when the other ones are stuck */
+        while (s->nb_queued >= s->max_queued && !s->tail->done &&
+               av_fifo_size(s->tail->frames))
+            pthread_cond_wait(&s->output_cond, &s->mutex);
+        if (s->tail->done)
+            ret = s->tail->ret < 0 ? s->tail->ret : AVERROR_BUG;
+        else
+            ret = fifo_push(s->tail->frames, &ref, sizeof(ref));
+        if (ret >= 0)
+            s->nb_queued++;
+        pthread_cond_broadcast(&s->input_cond);
+        pthread_mutex_unlock(&s->mutex);
+
+        if (ret < 0) {
+            av_frame_free(&ref);
+            return ret;
+        }
+        s->tail_frames++;
+    } else if (!s->flushing) {
+        pthread_mutex_lock(&s->mutex);
+        s->flushing = 1;
+        if (s->tail) {
+            s->tail->eof = 1;
+            pthread_cond_broadcast(&s->input_cond);
+        }
+        pthread_mutex_unlock(&s->mutex);
+    }
+
+    return output_packet(s, pkt, got_packet);
+}
+
+int ff_segment_thread_encoder_init(AVCodecContext *avctx, SegmentThreadContext **ps,
+                                   int nb_threads, int segment_frames)
+{
+    SegmentThreadContext *s;
+    int i, frame_size;
+
+    if (nb_threads < 2 || nb_threads > MAX_THREADS) {
+        av_log(avctx, AV_LOG_ERROR, "The number of segments encoded at once must be "
+               "between 2 and %d, not %d\n", MAX_THREADS, nb_threads);
+        return AVERROR(EINVAL);
+    }
+    frame_size = av_image_get_buffer_size(avctx->pix_fmt, avctx->width, avctx->height, 1);
+    if (segment_frames <= 0 || frame_size < 0)
+        return AVERROR(EINVAL);
+
+    s = av_mallocz(sizeof(*s));
+    if (!s)
+        return AVERROR(ENOMEM);
+    *ps = s;
+
+    s->avctx          = avctx;
+    s->segment_frames = segment_frames;
+    s->max_queued     = FFMAX(MAX_QUEUE_SIZE / FFMAX(frame_size, 1), nb_threads);
+    s->child_threads  = FFMAX((avctx->thread_count > 0 ? avctx->thread_count : av_cpu_count()) / nb_threads, 1);
+    s->frame_duration = 1;
+
+    /* The segments are encoded concurrently, so the state the rate control
+       ends one segment with is not known when the next ones start. Every
+       instance starts from the same settings: the target bitrate and the
+       initial VBV occupancy of the caller, as at the start of the stream. */
+    if (avctx->rc_buffer_size > 0)
+        av_log(avctx, AV_LOG_WARNING, "The VBV is not continuous across segments, each one "
+               "starts with the initial occupancy; the stitched stream may not "
+               "conform at the segment boundaries\n");
+
+    s->pts = av_fifo_alloc(16 * sizeof(int64_t));
+    if (!s->pts) {
+        av_freep(ps);
+        return AVERROR(ENOMEM);
+    }
+
+    pthread_mutex_init(&s->mutex, NULL);
+    pthread_cond_init(&s->input_cond, NULL);
+    pthread_cond_init(&s->output_cond, NULL);
+
+    for (i = 0; i < nb_threads; i++) {
+        s->workers[i].s = s;
+        if (pthread_create(&s->workers[i].thread, NULL, worker, &s->workers[i])) {
+            ff_segment_thread_encoder_free(ps);
+            return AVERROR(ENOMEM);
+        }
+        s->nb_workers++;
+    }
+
+    av_log(avctx, AV_LOG_VERBOSE, "Encoding segments of %d frames on %d threads, "
+           "%d encoder threads each\n", segment_frames, nb_threads, s->child_threads);
+    if ((int64_t)nb_threads * segment_frames > s->max_queued)
+        av_log(avctx, AV_LOG_WARNING, "At most %d raw frames are queued, segments will "
+               "wait for their input\n", s->max_queued);
+
+    return 0;
+}
+
+void ff_segment_thread_encoder_free(SegmentThreadContext **ps)
+{
+    SegmentThreadContext *s = *ps;
+    int i;
+
+    if (!s)
+        return;
+
+    pthread_mutex_lock(&s->mutex);
+    s->exit = 1;
+    pthread_cond_broadcast(&s->input_cond);
+    pthread_mutex_unlock(&s->mutex);
+
+    for (i = 0; i < s->nb_workers; i++)
+        pthread_join(s->workers[i].thread, NULL);
+
+    while (s->head) {
+        Segment *seg = s->head;
+        s->head = seg->next;
+        segment_free(&seg);
+    }
+
+    if (s->nb_segments)
+        av_log(s->avctx, AV_LOG_VERBOSE, "%"PRId64" segments, %"PRId64" frames\n",
+               s->nb_segments, s->nb_in);
+
+    pthread_mutex_destroy(&s->mutex);
+    pthread_cond_destroy(&s->input_cond);
+    pthread_cond_destroy(&s->output_cond);
+    av_fifo_freep(&s->pts);
+    av_freep(ps);
+}
@@ -0,0 +1,49 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVCODEC_SEGMENT_THREAD_ENCODER_H
+#define AVCODEC_SEGMENT_THREAD_ENCODER_H
+
+#include "avcodec.h"
+
+typedef struct SegmentThreadContext SegmentThreadContext;
+
+/**
+ * Encode the input as consecutive segments of segment_frames frames, each
+ * one with a fresh instance of avctx->codec, so that it starts with an IDR
+ * frame and does not reference the other segments. Up to nb_threads
+ * segments are encoded at once and their packets are put back in order as
+ * a single stream.
+ *
+ * The instances are opened with the options of avctx, except for the
+ * private option "segments", if any, which is set to 0. The encoder must
+ * have set avctx->has_b_frames, it is used to rebuild continuous dts.
+ *
+ * nb_threads must be at least 2. The raw frames queued for the instances
+ * are limited to about 1 GiB, beyond it ff_segment_thread_encode_frame()
+ * waits for the instances to take them.
+ */
+int ff_segment_thread_encoder_init(AVCodecContext *avctx, SegmentThreadContext **ps,
+                                   int nb_threads, int segment_frames);
+
+int ff_segment_thread_encode_frame(SegmentThreadContext *s, AVPacket *pkt,
+                                   const AVFrame *frame, int *got_packet);
+
+void ff_segment_thread_encoder_free(SegmentThreadContext **ps);
+
+#endif /* AVCODEC_SEGMENT_THREAD_ENCODER_H */
@@ -84,41 +84,6 @@ static av_cold int vf_irhdrtf_init(AVFilterContext* const ctx)
     return AVERROR(sys);
 }
 
-static int vf_irhdrtf_postinit(AVFilterLink* const inlink,
-    AVFrame* const frame)
-{
-    int result = 1;
-    AVFilterContext* filter         = (AVFilterContext*) inlink->dst;
-    struct ir_hdr_context* context   = (struct ir_hdr_context*) filter->priv;
-
-    do
-    {
-        if (VF_STATE_INITIALIZED == context->state) // Early exit when done
-        {
-            result = 0;
-            break;
-        }
-
-        context->width       = frame->width;
-        context->height      = frame->height;
-        context->linesize    = frame->linesize[0];
-        context->output_buffer = (uint8_t*) malloc(context->linesize *
-            context->height);
-        if (NULL == context->output_buffer)
-        {
-            break;
-        }
-
-        ir_print_config(filter);
-
-        context->state = VF_STATE_INITIALIZED;
-        result = 0;
-
-    } while(0);
-
-    return result;
-}
-
 static const double alpha = 1.09929682680944;
 static const double alpha_minus_1 = 0.09929682680944;
 static const double beta = 0.018053968510807;
@@ -152,106 +117,144 @@ static double eotf_unit(double E_prime)
 
     return E;
 }
-static int ir_hdr_eotf(const uint16_t* const input, uint16_t* const output,
-    size_t size)
-{
-    size_t i = 0;
 
-    for (i = 0; i < size; i++)
-    {
-        output[i] = (uint16_t) (eotf_unit((double)(input[i]) / 1023.0) * 1023);
-    }
+typedef double (*ir_hdr_fptr) (double value);
 
-    return 0;
-}
+static ir_hdr_fptr s_hdrtf[2] =
+{
+    eotf_unit,
+    oetf_unit
+};
 
-static int ir_hdr_oetf(const uint16_t* const input, uint16_t* const output,
-    size_t size)
+/**
+********************************************************************************
+* @brief  Tabulate the transfer function for every possible sample value, the
+*         normalization base is given for 10-bit and scaled to the plane depth
+********************************************************************************
+*/
+static void ir_hdr_build_lut(uint16_t* const lut, int depth, int norm_base,
+    int tf_type)
 {
-    size_t i = 0;
+    int i = 0;
+    int max = (1 << depth) - 1;
+    double norm = (double) norm_base * max / 1023.0;
 
-    for (i = 0; i < size; i++)
+    for (i = 0; i <= max; i++)
     {
-        output[i] = (uint16_t) (oetf_unit((double)(input[i]) / 1023.0) * 1023);
+        lut[i] = (uint16_t) av_clip((int) (s_hdrtf[tf_type]((double) i / norm) *
+            norm), 0, max);
     }
-
-    return 0;
 }
 
-typedef int (*ir_hdr_fptr) (const uint16_t* const input, uint16_t* const
-    output, size_t size);
-
-static ir_hdr_fptr s_hdrtf[2] =
-{
-    ir_hdr_eotf,
-    ir_hdr_oetf
-};
-
-static int ir_hdr_transfer(const void* const input, void* const output,
-    size_t width, size_t height, size_t linesize, int norm_base, int tf_type)
+static int vf_irhdrtf_postinit(AVFilterLink* const inlink,
+    AVFrame* const frame)
 {
     int result = 1;
+    AVFilterContext* filter         = (AVFilterContext*) inlink->dst;
+    struct ir_hdr_context* context   = (struct ir_hdr_context*) filter->priv;
+    const AVPixFmtDescriptor* desc  = av_pix_fmt_desc_get(frame->format);
 
     do
     {
-        if (NULL == input)
-        {
-            break;
-        }
-
-        if (NULL == output)
+        if (VF_STATE_INITIALIZED == context->state) // Early exit when done
         {
+            result = 0;
             break;
         }
 
-        if (0 == width)
+        if (NULL == desc || desc->comp[0].depth > 10)
         {
             break;
         }
 
-        if (0 == height)
-        {
-            break;
-        }
+        context->width       = frame->width;
+        context->height      = frame->height;
+        context->linesize    = frame->linesize[0];
+        context->depth       = desc->comp[0].depth;
 
-        if (0 == linesize)
-        {
-            break;
-        }
+        ir_hdr_build_lut(context->lut, context->depth,
+            context->config.norm_base, context->config.tf_type);
 
-        uint16_t* i_pic = (uint16_t*) input;
-        uint16_t* o_pic = (uint16_t*) output;
+        ir_print_config(filter);
 
-        result = s_hdrtf[tf_type](i_pic, o_pic, width * height);
+        context->state = VF_STATE_INITIALIZED;
+        result = 0;
 
     } while(0);
 
     return result;
 }
 
-static int vf_irhdrtf_process_frame(AVFilterLink* const inlink, 
+/**
+********************************************************************************
+* @brief  Apply the tabulated transfer function to a slice of luma rows in
+*         place, chroma planes are left untouched
+********************************************************************************
+*/
+static int ir_hdr_transfer_slice(AVFilterContext* ctx, void* arg, int jobnr,
+    int nb_jobs)
+{
+    struct ir_hdr_context* context = (struct ir_hdr_context*) ctx->priv;
+    const uint16_t* const lut = context->lut;
+    AVFrame* frame = (AVFrame*) arg;
+    int linesize = frame->linesize[0];
+    int width = frame->width;
+    int slice_start = (frame->height *  jobnr     ) / nb_jobs;
+    int slice_end   = (frame->height * (jobnr + 1)) / nb_jobs;
+    int x = 0;
+    int y = 0;
+
+    if (context->depth > 8)
+    {
+        for (y = slice_start; y < slice_end; y++)
+        {
+            uint16_t* row = (uint16_t*) (frame->data[0] + y * linesize);
+
+            for (x = 0; x < width; x++)
+            {
+                row[x] = lut[row[x] & 0x3FF];
+            }
+        }
+    }
+    else
+    {
+        for (y = slice_start; y < slice_end; y++)
+        {
+            uint8_t* row = frame->data[0] + y * linesize;
+
+            for (x = 0; x < width; x++)
+            {
+                row[x] = (uint8_t) lut[row[x]];
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int vf_irhdrtf_process_frame(AVFilterLink* const inlink,
     AVFrame* const frame)
 {
     int result = 1;
     AVFilterContext* filter = (AVFilterContext*) inlink->dst;
-    struct ir_hdr_context* context = (struct ir_hdr_context*) filter->priv;
-    
+
     do
     {
-        av_frame_make_writable(frame);
-
-        result = ir_hdr_transfer(frame->data[0], context->output_buffer,
-            context->width, context->height, context->linesize,
-            context->config.norm_base, context->config.tf_type);
+        if (NULL == frame->data[0])
+        {
+            break;
+        }
 
-        if (0 != result)
+        if (0 >= frame->width || 0 >= frame->height)
         {
             break;
         }
 
-        memcpy(frame->data[0], context->output_buffer, context->linesize *
-            context->height);
-        
+        filter->internal->execute(filter, ir_hdr_transfer_slice, frame, NULL,
+            FFMIN(frame->height, ff_filter_get_nb_threads(filter)));
+
+        result = 0;
+
     } while(0);
 
     return result;
@@ -291,11 +294,6 @@ static av_cold void vf_irhdrtf_uninit(AVFilterContext* const ctx)
 {
     struct ir_hdr_context* context = ctx->priv;
 
-    if (NULL != context && VF_STATE_INITIALIZED == context->state)
-    {
-        free(context->output_buffer);
-    }
-
     context->state = VF_STATE_UNINITIALIZED;
     av_log(ctx, AV_LOG_INFO, "Irdeto FFmpeg Video filter was uninitialized");
 }
@@ -363,4 +361,5 @@ AVFilter ff_vf_irhdrtf =
     .query_formats   = ir_irhdrtf_register_formats,
     .inputs          = ff_vf_irhdrtf_inputs,
     .outputs         = ff_vf_irhdrtf_outputs,
+    .flags           = AVFILTER_FLAG_SLICE_THREADS,
 };
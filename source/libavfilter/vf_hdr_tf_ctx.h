@@ -62,7 +62,14 @@ typedef struct ir_hdr_context
     size_t  width;
     size_t  height;
     size_t  linesize;
-    uint8_t* output_buffer;
+    int     depth;
+
+    /**
+    ****************************************************************************
+    * @brief    Transfer function tabulated for every sample value (up to 10-bit)
+    ****************************************************************************
+    */
+    uint16_t lut[1 << 10];
 
     /**
     ****************************************************************************
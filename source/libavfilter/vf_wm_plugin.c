@@ -701,7 +701,7 @@ static uint64_t convert_pts_to_msn(AVFilterContext* ctx, const int64_t pts, cons
     if ((context->pts_initial < 0) && (context->pts_last < 0))
     {
         // Initial epoch time
-        msn = 1 + context->epoch_time / context->epoch_seglen;
+        msn = av_wm_info_get_msn(context->epoch_time, 0, context->epoch_seglen);
 
         context->pts_initial = pts;
         context->pts_last    = pts;
@@ -711,7 +711,7 @@ static uint64_t convert_pts_to_msn(AVFilterContext* ctx, const int64_t pts, cons
     {
         uint64_t time_stamp_inc = 1000 * (pts - context->pts_initial) * time_base.num / time_base.den;
 
-        msn = 1 + context->epoch_time / context->epoch_seglen + time_stamp_inc / context->epoch_seglen;
+        msn = av_wm_info_get_msn(context->epoch_time, time_stamp_inc, context->epoch_seglen);
 
         context->pts_last = pts;
         context->pts_num ++;
@@ -726,7 +726,7 @@ static uint64_t convert_pts_to_msn(AVFilterContext* ctx, const int64_t pts, cons
 
         time_stamp_inc = 1000 * pts_inc * time_base.num / time_base.den;
 
-        msn = 1 + context->epoch_time / context->epoch_seglen + time_stamp_inc / context->epoch_seglen;
+        msn = av_wm_info_get_msn(context->epoch_time, time_stamp_inc, context->epoch_seglen);
 
         // Reset PTS sequence
         context->pts_initial = pts - pts_inc;
@@ -738,6 +738,21 @@ static uint64_t convert_pts_to_msn(AVFilterContext* ctx, const int64_t pts, cons
     return msn;
 }
 
+static void set_epoch_time_to_sidedata(AVFilterContext* ctx, AVFrame* const frame)
+{
+    struct ir_pf_context* context = (struct ir_pf_context*) ctx->priv;
+
+    // Encoders forward this value as AV_PKT_IRDETO_EPOCH_TIME packet side data to the muxers
+    AVFrameSideData* sd = av_frame_new_side_data(frame, AV_FRAME_DATA_IR_EPOCH_TIME, sizeof(AVIrdetoEpoch));
+
+    if (sd)
+    {
+        AVIrdetoEpoch* epoch = (AVIrdetoEpoch*) sd->data;
+        epoch->epoch_time = context->epoch_time;
+        epoch->seglen     = context->epoch_seglen;
+    }
+}
+
 static int wm_plugin_process_frame(AVFilterLink* const inlink,
     AVFrame* const frame)
 {
@@ -780,6 +795,8 @@ static int wm_plugin_process_frame(AVFilterLink* const inlink,
                     av_wm_info_set_epoch_time(context->epoch_time / 1000);
                 }
 
+                set_epoch_time_to_sidedata(ctx, frame);
+
                 // Convert PTS to Media Sequence Number
                 msn = convert_pts_to_msn(ctx, frame->pts, inlink->time_base);
                 context->wmp_lltos(msn, value, 64);
@@ -845,7 +862,12 @@ static int wm_plugin_process_frame(AVFilterLink* const inlink,
 
             if (payload_size > 0)
             {
-                AVFrameSideData* sd = av_frame_new_side_data(frame, AV_FRAME_DATA_IR_SEI_PAYLOAD, payload_size);
+                AVFrameSideData* sd;
+
+                /* replace a payload the decoder exported, encoders only
+                 * read the first one */
+                av_frame_remove_side_data(frame, AV_FRAME_DATA_IR_SEI_PAYLOAD);
+                sd = av_frame_new_side_data(frame, AV_FRAME_DATA_IR_SEI_PAYLOAD, payload_size);
                 if (sd) memcpy(sd->data, sei_payload, payload_size);
             }
         }
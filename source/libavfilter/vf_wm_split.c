@@ -70,6 +70,8 @@ typedef struct ir_pf_context
     size_t width;
     size_t height;
 
+    size_t pixel_step;      ///< Bytes per luma sample
+
     /**
     ****************************************************************************
     * @brief    Indication of the WM plugin state in current moment of time
@@ -190,6 +192,7 @@ static int wm_plugin_postinit(AVFilterLink* const inlink, const AVFrame* const f
     int result = 0;
     AVFilterContext* ctx = (AVFilterContext*) inlink->dst;
     struct ir_pf_context* context = (struct ir_pf_context*) ctx->priv;
+    const AVPixFmtDescriptor* desc = NULL;
     
     do
     {
@@ -199,7 +202,15 @@ static int wm_plugin_postinit(AVFilterLink* const inlink, const AVFrame* const f
             break;
         }
 
+        desc = av_pix_fmt_desc_get(frame->format);
+        if (NULL == desc)
+        {
+            result = EINVAL;
+            break;
+        }
 
+        // 10 bit samples are stored in 16 bit words
+        context->pixel_step = (desc->comp[0].depth > 8) ? 2 : 1;
 
         context->state = VF_STATE_INITIALIZED;
 
@@ -208,6 +219,31 @@ static int wm_plugin_postinit(AVFilterLink* const inlink, const AVFrame* const f
     return result;
 }
 
+/**
+* @brief        Clear a slice of the box rows in the luma plane
+* @param        [in] ctx        AVFilter context
+* @param        [in] arg        Frame to be processed
+* @param        [in] jobnr      Index of the slice
+* @param        [in] nb_jobs    Number of slices
+* @return       0
+*/
+static int wm_plugin_clear_slice(AVFilterContext* ctx, void* arg, int jobnr, int nb_jobs)
+{
+    struct ir_pf_context* context = (struct ir_pf_context*) ctx->priv;
+    AVFrame* frame = (AVFrame*) arg;
+    size_t slice_start = context->y + (context->height *  jobnr     ) / nb_jobs;
+    size_t slice_end   = context->y + (context->height * (jobnr + 1)) / nb_jobs;
+    size_t i;
+
+    for (i = slice_start; i < slice_end; i++)
+    {
+        memset(frame->data[0] + i * frame->linesize[0] + context->x * context->pixel_step, 0,
+            context->width * context->pixel_step);
+    }
+
+    return 0;
+}
+
 /**
 * @brief        Process single frame coming out of decoder or previous filter if applicable
 * @param        [in] inlink     AVFilter input connection
@@ -219,7 +255,6 @@ static int wm_plugin_process_frame(AVFilterLink* const inlink, AVFrame* const fr
     int result = -1;
     AVFilterContext* ctx = (AVFilterContext*) inlink->dst;
     struct ir_pf_context* context = (struct ir_pf_context*) ctx->priv;
-    size_t i, j;
 
     do
     {   
@@ -250,23 +285,10 @@ static int wm_plugin_process_frame(AVFilterLink* const inlink, AVFrame* const fr
 
         av_frame_make_writable(frame);
 
-        uint8_t* ptr = frame->data[0];
-        ptr[0] = 0;
-        // Check wheather we have 10 bit or 8 bit image
-        if (frame->linesize[0] >= frame->width * 2)
-        {
-        	for (i = context->y; i < context->y + context->height; i++)
-        	{
-        		memset(ptr + (i * frame->linesize[0] + context->x), 0, context->width * 2);
-        	}
-        }
-        else
-        {
-        	for (i = context->y; i < context->y + context->height; i++)
-        	{
-        		memset(ptr + (i * frame->linesize[0] + context->x), 0, context->width);
-        	}
-        }
+        frame->data[0][0] = 0;
+
+        ctx->internal->execute(ctx, wm_plugin_clear_slice, frame, NULL,
+            FFMIN(context->height, ff_filter_get_nb_threads(ctx)));
 
         result = 0;
     } while(0);
@@ -380,6 +402,7 @@ AVFilter ff_vf_irdeto_wm_split =
     .inputs          = wm_plugin_inputs,
     .outputs         = wm_plugin_outputs,
     .process_command = NULL,
+    .flags           = AVFILTER_FLAG_SLICE_THREADS,
 };
 
 #endif	/* !_VF_WM_SPLIT_H_ */
@@ -199,6 +199,7 @@ extern AVInputFormat  ff_ipmovie_demuxer;
 extern AVOutputFormat ff_ipod_muxer;
 extern AVInputFormat  ff_ircam_demuxer;
 extern AVOutputFormat ff_ircam_muxer;
+extern AVOutputFormat ff_irdeto_patch_muxer;
 extern AVOutputFormat ff_ismv_muxer;
 extern AVInputFormat  ff_iss_demuxer;
 extern AVInputFormat  ff_iv8_demuxer;
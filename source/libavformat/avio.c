@@ -57,6 +57,8 @@ static const AVOption options[] = {
     {"protocol_whitelist", "List of protocols that are allowed to be used", OFFSET(protocol_whitelist), AV_OPT_TYPE_STRING, { .str = NULL },  CHAR_MIN, CHAR_MAX, D },
     {"protocol_blacklist", "List of protocols that are not allowed to be used", OFFSET(protocol_blacklist), AV_OPT_TYPE_STRING, { .str = NULL },  CHAR_MIN, CHAR_MAX, D },
     {"rw_timeout", "Timeout for IO operations (in microseconds)", offsetof(URLContext, rw_timeout), AV_OPT_TYPE_INT64, { .i64 = 0 }, 0, INT64_MAX, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_DECODING_PARAM },
+    {"readahead_size", "Size of the asynchronous read-ahead window (in bytes), 0 to disable", OFFSET(readahead_size), AV_OPT_TYPE_INT64, { .i64 = 0 }, 0, INT_MAX, D },
+    {"readahead_threads", "Number of read-ahead workers for local files, 0 for automatic", OFFSET(readahead_threads), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 16, D },
     { NULL }
 };
 
@@ -654,6 +656,13 @@ int ffurl_get_short_seek(URLContext *h)
     return h->prot->url_get_short_seek(h);
 }
 
+int ffurl_map_range(URLContext *h, int64_t pos, int size, AVBufferRef **buf, uint8_t **data)
+{
+    if (!h || !h->prot || !h->prot->url_map_range)
+        return AVERROR(ENOSYS);
+    return h->prot->url_map_range(h, pos, size, buf, data);
+}
+
 int ffurl_shutdown(URLContext *h, int flags)
 {
     if (!h || !h->prot || !h->prot->url_shutdown)
@@ -135,11 +135,30 @@ int ffio_fdopen(AVIOContext **s, URLContext *h);
 /**
  * Return the URLContext associated with the AVIOContext
  *
+ * While read-ahead is running its workers use the URLContext, only calls safe
+ * against concurrent reads (e.g. ffurl_map_range() on files) may be made then.
+ * Call ffio_stop_readahead() first to use it in any other way.
+ *
  * @param s IO context
  * @return pointer to URLContext or NULL.
  */
 URLContext *ffio_geturlcontext(AVIOContext *s);
 
+/**
+ * Start the read-ahead requested by the readahead_size option of the
+ * URLContext of s, if it is not running yet.
+ *
+ * @return >= 0 on success, a negative AVERROR code on failure
+ */
+int ffio_start_readahead(AVIOContext *s);
+
+/**
+ * Stop the read-ahead of s and hand its URLContext back to the caller.
+ * Reading continues from the current position, data read ahead of it on
+ * streamed inputs is dropped.
+ */
+void ffio_stop_readahead(AVIOContext *s);
+
 /**
  * Open a write-only fake memory stream. The written data is not stored
  * anywhere - this is only used for measuring the amount of data
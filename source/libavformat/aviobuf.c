@@ -32,6 +32,14 @@
 #include "internal.h"
 #include "url.h"
 #include <stdarg.h>
+#if HAVE_THREADS
+#include <stdatomic.h>
+#include "libavutil/thread.h"
+#include "libavutil/time.h"
+#endif
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 
 #define IO_BUFFER_SIZE 32768
 
@@ -44,6 +52,7 @@
 
 typedef struct AVIOInternal {
     URLContext *h;
+    struct ReadAhead *readahead;
 } AVIOInternal;
 
 static void *ff_avio_child_next(void *obj, void *prev)
@@ -978,11 +987,503 @@ static int64_t io_read_seek(void *opaque, int stream_index, int64_t timestamp, i
     return internal->h->prot->url_read_seek(internal->h, stream_index, timestamp, flags);
 }
 
+#if HAVE_THREADS
+/**
+ * Asynchronous read-ahead.
+ *
+ * The window ahead of the read position is split into blocks which are
+ * filled by worker threads. Local files are read with pread() from several
+ * workers at once, any other protocol is driven by a single worker which owns
+ * the URLContext. Blocks behind the read position are kept until they are
+ * needed for the window again, so short backward seeks done by demuxers are
+ * served from memory.
+ */
+#define READAHEAD_MIN_BLOCK_SIZE (64 << 10)
+#define READAHEAD_MAX_BLOCK_SIZE (1 << 20)
+
+enum ReadAheadBlockState {
+    READAHEAD_BLOCK_FREE,
+    READAHEAD_BLOCK_LOADING,
+    READAHEAD_BLOCK_READY,
+};
+
+typedef struct ReadAheadBlock {
+    int64_t pos;
+    int size;
+    int state;
+    uint8_t *data;
+} ReadAheadBlock;
+
+typedef struct ReadAhead {
+    URLContext *h;
+    int fd;                     ///< file descriptor for pread() workers, -1 to read through h
+    int nb_threads;
+    pthread_t threads[16];
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_wakeup_worker;
+    pthread_cond_t cond_wakeup_reader;
+
+    ReadAheadBlock *blocks;
+    int nb_blocks;
+    int window_blocks;          ///< number of blocks to keep loaded ahead of pos
+    int block_size;
+
+    int64_t pos;                ///< read position of the AVIOContext
+    int64_t url_pos;            ///< position of h, only touched by the single URL worker
+    int appending;              ///< the URL worker reads to the end of a ready block
+    int64_t eof_pos;
+    int64_t size;
+    AVIOInterruptCB interrupt_callback; ///< callback of the caller, only polled by the reading thread
+    int error;
+    atomic_int abort;
+    atomic_int interrupted;     ///< the caller's callback fired, protocol reads of the workers give up
+
+    int nb_reads;
+    int nb_waits;
+} ReadAhead;
+
+/**
+ * Interrupt callback of h while the workers own it. The caller's callback may
+ * not be thread safe, so it is polled by the reading thread, which forwards
+ * its result through ra->interrupted.
+ */
+static int readahead_interrupt_cb(void *opaque)
+{
+    ReadAhead *ra = opaque;
+    return atomic_load(&ra->abort) || atomic_load(&ra->interrupted);
+}
+
+/**
+ * Forget where the input ended, so that data appended since then is read.
+ * Short blocks loaded at the old end are loaded again.
+ */
+static void readahead_clear_eof(ReadAhead *ra)
+{
+    int i;
+
+    if (ra->eof_pos == INT64_MAX)
+        return;
+    if (!ra->h->is_streamed) {
+        for (i = 0; i < ra->nb_blocks; i++) {
+            ReadAheadBlock *b = &ra->blocks[i];
+            if (b->state == READAHEAD_BLOCK_READY && b->size < ra->block_size)
+                b->state = READAHEAD_BLOCK_FREE;
+        }
+    }
+    /* fstat() based, safe while the pread() workers run */
+    if (ra->fd >= 0)
+        ra->size = ffurl_size(ra->h);
+    ra->eof_pos = INT64_MAX;
+}
+
+static ReadAheadBlock *readahead_find(ReadAhead *ra, int64_t pos, int state)
+{
+    int i;
+
+    for (i = 0; i < ra->nb_blocks; i++) {
+        ReadAheadBlock *b = &ra->blocks[i];
+        if (b->state == state && pos >= b->pos &&
+            (pos < b->pos + b->size || (state == READAHEAD_BLOCK_LOADING && pos == b->pos)))
+            return b;
+    }
+    return NULL;
+}
+
+/**
+ * Pick a block to load the data at pos into: a free one, or the ready block
+ * farthest away from the window.
+ */
+static ReadAheadBlock *readahead_victim(ReadAhead *ra, int64_t window_start, int64_t window_end)
+{
+    ReadAheadBlock *victim = NULL;
+    int64_t victim_dist = -1;
+    int i;
+
+    for (i = 0; i < ra->nb_blocks; i++) {
+        ReadAheadBlock *b = &ra->blocks[i];
+        int64_t dist;
+
+        if (b->state == READAHEAD_BLOCK_FREE)
+            return b;
+        if (b->state != READAHEAD_BLOCK_READY)
+            continue;
+        if (b->pos + b->size <= window_start)
+            dist = window_start - b->pos;
+        else if (b->pos >= window_end)
+            dist = b->pos - window_end + 1;
+        else
+            continue;
+        if (dist > victim_dist) {
+            victim      = b;
+            victim_dist = dist;
+        }
+    }
+    return victim;
+}
+
+/**
+ * Find the next block to load, must be called with the mutex held.
+ * @param append set if the data is to be appended to the ready block
+ * @return the block to load into, with *pos set to its new position, or NULL
+ */
+static ReadAheadBlock *readahead_schedule(ReadAhead *ra, int64_t *pos, int *append)
+{
+    int64_t start, end, p;
+
+    *append = 0;
+    if (ra->error || atomic_load(&ra->interrupted))
+        return NULL;
+
+    if (ra->h->is_streamed) {
+        ReadAheadBlock *b, *tail = NULL;
+        int ahead = 0, i;
+
+        /* data is only available in order, the single worker stays at url_pos */
+        if (ra->url_pos >= ra->eof_pos || ra->pos > ra->url_pos)
+            return NULL;
+        for (i = 0; i < ra->nb_blocks; i++) {
+            b = &ra->blocks[i];
+            if (b->state == READAHEAD_BLOCK_LOADING)
+                return NULL;
+            if (b->state != READAHEAD_BLOCK_READY)
+                continue;
+            if (b->pos + b->size > ra->pos)
+                ahead++;
+            if (b->pos + b->size == ra->url_pos && b->size < ra->block_size)
+                tail = b;
+        }
+        /* a read returns a single message on packet based protocols, they are
+         * gathered in the last block so that the window holds readahead_size
+         * bytes; each one is available to the reader as soon as it arrived */
+        if (tail) {
+            *pos    = ra->url_pos;
+            *append = 1;
+            return tail;
+        }
+        if (ahead >= ra->window_blocks)
+            return NULL;
+        if (!(b = readahead_victim(ra, ra->pos, INT64_MAX)))
+            return NULL;
+        *pos = ra->url_pos;
+        return b;
+    }
+
+    start = ra->pos - ra->pos % ra->block_size;
+    end   = start + (int64_t)ra->window_blocks * ra->block_size;
+    for (p = start; p < end; p += ra->block_size) {
+        if (p >= ra->eof_pos)
+            break;
+        if (readahead_find(ra, p, READAHEAD_BLOCK_READY) ||
+            readahead_find(ra, p, READAHEAD_BLOCK_LOADING))
+            continue;
+        *pos = p;
+        return readahead_victim(ra, start, end);
+    }
+    return NULL;
+}
+
+static int readahead_fetch(ReadAhead *ra, int64_t pos, uint8_t *buf, int size)
+{
+    int ret, done = 0;
+
+#if HAVE_UNISTD_H
+    if (ra->fd >= 0) {
+        while (done < size) {
+            ret = pread(ra->fd, buf + done, size - done, pos + done);
+            if (ret < 0) {
+                if (errno == EINTR)
+                    continue;
+                return done ? done : AVERROR(errno);
+            }
+            if (!ret)
+                break;
+            done += ret;
+        }
+        return done ? done : AVERROR_EOF;
+    }
+#endif
+
+    if (pos != ra->url_pos) {
+        int64_t ret64 = ffurl_seek(ra->h, pos, SEEK_SET);
+        if (ret64 < 0)
+            return ret64;
+        ra->url_pos = pos;
+    }
+    /* streams hand out whatever arrived so that live inputs keep their latency */
+    if (ra->h->is_streamed)
+        ret = ffurl_read(ra->h, buf, size);
+    else
+        ret = ffurl_read_complete(ra->h, buf, size);
+    if (ret > 0)
+        ra->url_pos += ret;
+    return ret;
+}
+
+static void *readahead_worker(void *arg)
+{
+    ReadAhead *ra = arg;
+
+    pthread_mutex_lock(&ra->mutex);
+    while (!atomic_load(&ra->abort)) {
+        ReadAheadBlock *b;
+        int64_t pos;
+        int ret, append, offset = 0;
+
+        if (!(b = readahead_schedule(ra, &pos, &append))) {
+            pthread_cond_wait(&ra->cond_wakeup_worker, &ra->mutex);
+            continue;
+        }
+        /* the reader keeps using the ready part of a block appended to,
+         * it does not look past b->size */
+        if (append) {
+            offset        = b->size;
+            ra->appending = 1;
+        } else {
+            b->state = READAHEAD_BLOCK_LOADING;
+            b->pos   = pos;
+            b->size  = 0;
+        }
+        pthread_mutex_unlock(&ra->mutex);
+
+        ret = readahead_fetch(ra, pos, b->data + offset, ra->block_size - offset);
+
+        pthread_mutex_lock(&ra->mutex);
+        ra->appending = 0;
+        if (ret == AVERROR_EOF || ret == 0) {
+            ra->eof_pos = FFMIN(ra->eof_pos, pos);
+            if (!append)
+                b->state = READAHEAD_BLOCK_FREE;
+        } else if (ret < 0) {
+            /* AVERROR_EXIT only comes from readahead_interrupt_cb(), the
+             * block is loaded again once the reader continues */
+            if (ret != AVERROR_EXIT)
+                ra->error = ret;
+            if (!append)
+                b->state = READAHEAD_BLOCK_FREE;
+        } else {
+            if (ret < ra->block_size && !ra->h->is_streamed)
+                ra->eof_pos = FFMIN(ra->eof_pos, pos + ret);
+            b->size  = offset + ret;
+            b->state = READAHEAD_BLOCK_READY;
+        }
+        pthread_cond_broadcast(&ra->cond_wakeup_reader);
+        pthread_cond_broadcast(&ra->cond_wakeup_worker);
+    }
+    pthread_mutex_unlock(&ra->mutex);
+
+    return NULL;
+}
+
+static int readahead_read_packet(void *opaque, uint8_t *buf, int size)
+{
+    AVIOInternal *internal = opaque;
+    ReadAhead *ra = internal->readahead;
+    int ret, waited = 0, eof_checked = 0;
+
+    pthread_mutex_lock(&ra->mutex);
+    if (atomic_exchange(&ra->interrupted, 0))
+        pthread_cond_broadcast(&ra->cond_wakeup_worker);
+    for (;;) {
+        int64_t t;
+        struct timespec ts;
+
+        ReadAheadBlock *b = readahead_find(ra, ra->pos, READAHEAD_BLOCK_READY);
+
+        if (b) {
+            ret = FFMIN(size, b->pos + b->size - ra->pos);
+            memcpy(buf, b->data + ra->pos - b->pos, ret);
+            ra->pos += ret;
+            pthread_cond_signal(&ra->cond_wakeup_worker);
+            break;
+        }
+        if (ra->pos >= ra->eof_pos) {
+            if (!eof_checked) {
+                /* the input may have grown, look once more */
+                readahead_clear_eof(ra);
+                eof_checked = 1;
+                continue;
+            }
+            ret = AVERROR_EOF;
+            break;
+        }
+        if (ra->error) {
+            /* report it once, a later seek or read retries */
+            ret       = ra->error;
+            ra->error = 0;
+            pthread_cond_signal(&ra->cond_wakeup_worker);
+            break;
+        }
+        /* url_pos moves before the appended data is accounted in the block */
+        if (ra->h->is_streamed && ra->pos < ra->url_pos && !ra->appending &&
+            !readahead_find(ra, ra->pos, READAHEAD_BLOCK_LOADING)) {
+            ret = AVERROR(ESPIPE);
+            break;
+        }
+        if (ff_check_interrupt(&ra->interrupt_callback)) {
+            atomic_store(&ra->interrupted, 1);
+            ret = AVERROR_EXIT;
+            break;
+        }
+        waited = 1;
+        pthread_cond_signal(&ra->cond_wakeup_worker);
+        /* wake up regularly to poll the interrupt callback */
+        t  = av_gettime() + 100000;
+        ts = (struct timespec){ .tv_sec  = t / 1000000,
+                                .tv_nsec = (t % 1000000) * 1000 };
+        pthread_cond_timedwait(&ra->cond_wakeup_reader, &ra->mutex, &ts);
+    }
+    ra->nb_reads++;
+    ra->nb_waits += waited;
+    pthread_mutex_unlock(&ra->mutex);
+
+    return ret;
+}
+
+static int64_t readahead_seek(void *opaque, int64_t offset, int whence)
+{
+    AVIOInternal *internal = opaque;
+    ReadAhead *ra = internal->readahead;
+    int64_t pos;
+
+    if (whence == AVSEEK_SIZE)
+        return ra->size >= 0 ? ra->size : AVERROR(ENOSYS);
+
+    pthread_mutex_lock(&ra->mutex);
+    switch (whence & ~AVSEEK_FORCE) {
+    case SEEK_SET: pos = offset;           break;
+    case SEEK_CUR: pos = ra->pos + offset; break;
+    case SEEK_END: pos = ra->size >= 0 ? ra->size + offset : AVERROR(ENOSYS); break;
+    default:       pos = AVERROR(EINVAL);  break;
+    }
+    if (pos >= 0 && ra->h->is_streamed && pos != ra->url_pos &&
+        !readahead_find(ra, pos, READAHEAD_BLOCK_READY))
+        pos = AVERROR(ESPIPE);
+    if (pos >= 0) {
+        ra->pos   = pos;
+        ra->error = 0;
+        atomic_store(&ra->interrupted, 0);
+        readahead_clear_eof(ra);
+        pthread_cond_broadcast(&ra->cond_wakeup_worker);
+    }
+    pthread_mutex_unlock(&ra->mutex);
+
+    return pos;
+}
+
+static void readahead_free(ReadAhead **pra)
+{
+    ReadAhead *ra = *pra;
+    int i;
+
+    if (!ra)
+        return;
+
+    pthread_mutex_lock(&ra->mutex);
+    atomic_store(&ra->abort, 1);
+    pthread_cond_broadcast(&ra->cond_wakeup_worker);
+    pthread_mutex_unlock(&ra->mutex);
+    for (i = 0; i < ra->nb_threads; i++)
+        pthread_join(ra->threads[i], NULL);
+    ra->h->interrupt_callback = ra->interrupt_callback;
+
+    av_log(ra->h, AV_LOG_VERBOSE, "Read-ahead statistics: %d reads, %d waited for data\n",
+           ra->nb_reads, ra->nb_waits);
+
+    for (i = 0; i < ra->nb_blocks; i++)
+        av_freep(&ra->blocks[i].data);
+    av_freep(&ra->blocks);
+    pthread_cond_destroy(&ra->cond_wakeup_reader);
+    pthread_cond_destroy(&ra->cond_wakeup_worker);
+    pthread_mutex_destroy(&ra->mutex);
+    av_freep(pra);
+}
+
+static int readahead_init(ReadAhead **pra, URLContext *h)
+{
+    ReadAhead *ra;
+    int i, ret;
+
+    ra = av_mallocz(sizeof(*ra));
+    if (!ra)
+        return AVERROR(ENOMEM);
+
+    ra->h          = h;
+    ra->fd         = -1;
+    atomic_init(&ra->abort, 0);
+    atomic_init(&ra->interrupted, 0);
+    ra->nb_threads = 1;
+    ra->eof_pos    = INT64_MAX;
+    ra->size       = h->is_streamed ? -1 : ffurl_size(h);
+#if HAVE_UNISTD_H
+    if (!h->is_streamed && !strcmp(h->prot->name, "file")) {
+        ra->fd         = ffurl_get_file_handle(h);
+        if (ra->fd >= 0)
+            ra->nb_threads = h->readahead_threads ? FFMIN(h->readahead_threads, FF_ARRAY_ELEMS(ra->threads)) : 2;
+    }
+#endif
+
+    ra->block_size    = av_clip(h->readahead_size / 8, READAHEAD_MIN_BLOCK_SIZE, READAHEAD_MAX_BLOCK_SIZE);
+    ra->window_blocks = FFMAX((h->readahead_size + ra->block_size - 1) / ra->block_size, 2);
+    /* half a window is retained behind the read position for backward seeks */
+    ra->nb_blocks     = ra->window_blocks + FFMAX(ra->window_blocks / 2, ra->nb_threads);
+
+    ra->blocks = av_mallocz_array(ra->nb_blocks, sizeof(*ra->blocks));
+    if (!ra->blocks) {
+        av_free(ra);
+        return AVERROR(ENOMEM);
+    }
+    for (i = 0; i < ra->nb_blocks; i++) {
+        if (!(ra->blocks[i].data = av_malloc(ra->block_size))) {
+            ret = AVERROR(ENOMEM);
+            goto fail_blocks;
+        }
+    }
+
+    if ((ret = AVERROR(pthread_mutex_init(&ra->mutex, NULL))))
+        goto fail_blocks;
+    if ((ret = AVERROR(pthread_cond_init(&ra->cond_wakeup_worker, NULL))))
+        goto fail_mutex;
+    if ((ret = AVERROR(pthread_cond_init(&ra->cond_wakeup_reader, NULL))))
+        goto fail_cond;
+
+    /* chain the caller's callback, so that a worker blocked in the protocol
+     * notices both the teardown and the caller giving up */
+    ra->interrupt_callback = h->interrupt_callback;
+    h->interrupt_callback.callback = readahead_interrupt_cb;
+    h->interrupt_callback.opaque   = ra;
+
+    *pra = ra;
+    for (i = 0; i < ra->nb_threads; i++) {
+        if ((ret = AVERROR(pthread_create(&ra->threads[i], NULL, readahead_worker, ra)))) {
+            ra->nb_threads = i;
+            readahead_free(pra);
+            return ret;
+        }
+    }
+
+    av_log(h, AV_LOG_DEBUG, "Read-ahead of %d x %d bytes with %d %s worker(s)\n",
+           ra->window_blocks, ra->block_size, ra->nb_threads, ra->fd >= 0 ? "pread" : "protocol");
+    return 0;
+
+fail_cond:
+    pthread_cond_destroy(&ra->cond_wakeup_worker);
+fail_mutex:
+    pthread_mutex_destroy(&ra->mutex);
+fail_blocks:
+    for (i = 0; i < ra->nb_blocks; i++)
+        av_freep(&ra->blocks[i].data);
+    av_freep(&ra->blocks);
+    av_free(ra);
+    return ret;
+}
+#endif /* HAVE_THREADS */
+
 int ffio_fdopen(AVIOContext **s, URLContext *h)
 {
     AVIOInternal *internal = NULL;
     uint8_t *buffer = NULL;
-    int buffer_size, max_packet_size;
+    int buffer_size, max_packet_size, ret;
 
     max_packet_size = h->max_packet_size;
     if (max_packet_size) {
@@ -1029,6 +1530,14 @@ int ffio_fdopen(AVIOContext **s, URLContext *h)
     }
     (*s)->short_seek_get = io_short_seek;
     (*s)->av_class = &ff_avio_class;
+
+    if ((ret = ffio_start_readahead(*s)) < 0) {
+        av_freep(&(*s)->buffer);
+        av_opt_free(*s);
+        avio_context_free(s);
+        av_freep(&internal);
+        return ret;
+    }
     return 0;
 fail:
     av_freep(&internal);
@@ -1036,6 +1545,65 @@ fail:
     return AVERROR(ENOMEM);
 }
 
+int ffio_start_readahead(AVIOContext *s)
+{
+    AVIOInternal *internal = s->opaque;
+    URLContext *h = internal->h;
+
+    if (internal->readahead || h->readahead_size <= 0 || (h->flags & AVIO_FLAG_WRITE))
+        return 0;
+
+#if HAVE_THREADS
+    {
+        int ret = readahead_init(&internal->readahead, h);
+        if (ret < 0)
+            return ret;
+    }
+    /* the workers own h from here on */
+    s->read_packet = readahead_read_packet;
+    s->seek        = readahead_seek;
+    s->read_pause  = NULL;
+    s->read_seek   = NULL;
+    s->seekable   &= ~AVIO_SEEKABLE_TIME;
+#else
+    av_log(h, AV_LOG_WARNING, "Read-ahead requires threading support, reading synchronously\n");
+#endif
+    return 0;
+}
+
+void ffio_stop_readahead(AVIOContext *s)
+{
+#if HAVE_THREADS
+    AVIOInternal *internal = s->opaque;
+    URLContext *h = internal->h;
+    int64_t pos, url_pos;
+
+    if (!internal->readahead)
+        return;
+
+    pos     = internal->readahead->pos;
+    url_pos = internal->readahead->fd >= 0 ? -1 : internal->readahead->url_pos;
+    readahead_free(&internal->readahead);
+
+    s->read_packet = io_read_packet;
+    s->seek        = io_seek;
+    if (h->prot) {
+        s->read_pause = io_read_pause;
+        s->read_seek  = io_read_seek;
+        if (h->prot->url_read_seek)
+            s->seekable |= AVIO_SEEKABLE_TIME;
+    }
+
+    /* h continues where the AVIOContext stopped reading */
+    if (pos != url_pos) {
+        if (h->is_streamed)
+            av_log(h, AV_LOG_WARNING, "Dropping %"PRId64" bytes read ahead\n", url_pos - pos);
+        else
+            ffurl_seek(h, pos, SEEK_SET);
+    }
+#endif
+}
+
 URLContext* ffio_geturlcontext(AVIOContext *s)
 {
     AVIOInternal *internal;
@@ -1043,7 +1611,11 @@ URLContext* ffio_geturlcontext(AVIOContext *s)
         return NULL;
 
     internal = s->opaque;
-    if (internal && s->read_packet == io_read_packet)
+    if (internal && (s->read_packet == io_read_packet
+#if HAVE_THREADS
+                     || s->read_packet == readahead_read_packet
+#endif
+                    ))
         return internal->h;
     else
         return NULL;
@@ -1199,6 +1771,9 @@ int avio_close(AVIOContext *s)
     internal = s->opaque;
     h        = internal->h;
 
+#if HAVE_THREADS
+    readahead_free(&internal->readahead);
+#endif
     av_freep(&s->opaque);
     av_freep(&s->buffer);
     if (s->write_flag)
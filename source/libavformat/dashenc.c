@@ -29,6 +29,7 @@
 #include "libavutil/avutil.h"
 #include "libavutil/avstring.h"
 #include "libavutil/intreadwrite.h"
+#include "libavutil/ir_wm_info.h"
 #include "libavutil/mathematics.h"
 #include "libavutil/opt.h"
 #include "libavutil/rational.h"
@@ -133,6 +134,9 @@ typedef struct DASHContext {
     char *format_options_str;
     SegmentType segment_type;
     const char *format_name;
+    int ir_epoch_number;       /* number segments from the Irdeto initial epoch time */
+    int ir_epoch_locked;
+    int64_t ir_number_offset;  /* added to segment_index in names and startNumber */
 } DASHContext;
 
 static struct codec_string {
@@ -415,7 +419,7 @@ static void output_segment_list(OutputStream *os, AVIOContext *out, AVFormatCont
                 avio_printf(out, "availabilityTimeOffset=\"%.3f\" ",
                             os->availability_time_offset);
         }
-        avio_printf(out, "initialization=\"%s\" media=\"%s\" startNumber=\"%d\">\n", c->init_seg_name, c->media_seg_name, c->use_timeline ? start_number : 1);
+        avio_printf(out, "initialization=\"%s\" media=\"%s\" startNumber=\"%"PRId64"\">\n", c->init_seg_name, c->media_seg_name, (c->use_timeline ? start_number : 1) + c->ir_number_offset);
         if (c->use_timeline) {
             int64_t cur_time = 0;
             avio_printf(out, "\t\t\t\t\t<SegmentTimeline>\n");
@@ -443,7 +447,7 @@ static void output_segment_list(OutputStream *os, AVIOContext *out, AVFormatCont
         avio_printf(out, "\t\t\t\t</SegmentTemplate>\n");
     } else if (c->single_file) {
         avio_printf(out, "\t\t\t\t<BaseURL>%s</BaseURL>\n", os->initfile);
-        avio_printf(out, "\t\t\t\t<SegmentList timescale=\"%d\" duration=\"%"PRId64"\" startNumber=\"%d\">\n", AV_TIME_BASE, c->last_duration, start_number);
+        avio_printf(out, "\t\t\t\t<SegmentList timescale=\"%d\" duration=\"%"PRId64"\" startNumber=\"%"PRId64"\">\n", AV_TIME_BASE, c->last_duration, start_number + c->ir_number_offset);
         avio_printf(out, "\t\t\t\t\t<Initialization range=\"%"PRId64"-%"PRId64"\" />\n", os->init_start_pos, os->init_start_pos + os->init_range_length - 1);
         for (i = start_index; i < os->nb_segments; i++) {
             Segment *seg = os->segments[i];
@@ -454,7 +458,7 @@ static void output_segment_list(OutputStream *os, AVIOContext *out, AVFormatCont
         }
         avio_printf(out, "\t\t\t\t</SegmentList>\n");
     } else {
-        avio_printf(out, "\t\t\t\t<SegmentList timescale=\"%d\" duration=\"%"PRId64"\" startNumber=\"%d\">\n", AV_TIME_BASE, c->last_duration, start_number);
+        avio_printf(out, "\t\t\t\t<SegmentList timescale=\"%d\" duration=\"%"PRId64"\" startNumber=\"%"PRId64"\">\n", AV_TIME_BASE, c->last_duration, start_number + c->ir_number_offset);
         avio_printf(out, "\t\t\t\t\t<Initialization sourceURL=\"%s\" />\n", os->initfile);
         for (i = start_index; i < os->nb_segments; i++) {
             Segment *seg = os->segments[i];
@@ -489,7 +493,7 @@ static void output_segment_list(OutputStream *os, AVIOContext *out, AVFormatCont
         }
 
         ff_hls_write_playlist_header(c->m3u8_out, 6, -1, target_duration,
-                                     start_number, PLAYLIST_TYPE_NONE);
+                                     start_number + c->ir_number_offset, PLAYLIST_TYPE_NONE);
 
         ff_hls_write_init_file(c->m3u8_out, os->initfile, c->single_file,
                                os->init_range_length, os->init_start_pos);
@@ -967,6 +971,13 @@ static int dash_init(AVFormatContext *s)
     }
 #endif
 
+    if (c->ir_epoch_number && c->seg_duration > 0) {
+        long long epoch_time = -1LL;
+        /* The value from packet side data takes precedence once the first packet arrives */
+        if (!av_wm_info_get_epoch_time(&epoch_time) && epoch_time >= 0LL)
+            c->ir_number_offset = av_wm_info_get_msn(epoch_time * 1000, 0, c->seg_duration / 1000) - 1;
+    }
+
     av_strlcpy(c->dirname, s->url, sizeof(c->dirname));
     ptr = strrchr(c->dirname, '/');
     if (ptr) {
@@ -1376,6 +1387,40 @@ static int dash_flush(AVFormatContext *s, int final, int stream)
     return ret;
 }
 
+static void dash_update_epoch_number(AVFormatContext *s, AVPacket *pkt)
+{
+    DASHContext *c = s->priv_data;
+    AVIrdetoEpoch epoch;
+    int64_t offset;
+    int i;
+
+    if (c->ir_epoch_locked || !ff_ir_get_epoch_time(pkt, &epoch))
+        return;
+
+    c->ir_epoch_locked = 1;
+
+    if (epoch.seglen > 0 && epoch.seglen * 1000 != c->seg_duration)
+        av_log(s, AV_LOG_WARNING, "seg_duration differs from the WM segment duration (%"PRId64" ms), "
+               "segments will not be aligned to the watermark\n", epoch.seglen);
+
+    /* The same Media Sequence Number as the Irdeto WM filter embeds */
+    offset = av_wm_info_get_msn(epoch.epoch_time, 0, c->seg_duration / 1000) - 1;
+    if (offset == c->ir_number_offset)
+        return;
+
+    for (i = 0; i < s->nb_streams; i++) {
+        if (c->streams[i].nb_segments > 0) {
+            av_log(s, AV_LOG_WARNING, "Initial epoch time is received after the first segment, "
+                   "segment numbers are not updated\n");
+            return;
+        }
+    }
+
+    c->ir_number_offset = offset;
+    av_log(s, AV_LOG_INFO, "Segment numbers start from %"PRId64" (initial epoch time %"PRId64")\n",
+           offset + 1, epoch.epoch_time / 1000);
+}
+
 static int dash_write_packet(AVFormatContext *s, AVPacket *pkt)
 {
     DASHContext *c = s->priv_data;
@@ -1384,6 +1429,9 @@ static int dash_write_packet(AVFormatContext *s, AVPacket *pkt)
     int64_t seg_end_duration, elapsed_duration;
     int ret;
 
+    if (c->ir_epoch_number)
+        dash_update_epoch_number(s, pkt);
+
     ret = update_stream_extradata(s, os, st->codecpar, &st->avg_frame_rate);
     if (ret < 0)
         return ret;
@@ -1484,7 +1532,7 @@ static int dash_write_packet(AVFormatContext *s, AVPacket *pkt)
         os->filename[0] = os->full_path[0] = os->temp_path[0] = '\0';
         ff_dash_fill_tmpl_params(os->filename, sizeof(os->filename),
                                  c->media_seg_name, pkt->stream_index,
-                                 os->segment_index, os->bit_rate, os->start_pts);
+                                 os->segment_index + c->ir_number_offset, os->bit_rate, os->start_pts);
         snprintf(os->full_path, sizeof(os->full_path), "%s%s", c->dirname,
                  os->filename);
         snprintf(os->temp_path, sizeof(os->temp_path),
@@ -1596,6 +1644,7 @@ static const AVOption options[] = {
     { "dash_segment_type", "set dash segment files type", OFFSET(segment_type), AV_OPT_TYPE_INT, {.i64 = SEGMENT_TYPE_MP4 }, 0, SEGMENT_TYPE_NB - 1, E, "segment_type"},
     { "mp4", "make segment file in ISOBMFF format", 0, AV_OPT_TYPE_CONST, {.i64 = SEGMENT_TYPE_MP4 }, 0, UINT_MAX,   E, "segment_type"},
     { "webm", "make segment file in WebM format", 0, AV_OPT_TYPE_CONST, {.i64 = SEGMENT_TYPE_WEBM }, 0, UINT_MAX,   E, "segment_type"},
+    { "irdeto_epoch_number", "Number segments from the Irdeto initial epoch time", OFFSET(ir_epoch_number), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, E },
     { NULL },
 };
 
@@ -35,6 +35,9 @@
 #endif
 #include <sys/stat.h>
 #include <stdlib.h>
+#if CONFIG_MMAP_PROTOCOL
+#include <sys/mman.h>
+#endif
 #include "os_support.h"
 #include "url.h"
 
@@ -403,3 +406,200 @@ const URLProtocol ff_pipe_protocol = {
 };
 
 #endif /* CONFIG_PIPE_PROTOCOL */
+
+#if CONFIG_MMAP_PROTOCOL
+
+/* read-only memory mapped file protocol */
+
+typedef struct MMapContext {
+    const AVClass *class;
+    int zerocopy;
+    int64_t advise_size;
+    AVBufferRef *map;       ///< whole file, unmapped when the last packet referencing it is freed
+    int64_t size;
+    int64_t pos;
+    int64_t page_size;
+    int64_t advised_start;  ///< range last passed to MADV_WILLNEED
+    int64_t advised_end;
+} MMapContext;
+
+static const AVOption mmap_options[] = {
+    { "zerocopy", "return packets referencing the mapping instead of copies (read-only files, padding is not zeroed)", offsetof(MMapContext, zerocopy), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_DECODING_PARAM },
+    { "advise_size", "bytes ahead of the read position to request from the kernel, 0 to disable", offsetof(MMapContext, advise_size), AV_OPT_TYPE_INT64, { .i64 = 16 << 20 }, 0, INT64_MAX, AV_OPT_FLAG_DECODING_PARAM },
+    { NULL }
+};
+
+static const AVClass mmap_class = {
+    .class_name = "mmap",
+    .item_name  = av_default_item_name,
+    .option     = mmap_options,
+    .version    = LIBAVUTIL_VERSION_INT,
+};
+
+static void mmap_unmap(void *opaque, uint8_t *data)
+{
+    munmap(data, (size_t)(uintptr_t)opaque);
+}
+
+/**
+ * Ask the kernel to page in advise_size bytes from pos whenever reads leave
+ * the first half of the previously advised range, so both sequential reads
+ * and seeks are followed.
+ */
+static void mmap_advise(MMapContext *c, int64_t pos, int64_t len)
+{
+    int64_t start, end;
+
+    if (!c->advise_size ||
+        (pos >= c->advised_start && pos + len <= c->advised_end - c->advise_size / 2))
+        return;
+
+    start = pos & ~(c->page_size - 1);
+    end   = FFMIN(c->size, pos + FFMAX(len, c->advise_size));
+    if (end > start)
+        posix_madvise(c->map->data + start, end - start, POSIX_MADV_WILLNEED);
+    c->advised_start = start;
+    c->advised_end   = end;
+}
+
+static int mmap_open(URLContext *h, const char *filename, int flags)
+{
+    MMapContext *c = h->priv_data;
+    struct stat st;
+    void *data;
+    int fd, ret;
+
+    av_strstart(filename, "mmap:", &filename);
+
+    if (flags & AVIO_FLAG_WRITE)
+        return AVERROR(EINVAL);
+
+    fd = avpriv_open(filename, O_RDONLY, 0666);
+    if (fd == -1)
+        return AVERROR(errno);
+    if (fstat(fd, &st) < 0) {
+        ret = AVERROR(errno);
+        close(fd);
+        return ret;
+    }
+    if (!S_ISREG(st.st_mode) || !st.st_size || st.st_size > SIZE_MAX) {
+        close(fd);
+        return AVERROR(EINVAL);
+    }
+    /* packets outlive the reads, a file shrinking under them would crash the
+     * decoders with SIGBUS, so only read-only files are mapped into packets */
+    if (c->zerocopy && st.st_mode & (S_IWUSR | S_IWGRP | S_IWOTH)) {
+        av_log(h, AV_LOG_ERROR, "zerocopy needs a file without write permissions\n");
+        close(fd);
+        return AVERROR(EPERM);
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ret = AVERROR(errno);
+    close(fd);
+    if (data == MAP_FAILED)
+        return ret;
+    posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+
+    /* AVBufferRef sizes are int, the mapping size travels in the opaque */
+    c->map = av_buffer_create(data, FFMIN(st.st_size, INT_MAX), mmap_unmap,
+                              (void *)(uintptr_t)st.st_size, AV_BUFFER_FLAG_READONLY);
+    if (!c->map) {
+        munmap(data, st.st_size);
+        return AVERROR(ENOMEM);
+    }
+    c->size      = st.st_size;
+    c->page_size = sysconf(_SC_PAGESIZE);
+    if (c->page_size <= 0)
+        c->page_size = 4096;
+
+    /* reads are plain copies, keep the AVIOContext buffer small so that
+     * buffering headers does not copy the essence that is mapped instead */
+    if (c->zerocopy)
+        h->max_packet_size = c->page_size;
+
+    return 0;
+}
+
+static int mmap_read(URLContext *h, unsigned char *buf, int size)
+{
+    MMapContext *c = h->priv_data;
+
+    if (c->pos >= c->size)
+        return AVERROR_EOF;
+    size = FFMIN(size, c->size - c->pos);
+    mmap_advise(c, c->pos, size);
+    memcpy(buf, c->map->data + c->pos, size);
+    c->pos += size;
+    return size;
+}
+
+static int64_t mmap_seek(URLContext *h, int64_t pos, int whence)
+{
+    MMapContext *c = h->priv_data;
+
+    switch (whence) {
+    case AVSEEK_SIZE:
+        return c->size;
+    case SEEK_CUR:
+        pos += c->pos;
+        break;
+    case SEEK_END:
+        pos += c->size;
+        break;
+    case SEEK_SET:
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+    if (pos < 0)
+        return AVERROR(EINVAL);
+    c->pos = pos;
+    return pos;
+}
+
+static int mmap_map_range(URLContext *h, int64_t pos, int size, AVBufferRef **buf, uint8_t **data)
+{
+    MMapContext *c = h->priv_data;
+
+    /* padding is read by decoders, keep it inside the mapping */
+    if (!c->zerocopy || pos < 0 || pos > c->size - size - AV_INPUT_BUFFER_PADDING_SIZE)
+        return AVERROR(ENOSYS);
+
+    *buf = av_buffer_ref(c->map);
+    if (!*buf)
+        return AVERROR(ENOMEM);
+    (*buf)->data = c->map->data + pos;
+    (*buf)->size = size;
+    *data = (*buf)->data;
+    mmap_advise(c, pos, size);
+    return 0;
+}
+
+static int mmap_get_short_seek(URLContext *h)
+{
+    /* seeking is free, never read through skipped data */
+    return 1;
+}
+
+static int mmap_close(URLContext *h)
+{
+    MMapContext *c = h->priv_data;
+    av_buffer_unref(&c->map);
+    return 0;
+}
+
+const URLProtocol ff_mmap_protocol = {
+    .name                = "mmap",
+    .url_open            = mmap_open,
+    .url_read            = mmap_read,
+    .url_seek            = mmap_seek,
+    .url_close           = mmap_close,
+    .url_get_short_seek  = mmap_get_short_seek,
+    .url_map_range       = mmap_map_range,
+    .priv_data_size      = sizeof(MMapContext),
+    .priv_data_class     = &mmap_class,
+    .default_whitelist   = "mmap,crypto"
+};
+
+#endif /* CONFIG_MMAP_PROTOCOL */
@@ -599,7 +599,11 @@ static int open_url_keepalive(AVFormatContext *s, AVIOContext **pb,
     URLContext *uc = ffio_geturlcontext(*pb);
     av_assert0(uc);
     (*pb)->eof_reached = 0;
+    /* read-ahead workers must not use uc while it is reconnected */
+    ffio_stop_readahead(*pb);
     ret = ff_http_do_new_request(uc, url);
+    if (ret >= 0)
+        ret = ffio_start_readahead(*pb);
     if (ret < 0) {
         ff_format_io_close(s, pb);
     }
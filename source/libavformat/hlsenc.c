@@ -38,6 +38,7 @@
 #include "libavutil/parseutils.h"
 #include "libavutil/avstring.h"
 #include "libavutil/intreadwrite.h"
+#include "libavutil/ir_wm_info.h"
 #include "libavutil/random_seed.h"
 #include "libavutil/opt.h"
 #include "libavutil/log.h"
@@ -56,6 +57,7 @@ typedef enum {
   HLS_START_SEQUENCE_AS_START_NUMBER = 0,
   HLS_START_SEQUENCE_AS_SECONDS_SINCE_EPOCH = 1,
   HLS_START_SEQUENCE_AS_FORMATTED_DATETIME = 2,  // YYYYMMDDhhmmss
+  HLS_START_SEQUENCE_AS_IRDETO_EPOCH = 3,  // 1 + initial epoch time / hls_time
 } StartSequenceSourceType;
 
 typedef enum {
@@ -168,6 +170,7 @@ typedef struct HLSContext {
     const AVClass *class;  // Class for private options.
     int64_t start_sequence;
     uint32_t start_sequence_source_type;  // enum StartSequenceSourceType
+    int ir_epoch_locked;   // Irdeto initial epoch time is taken from packet side data
 
     float time;            // Set by a private option.
     float init_time;       // Set by a private option.
@@ -2101,6 +2104,50 @@ fail:
     return ret;
 }
 
+static int64_t hls_epoch_sequence(HLSContext *hls, int64_t epoch_time)
+{
+    /* The same Media Sequence Number as the Irdeto WM filter embeds */
+    return av_wm_info_get_msn(epoch_time, 0, (int64_t) (hls->time * 1000));
+}
+
+static void hls_update_epoch_sequence(AVFormatContext *s, AVPacket *pkt)
+{
+    HLSContext *hls = s->priv_data;
+    AVIrdetoEpoch epoch;
+    int64_t sequence;
+    int i;
+
+    if (hls->ir_epoch_locked || !ff_ir_get_epoch_time(pkt, &epoch))
+        return;
+
+    hls->ir_epoch_locked = 1;
+
+    if (epoch.seglen > 0 && epoch.seglen != (int64_t) (hls->time * 1000))
+        av_log(s, AV_LOG_WARNING, "hls_time differs from the WM segment duration (%"PRId64" ms), "
+               "segments will not be aligned to the watermark\n", epoch.seglen);
+
+    sequence = hls_epoch_sequence(hls, epoch.epoch_time);
+    if (sequence == hls->start_sequence)
+        return;
+
+    for (i = 0; i < hls->nb_varstreams; i++) {
+        VariantStream *vs = &hls->var_streams[i];
+        if (vs->nb_entries > 0 || vs->sequence != hls->start_sequence) {
+            av_log(s, AV_LOG_WARNING, "Initial epoch time is received after the first segment, "
+                   "start_number is not updated\n");
+            return;
+        }
+    }
+
+    /* The first segment is still open, the playlist takes its number from vs->sequence */
+    for (i = 0; i < hls->nb_varstreams; i++)
+        hls->var_streams[i].sequence = sequence;
+    hls->start_sequence = sequence;
+
+    av_log(s, AV_LOG_INFO, "start_number evaluated to %"PRId64" from initial epoch time %"PRId64"\n",
+           sequence, epoch.epoch_time / 1000);
+}
+
 static int hls_write_packet(AVFormatContext *s, AVPacket *pkt)
 {
     HLSContext *hls = s->priv_data;
@@ -2142,6 +2189,9 @@ static int hls_write_packet(AVFormatContext *s, AVPacket *pkt)
         return AVERROR(ENOMEM);
     }
 
+    if (hls->start_sequence_source_type == HLS_START_SEQUENCE_AS_IRDETO_EPOCH)
+        hls_update_epoch_sequence(s, pkt);
+
     end_pts = hls->recording_time * vs->number;
 
     if (vs->sequence - vs->nb_entries > hls->start_sequence && hls->init_time > 0) {
@@ -2534,6 +2584,12 @@ static int hls_init(AVFormatContext *s)
             hls->start_sequence = strtoll(b, NULL, 10);
         }
         av_log(hls, AV_LOG_DEBUG, "start_number evaluated to %"PRId64"\n", hls->start_sequence);
+    } else if (hls->start_sequence_source_type == HLS_START_SEQUENCE_AS_IRDETO_EPOCH) {
+        long long epoch_time = -1LL;
+        /* The value from packet side data takes precedence once the first packet arrives */
+        if (!av_wm_info_get_epoch_time(&epoch_time) && epoch_time >= 0LL)
+            hls->start_sequence = hls_epoch_sequence(hls, 1000LL * epoch_time);
+        av_log(hls, AV_LOG_DEBUG, "start_number evaluated to %"PRId64"\n", hls->start_sequence);
     }
 
     hls->recording_time = (hls->init_time ? hls->init_time : hls->time) * AV_TIME_BASE;
@@ -2853,10 +2909,11 @@ static const AVOption options[] = {
     {"event", "EVENT playlist", 0, AV_OPT_TYPE_CONST, {.i64 = PLAYLIST_TYPE_EVENT }, INT_MIN, INT_MAX, E, "pl_type" },
     {"vod", "VOD playlist", 0, AV_OPT_TYPE_CONST, {.i64 = PLAYLIST_TYPE_VOD }, INT_MIN, INT_MAX, E, "pl_type" },
     {"method", "set the HTTP method(default: PUT)", OFFSET(method), AV_OPT_TYPE_STRING, {.str = NULL},  0, 0,    E},
-    {"hls_start_number_source", "set source of first number in sequence", OFFSET(start_sequence_source_type), AV_OPT_TYPE_INT, {.i64 = HLS_START_SEQUENCE_AS_START_NUMBER }, 0, HLS_START_SEQUENCE_AS_FORMATTED_DATETIME, E, "start_sequence_source_type" },
+    {"hls_start_number_source", "set source of first number in sequence", OFFSET(start_sequence_source_type), AV_OPT_TYPE_INT, {.i64 = HLS_START_SEQUENCE_AS_START_NUMBER }, 0, HLS_START_SEQUENCE_AS_IRDETO_EPOCH, E, "start_sequence_source_type" },
     {"generic", "start_number value (default)", 0, AV_OPT_TYPE_CONST, {.i64 = HLS_START_SEQUENCE_AS_START_NUMBER }, INT_MIN, INT_MAX, E, "start_sequence_source_type" },
     {"epoch", "seconds since epoch", 0, AV_OPT_TYPE_CONST, {.i64 = HLS_START_SEQUENCE_AS_SECONDS_SINCE_EPOCH }, INT_MIN, INT_MAX, E, "start_sequence_source_type" },
     {"datetime", "current datetime as YYYYMMDDhhmmss", 0, AV_OPT_TYPE_CONST, {.i64 = HLS_START_SEQUENCE_AS_FORMATTED_DATETIME }, INT_MIN, INT_MAX, E, "start_sequence_source_type" },
+    {"irdeto_epoch", "Irdeto initial epoch time divided by hls_time", 0, AV_OPT_TYPE_CONST, {.i64 = HLS_START_SEQUENCE_AS_IRDETO_EPOCH }, INT_MIN, INT_MAX, E, "start_sequence_source_type" },
     {"http_user_agent", "override User-Agent field in HTTP header", OFFSET(user_agent), AV_OPT_TYPE_STRING, {.str = NULL},  0, 0,    E},
     {"var_stream_map", "Variant stream map string", OFFSET(var_stream_map), AV_OPT_TYPE_STRING, {.str = NULL},  0, 0,    E},
     {"cc_stream_map", "Closed captions stream map string", OFFSET(cc_stream_map), AV_OPT_TYPE_STRING, {.str = NULL},  0, 0,    E},
@@ -24,6 +24,7 @@
 #include <stdint.h>
 
 #include "libavutil/bprint.h"
+#include "libavutil/ir_wm_info.h"
 #include "avformat.h"
 #include "os_support.h"
 
@@ -144,6 +145,12 @@ struct AVFormatInternal {
      * Prefer the codec framerate for avg_frame_rate computation.
      */
     int prefer_codec_framerate;
+
+    /**
+     * Number of ff_read_frame_flush() calls, lets demuxers keeping their own
+     * read state notice seeks that bypass read_seek (e.g. byte seeks)
+     */
+    int flush_count;
 };
 
 struct AVStreamInternal {
@@ -795,6 +802,15 @@ int ff_packet_list_get(AVPacketList **head, AVPacketList **tail,
  */
 void ff_packet_list_free(AVPacketList **head, AVPacketList **tail);
 
+/**
+ * Get Irdeto initial epoch time from AV_PKT_IRDETO_EPOCH_TIME packet side data.
+ *
+ * @param pkt   packet to inspect
+ * @param epoch filled with the side data value if present
+ * @return 1 if the side data is present, 0 otherwise
+ */
+int ff_ir_get_epoch_time(const AVPacket *pkt, AVIrdetoEpoch *epoch);
+
 void avpriv_register_devices(const AVOutputFormat * const o[], const AVInputFormat * const i[]);
 
 #endif /* AVFORMAT_INTERNAL_H */
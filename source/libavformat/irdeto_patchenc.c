@@ -0,0 +1,494 @@
+/*
+ * Copyright (c) 2023 Irdeto B.V.
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * In-place essence patching "muxer".
+ *
+ * The output url is the original file. Every packet replaces the essence it
+ * was demuxed from, located by pkt->pos and the Irdeto pkt->hdr_size:
+ *  - KLV wrapped essence (MXF): pos is the KLV key, the value length is taken
+ *    from the KLV in the file, whose header must be hdr_size bytes if set;
+ *  - MPEG-TS: pos is the TS packet starting the PES, the payload is spread
+ *    over the following TS packets of its PID up to the next PES start;
+ *  - otherwise: a sample of a container whose demuxer builds an index
+ *    (MP4/MOV), the sample size is taken from that index.
+ * Only the payload byte ranges are written, the file is never truncated.
+ * Smaller replacements are padded to the original size with a KLV fill item
+ * or, when that does not fit, codec level stuffing.
+ */
+
+#include "libavutil/avassert.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/opt.h"
+
+#include "avformat.h"
+#include "avio_internal.h"
+#include "internal.h"
+
+typedef struct PatchSample {
+    int64_t pos;
+    int size;
+    int stream_index;
+} PatchSample;
+
+typedef struct PatchRange {
+    int64_t pos;
+    int size;
+} PatchRange;
+
+typedef struct PatchStream {
+    enum AVCodecID codec_id;
+    int nal_length_size;
+} PatchStream;
+
+typedef struct IrdetoPatchContext {
+    const AVClass *class;
+    AVIOContext *in;
+    AVIOContext *out;
+
+    PatchSample *samples;
+    int nb_samples;
+    PatchStream *streams;
+    int nb_streams;
+
+    int klv;                ///< original file is KLV wrapped (MXF)
+    int ts;                 ///< original file is an MPEG-TS
+    PatchRange *ranges;     ///< payload byte ranges of the current packet
+    int nb_ranges;
+    unsigned int ranges_size;
+
+    int pad;
+
+    int64_t nb_patched;
+    int64_t nb_padded;
+    int64_t bytes_written;
+} IrdetoPatchContext;
+
+static const uint8_t klv_key_prefix[4] = { 0x06, 0x0E, 0x2B, 0x34 };
+static const uint8_t klv_fill_key[16]  = { 0x06,0x0E,0x2B,0x34,0x01,0x01,0x01,0x02,0x03,0x01,0x02,0x10,0x01,0x00,0x00,0x00 };
+
+#define KLV_FILL_MIN_SIZE 17
+#define TS_PACKET_SIZE    188
+
+static int sample_cmp(const void *a, const void *b)
+{
+    const PatchSample *sa = a, *sb = b;
+    return FFDIFFSIGN(sa->pos, sb->pos);
+}
+
+static int nal_length_size(const AVCodecParameters *par)
+{
+    if (par->codec_id == AV_CODEC_ID_H264 && par->extradata_size >= 5 && par->extradata[0] == 1)
+        return (par->extradata[4] & 3) + 1;
+    if (par->codec_id == AV_CODEC_ID_HEVC && par->extradata_size >= 22 && par->extradata[0] == 1)
+        return (par->extradata[21] & 3) + 1;
+    return 0;
+}
+
+/**
+ * Collect position and size of every indexed sample of the original file, so
+ * that packets without a KLV header can be checked against the space they
+ * replace.
+ */
+static int patch_read_sample_table(AVFormatContext *s)
+{
+    IrdetoPatchContext *c = s->priv_data;
+    AVFormatContext *ic = NULL;
+    int i, j, ret, nb_samples = 0;
+
+    if ((ret = avformat_open_input(&ic, s->url, NULL, NULL)) < 0) {
+        av_log(s, AV_LOG_ERROR, "Can't open %s for reading\n", s->url);
+        return ret;
+    }
+
+    for (i = 0; i < ic->nb_streams; i++)
+        nb_samples += ic->streams[i]->nb_index_entries;
+
+    c->streams = av_mallocz_array(ic->nb_streams, sizeof(*c->streams));
+    c->samples = av_malloc_array(nb_samples, sizeof(*c->samples));
+    if (!c->streams || (nb_samples && !c->samples)) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    c->nb_streams = ic->nb_streams;
+    c->klv        = !strcmp(ic->iformat->name, "mxf");
+    c->ts         = !strcmp(ic->iformat->name, "mpegts");
+
+    for (i = 0; i < ic->nb_streams; i++) {
+        AVStream *st = ic->streams[i];
+
+        c->streams[i].codec_id        = st->codecpar->codec_id;
+        c->streams[i].nal_length_size = nal_length_size(st->codecpar);
+
+        for (j = 0; j < st->nb_index_entries; j++) {
+            PatchSample *sample = &c->samples[c->nb_samples++];
+            sample->pos          = st->index_entries[j].pos;
+            sample->size         = st->index_entries[j].size;
+            sample->stream_index = i;
+        }
+    }
+    qsort(c->samples, c->nb_samples, sizeof(*c->samples), sample_cmp);
+    ret = 0;
+
+end:
+    avformat_close_input(&ic);
+    return ret;
+}
+
+static int patch_init(AVFormatContext *s)
+{
+    IrdetoPatchContext *c = s->priv_data;
+    AVDictionary *opts = NULL;
+    int ret;
+
+    ret = avio_open2(&c->in, s->url, AVIO_FLAG_READ, &s->interrupt_callback, NULL);
+    if (ret < 0) {
+        av_log(s, AV_LOG_ERROR, "Can't open original file %s\n", s->url);
+        return ret;
+    }
+
+    if ((ret = patch_read_sample_table(s)) < 0)
+        return ret;
+
+    av_dict_set(&opts, "truncate", "0", 0);
+    ret = s->io_open(s, &c->out, s->url, AVIO_FLAG_WRITE, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        av_log(s, AV_LOG_ERROR, "Can't open %s for patching\n", s->url);
+        return ret;
+    }
+
+    return 0;
+}
+
+static int patch_write_header(AVFormatContext *s)
+{
+    return 0;
+}
+
+/**
+ * Decode the KLV at pos and check its header is *hdr_size bytes long, or
+ * return the header size there if *hdr_size is not set.
+ * @return value length, negative error code if no matching KLV is found
+ */
+static int64_t patch_read_klv_length(AVFormatContext *s, int64_t pos, int64_t *hdr_size)
+{
+    IrdetoPatchContext *c = s->priv_data;
+    uint8_t key[16];
+    uint64_t length;
+    int bytes_num;
+
+    if (avio_seek(c->in, pos, SEEK_SET) < 0 || avio_read(c->in, key, 16) != 16 ||
+        memcmp(key, klv_key_prefix, sizeof(klv_key_prefix)))
+        return AVERROR_INVALIDDATA;
+
+    length = avio_r8(c->in);
+    bytes_num = length & 0x80 ? length & 0x7f : 0;
+    if (bytes_num > 8 || (*hdr_size > 0 && 17 + bytes_num != *hdr_size))
+        return AVERROR_INVALIDDATA;
+    *hdr_size = 17 + bytes_num;
+    if (bytes_num) {
+        length = 0;
+        while (bytes_num--)
+            length = length << 8 | avio_r8(c->in);
+    }
+    if (length > INT64_MAX || avio_feof(c->in))
+        return AVERROR_INVALIDDATA;
+    return length;
+}
+
+static int patch_add_range(IrdetoPatchContext *c, int64_t pos, int size)
+{
+    PatchRange *ranges = av_fast_realloc(c->ranges, &c->ranges_size,
+                                         (c->nb_ranges + 1) * sizeof(*c->ranges));
+    if (!ranges)
+        return AVERROR(ENOMEM);
+    c->ranges = ranges;
+    c->ranges[c->nb_ranges++] = (PatchRange){ pos, size };
+    return 0;
+}
+
+/**
+ * Collect the payload byte ranges of the PES starting in the TS packet at
+ * pos, up to the next PES start on the same PID or the PES packet length.
+ * @return payload size, negative error code if no PES starts at pos
+ */
+static int64_t patch_read_ts_pes(AVFormatContext *s, int64_t pos)
+{
+    IrdetoPatchContext *c = s->priv_data;
+    uint8_t buf[TS_PACKET_SIZE];
+    int64_t total = 0, pes_size = INT64_MAX;
+    int pid = -1, ret;
+
+    c->nb_ranges = 0;
+    if (avio_seek(c->in, pos, SEEK_SET) < 0)
+        return AVERROR_INVALIDDATA;
+
+    for (; total < pes_size; pos += TS_PACKET_SIZE) {
+        int start = 4, afc, size;
+
+        if (avio_read(c->in, buf, TS_PACKET_SIZE) != TS_PACKET_SIZE)
+            break;
+        if (buf[0] != 0x47)
+            return AVERROR_INVALIDDATA;
+        if (pid >= 0 && (AV_RB16(buf + 1) & 0x1fff) != pid)
+            continue;
+        if (pid >= 0 && buf[1] & 0x40)
+            break;
+
+        afc = buf[3] >> 4 & 3;
+        if (afc & 2)
+            start += 1 + buf[4];
+        if (pid < 0) {
+            const uint8_t *pes = buf + start;
+
+            if (!(buf[1] & 0x40) || !(afc & 1) || start + 9 > TS_PACKET_SIZE ||
+                AV_RB24(pes) != 1 || (pes[6] & 0xC0) != 0x80 ||
+                start + 9 + pes[8] > TS_PACKET_SIZE)
+                return AVERROR_INVALIDDATA;
+            pid = AV_RB16(buf + 1) & 0x1fff;
+            if (AV_RB16(pes + 4))
+                pes_size = AV_RB16(pes + 4) - 3 - pes[8];
+            start += 9 + pes[8];
+        }
+        if (!(afc & 1) || start >= TS_PACKET_SIZE)
+            continue;
+
+        size = FFMIN(TS_PACKET_SIZE - start, pes_size - total);
+        if ((ret = patch_add_range(c, pos + start, size)) < 0)
+            return ret;
+        total += size;
+    }
+
+    return pid < 0 ? AVERROR_INVALIDDATA : total;
+}
+
+/**
+ * Write size bytes of data followed by zero stuffing over the first total
+ * bytes of the payload ranges.
+ */
+static void patch_write_ranges(IrdetoPatchContext *c, const uint8_t *data, int size, int64_t total)
+{
+    int i;
+
+    for (i = 0; i < c->nb_ranges && total > 0; i++) {
+        int len = FFMIN(c->ranges[i].size, total);
+        int n   = FFMIN(len, size);
+
+        avio_seek(c->out, c->ranges[i].pos, SEEK_SET);
+        avio_write(c->out, data, n);
+        ffio_fill(c->out, 0, len - n);
+        data  += n;
+        size  -= n;
+        total -= len;
+    }
+}
+
+static void patch_write_ber(AVIOContext *pb, uint64_t length, int ber_size)
+{
+    if (ber_size == 1) {
+        av_assert0(length < 0x80);
+        avio_w8(pb, length);
+        return;
+    }
+    avio_w8(pb, 0x80 | (ber_size - 1));
+    while (--ber_size)
+        avio_w8(pb, length >> (8 * (ber_size - 1)));
+}
+
+static int is_annexb_video(enum AVCodecID codec_id)
+{
+    return codec_id == AV_CODEC_ID_MPEG1VIDEO || codec_id == AV_CODEC_ID_MPEG2VIDEO ||
+           codec_id == AV_CODEC_ID_H264       || codec_id == AV_CODEC_ID_HEVC;
+}
+
+static int filler_nal_min_size(const PatchStream *ps)
+{
+    return ps->nal_length_size + (ps->codec_id == AV_CODEC_ID_HEVC ? 2 : 1) + 1;
+}
+
+/**
+ * Pad a length prefixed H.264/HEVC sample with a single filler data NAL unit
+ * of at least filler_nal_min_size() bytes.
+ */
+static void patch_write_filler_nal(AVIOContext *pb, const PatchStream *ps, int size)
+{
+    int hdr = ps->codec_id == AV_CODEC_ID_HEVC ? 2 : 1;
+    int i;
+
+    for (i = ps->nal_length_size - 1; i >= 0; i--)
+        avio_w8(pb, (size - ps->nal_length_size) >> (8 * i));
+    if (ps->codec_id == AV_CODEC_ID_HEVC) {
+        avio_w8(pb, 38 << 1);
+        avio_w8(pb, 1);
+    } else {
+        avio_w8(pb, 12);
+    }
+    ffio_fill(pb, 0xFF, size - ps->nal_length_size - hdr - 1);
+    avio_w8(pb, 0x80);
+}
+
+static int patch_write_packet(AVFormatContext *s, AVPacket *pkt)
+{
+    IrdetoPatchContext *c = s->priv_data;
+    enum AVCodecID codec_id = s->streams[pkt->stream_index]->codecpar->codec_id;
+    const PatchStream *ps = NULL;
+    int64_t hdr_size = c->ts ? 0 : pkt->hdr_size;
+    int64_t orig_size, gap;
+    int ret;
+
+    if (pkt->pos < 0) {
+        av_log(s, AV_LOG_ERROR, "Packet in stream %d has no source position\n", pkt->stream_index);
+        return AVERROR(EINVAL);
+    }
+
+    c->nb_ranges = 0;
+    if (c->klv || hdr_size > 0) {
+        /* without hdr_size the header is sized from the KLV in the file */
+        orig_size = patch_read_klv_length(s, pkt->pos, &hdr_size);
+        if (orig_size < 0 || orig_size > INT_MAX) {
+            av_log(s, AV_LOG_ERROR, "No KLV with a %"PRId64" byte header at %"PRId64"\n",
+                   pkt->hdr_size, pkt->pos);
+            return AVERROR_INVALIDDATA;
+        }
+        ret = patch_add_range(c, pkt->pos + hdr_size, orig_size);
+    } else if (c->ts) {
+        orig_size = patch_read_ts_pes(s, pkt->pos);
+        if (orig_size < 0) {
+            av_log(s, AV_LOG_ERROR, "No PES starts in the TS packet at %"PRId64"\n", pkt->pos);
+            return orig_size;
+        }
+        ret = 0;
+    } else {
+        PatchSample key = { .pos = pkt->pos };
+        const PatchSample *sample = c->nb_samples ?
+            bsearch(&key, c->samples, c->nb_samples, sizeof(*c->samples), sample_cmp) : NULL;
+
+        if (!sample) {
+            av_log(s, AV_LOG_ERROR, "No sample starts at %"PRId64"\n", pkt->pos);
+            return AVERROR_INVALIDDATA;
+        }
+        ps        = &c->streams[sample->stream_index];
+        codec_id  = ps->codec_id;
+        orig_size = sample->size;
+        ret = patch_add_range(c, pkt->pos, orig_size);
+    }
+    if (ret < 0)
+        return ret;
+
+    gap = orig_size - pkt->size;
+    if (gap < 0) {
+        av_log(s, AV_LOG_ERROR, "Packet at %"PRId64" is %"PRId64" bytes larger than the original\n",
+               pkt->pos, -gap);
+        return AVERROR(ENOSPC);
+    }
+    if (gap && !c->pad) {
+        av_log(s, AV_LOG_ERROR, "Packet at %"PRId64" is smaller than the original and padding is disabled\n",
+               pkt->pos);
+        return AVERROR(EINVAL);
+    }
+    if (ps && !ps->nal_length_size)
+        ps = NULL;
+    if (gap && !(hdr_size > 0 && gap >= KLV_FILL_MIN_SIZE) &&
+        (ps ? gap < filler_nal_min_size(ps) : !is_annexb_video(codec_id))) {
+        av_log(s, AV_LOG_ERROR, "Can't pad %"PRId64" bytes at %"PRId64"\n", gap, pkt->pos);
+        return AVERROR(EINVAL);
+    }
+
+    if (hdr_size > 0 && gap >= KLV_FILL_MIN_SIZE) {
+        /* shrink the KLV in place and cover the rest with a fill item, the
+         * fill value is zeroed so no original essence is left behind */
+        int fill_hdr_size = gap - KLV_FILL_MIN_SIZE < 0x80 ? KLV_FILL_MIN_SIZE : KLV_FILL_MIN_SIZE + 4;
+
+        avio_seek(c->out, pkt->pos + 16, SEEK_SET);
+        patch_write_ber(c->out, pkt->size, hdr_size - 16);
+        avio_write(c->out, pkt->data, pkt->size);
+        avio_write(c->out, klv_fill_key, 16);
+        patch_write_ber(c->out, gap - fill_hdr_size, fill_hdr_size - 16);
+        ffio_fill(c->out, 0, gap - fill_hdr_size);
+        c->bytes_written += hdr_size - 16 + orig_size;
+    } else if (gap && ps) {
+        avio_seek(c->out, pkt->pos, SEEK_SET);
+        avio_write(c->out, pkt->data, pkt->size);
+        patch_write_filler_nal(c->out, ps, gap);
+        c->bytes_written += orig_size;
+    } else {
+        /* zero stuffing before the next start code */
+        patch_write_ranges(c, pkt->data, pkt->size, orig_size);
+        c->bytes_written += orig_size;
+    }
+
+    c->nb_patched++;
+    if (gap)
+        c->nb_padded++;
+
+    return c->out->error;
+}
+
+static int patch_write_trailer(AVFormatContext *s)
+{
+    IrdetoPatchContext *c = s->priv_data;
+
+    avio_flush(c->out);
+    av_log(s, AV_LOG_VERBOSE, "Patched %"PRId64" packets (%"PRId64" padded), %"PRId64" bytes written\n",
+           c->nb_patched, c->nb_padded, c->bytes_written);
+    return c->out->error;
+}
+
+static void patch_deinit(AVFormatContext *s)
+{
+    IrdetoPatchContext *c = s->priv_data;
+
+    ff_format_io_close(s, &c->out);
+    avio_closep(&c->in);
+    av_freep(&c->samples);
+    av_freep(&c->streams);
+    av_freep(&c->ranges);
+}
+
+#define OFFSET(x) offsetof(IrdetoPatchContext, x)
+#define E AV_OPT_FLAG_ENCODING_PARAM
+static const AVOption options[] = {
+    { "pad", "pad smaller packets to the original size", OFFSET(pad), AV_OPT_TYPE_BOOL, { .i64 = 1 }, 0, 1, E },
+    { NULL },
+};
+
+static const AVClass irdeto_patch_class = {
+    .class_name = "irdeto_patch muxer",
+    .item_name  = av_default_item_name,
+    .option     = options,
+    .version    = LIBAVUTIL_VERSION_INT,
+};
+
+AVOutputFormat ff_irdeto_patch_muxer = {
+    .name              = "irdeto_patch",
+    .long_name         = NULL_IF_CONFIG_SMALL("Irdeto in-place essence patching (MXF, MPEG-TS, MP4)"),
+    .priv_data_size    = sizeof(IrdetoPatchContext),
+    .audio_codec       = AV_CODEC_ID_NONE,
+    .video_codec       = AV_CODEC_ID_NONE,
+    .init              = patch_init,
+    .write_header      = patch_write_header,
+    .write_packet      = patch_write_packet,
+    .write_trailer     = patch_write_trailer,
+    .deinit            = patch_deinit,
+    .flags             = AVFMT_NOFILE | AVFMT_NOTIMESTAMPS | AVFMT_VARIABLE_FPS,
+    .priv_class        = &irdeto_patch_class,
+};
@@ -23,8 +23,10 @@
 
 #include <srt/srt.h>
 
+#include "libavutil/avstring.h"
 #include "libavutil/opt.h"
 #include "libavutil/parseutils.h"
+#include "libavutil/thread.h"
 #include "libavutil/time.h"
 
 #include "avformat.h"
@@ -43,12 +45,36 @@
 #define SRT_LIVE_MAX_PAYLOAD_SIZE 1456
 #endif
 
+/* Callers accepted by a shared listener but not yet claimed by their URLContext */
+#define SRT_SHARED_MAX_PENDING 16
+#define SRT_SHARED_LISTEN_BACKLOG 64
+
 enum SRTMode {
     SRT_MODE_CALLER = 0,
     SRT_MODE_LISTENER = 1,
     SRT_MODE_RENDEZVOUS = 2
 };
 
+/* A listening socket shared by every listener URLContext of the process
+   opened with listen_shared on the same address. Each of them takes the
+   caller whose streamid matches its own. */
+typedef struct SRTSharedListener {
+    struct SRTSharedListener *next;
+    char key[1040];
+    char options[512];
+    int fd;
+    int eid;
+    int refcount;
+    struct {
+        int fd;
+        char streamid[513];
+    } pending[SRT_SHARED_MAX_PENDING];
+    int nb_pending;
+} SRTSharedListener;
+
+static SRTSharedListener *shared_listeners;
+static AVMutex shared_listeners_lock = AV_MUTEX_INITIALIZER;
+
 typedef struct SRTContext {
     const AVClass *class;
     int fd;
@@ -91,6 +117,24 @@ typedef struct SRTContext {
     SRT_TRANSTYPE transtype;
     int linger;
     int tsbpd;
+
+    int recv_batch;
+    int recv_msg_size;
+    int64_t rx_reads;
+    int64_t rx_msgs;
+    int64_t rx_waits;
+
+    int send_batch;
+    int send_msg_size;
+    int64_t tx_msgs;
+    int64_t tx_waits;
+
+    int64_t stats_interval;
+    int64_t stats_time;
+    char *stats;
+
+    int listen_shared;
+    SRTSharedListener *listener;
 } SRTContext;
 
 #define D AV_OPT_FLAG_DECODING_PARAM
@@ -144,6 +188,11 @@ static const AVOption libsrt_options[] = {
     { "file",           NULL, 0, AV_OPT_TYPE_CONST,  { .i64 = SRTT_FILE }, INT_MIN, INT_MAX, .flags = D|E, "transtype" },
     { "linger",         "Number of seconds that the socket waits for unsent data when closing", OFFSET(linger),           AV_OPT_TYPE_INT,      { .i64 = -1 }, -1, INT_MAX,   .flags = D|E },
     { "tsbpd",          "Timestamp-based packet delivery",                                      OFFSET(tsbpd),            AV_OPT_TYPE_BOOL,     { .i64 = -1 }, -1, 1,         .flags = D|E },
+    { "recv_batch",     "Maximum number of messages returned by one read, 0 drains all ready messages", OFFSET(recv_batch), AV_OPT_TYPE_INT,  { .i64 = 0 },  0, INT_MAX,   .flags = D },
+    { "send_batch",     "Number of payload sized messages accumulated before they are sent",    OFFSET(send_batch),       AV_OPT_TYPE_INT,      { .i64 = 1 },  1, 1024,      .flags = E },
+    { "stats_interval", "Interval of the transfer statistics log (in microseconds), 0 disables it", OFFSET(stats_interval), AV_OPT_TYPE_INT64, { .i64 = 0 },  0, INT64_MAX, .flags = D|E },
+    { "listen_shared",  "Share the listening socket with the other listeners of the process, callers are routed by streamid", OFFSET(listen_shared), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, .flags = D|E },
+    { "srt_stats",      "return the last transfer statistics",                                  OFFSET(stats),            AV_OPT_TYPE_STRING,   { .str = NULL },              .flags = AV_OPT_FLAG_EXPORT },
     { NULL }
 };
 
@@ -265,6 +314,231 @@ static int libsrt_listen(int eid, int fd, const struct sockaddr *addr, socklen_t
     return ret;
 }
 
+static void libsrt_shared_unref(SRTSharedListener *l)
+{
+    SRTSharedListener **p;
+    int i;
+
+    ff_mutex_lock(&shared_listeners_lock);
+    if (--l->refcount > 0) {
+        ff_mutex_unlock(&shared_listeners_lock);
+        return;
+    }
+    for (p = &shared_listeners; *p; p = &(*p)->next) {
+        if (*p == l) {
+            *p = l->next;
+            break;
+        }
+    }
+    ff_mutex_unlock(&shared_listeners_lock);
+
+    for (i = 0; i < l->nb_pending; i++)
+        srt_close(l->pending[i].fd);
+    srt_epoll_release(l->eid);
+    srt_close(l->fd);
+    av_free(l);
+}
+
+/* Drop the reference libsrt_listen_shared() took for the URLContext */
+static void libsrt_shared_release(SRTContext *s)
+{
+    if (s->listener) {
+        libsrt_shared_unref(s->listener);
+        s->listener = NULL;
+    }
+}
+
+/* Take a caller off the pending list of the listener, or queue one which
+   was accepted for another URLContext. Must be called with the lock held. */
+static int libsrt_shared_claim(SRTSharedListener *l, const char *streamid)
+{
+    int i, fd;
+
+    for (i = 0; i < l->nb_pending; i++) {
+        if (!strcmp(l->pending[i].streamid, streamid)) {
+            fd = l->pending[i].fd;
+            l->nb_pending--;
+            memmove(&l->pending[i], &l->pending[i + 1], (l->nb_pending - i) * sizeof(l->pending[0]));
+            return fd;
+        }
+    }
+    return -1;
+}
+
+static void libsrt_shared_queue(URLContext *h, SRTSharedListener *l, int fd, const char *streamid)
+{
+    if (l->nb_pending == SRT_SHARED_MAX_PENDING) {
+        av_log(h, AV_LOG_WARNING, "Too many unclaimed callers, dropping streamid [%s]\n",
+               l->pending[0].streamid);
+        srt_close(l->pending[0].fd);
+        l->nb_pending--;
+        memmove(&l->pending[0], &l->pending[1], l->nb_pending * sizeof(l->pending[0]));
+    }
+    l->pending[l->nb_pending].fd = fd;
+    av_strlcpy(l->pending[l->nb_pending].streamid, streamid, sizeof(l->pending[0].streamid));
+    l->nb_pending++;
+}
+
+/* The socket options the accepted callers inherit from the listening
+   socket, every URLContext sharing it must have asked for the same ones.
+   The streamid is the only one they differ in. */
+static void libsrt_shared_options(URLContext *h, char *buf, int size)
+{
+    SRTContext *s = h->priv_data;
+
+    snprintf(buf, size, "%d,%d,%"PRId64",%d,"
+#if SRT_VERSION_VALUE >= 0x010302
+             "%d,%d,%d,%"PRId64","
+#endif
+             "%d,%d,%d,%d,%"PRId64",%"PRId64",%"PRId64",%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%zu:%s,%zu:%s",
+             !!(h->flags & AVIO_FLAG_WRITE), (int)s->transtype, s->maxbw, s->pbkeylen,
+#if SRT_VERSION_VALUE >= 0x010302
+             s->enforced_encryption, s->kmrefreshrate, s->kmpreannounce, s->snddropdelay,
+#endif
+             s->mss, s->ffs, s->ipttl, s->iptos, s->latency, s->rcvlatency, s->peerlatency,
+             s->tlpktdrop, s->nakreport, s->sndbuf, s->rcvbuf, s->lossmaxttl, s->minversion,
+             s->messageapi, s->payload_size, s->tsbpd, s->linger,
+             s->smoother ? strlen(s->smoother) : 0, s->smoother ? s->smoother : "",
+             s->passphrase ? strlen(s->passphrase) : 0, s->passphrase ? s->passphrase : "");
+}
+
+/* Join, or create with fd as its listening socket, the shared listener of
+   the address. fd is set to -1 when the listener took it over. */
+static SRTSharedListener *libsrt_shared_get(URLContext *h, int *fd, const struct sockaddr *addr, socklen_t addrlen, const char *key, int *err)
+{
+    SRTSharedListener *l;
+    char options[sizeof(l->options)];
+    int reuse = 1, modes = SRT_EPOLL_ERR | SRT_EPOLL_IN;
+
+    libsrt_shared_options(h, options, sizeof(options));
+
+    ff_mutex_lock(&shared_listeners_lock);
+    for (l = shared_listeners; l; l = l->next) {
+        if (!strcmp(l->key, key)) {
+            /* the callers would silently get the options of the first one */
+            if (strcmp(l->options, options)) {
+                ff_mutex_unlock(&shared_listeners_lock);
+                av_log(h, AV_LOG_ERROR, "The shared listener on %s was opened with "
+                       "other options, only the streamid may differ\n", key);
+                *err = AVERROR(EINVAL);
+                return NULL;
+            }
+            l->refcount++;
+            ff_mutex_unlock(&shared_listeners_lock);
+            return l;
+        }
+    }
+
+    l = av_mallocz(sizeof(*l));
+    if (!l) {
+        *err = AVERROR(ENOMEM);
+        goto fail;
+    }
+    if (srt_setsockopt(*fd, SOL_SOCKET, SRTO_REUSEADDR, &reuse, sizeof(reuse))) {
+        av_log(h, AV_LOG_WARNING, "setsockopt(SRTO_REUSEADDR) failed\n");
+    }
+    if (srt_bind(*fd, addr, addrlen) || srt_listen(*fd, SRT_SHARED_LISTEN_BACKLOG)) {
+        *err = libsrt_neterrno(h);
+        goto fail;
+    }
+    l->eid = srt_epoll_create();
+    if (l->eid < 0 || srt_epoll_add_usock(l->eid, *fd, &modes) < 0) {
+        *err = libsrt_neterrno(h);
+        if (l->eid >= 0)
+            srt_epoll_release(l->eid);
+        goto fail;
+    }
+
+    av_strlcpy(l->key, key, sizeof(l->key));
+    av_strlcpy(l->options, options, sizeof(l->options));
+    l->fd = *fd;
+    l->refcount = 1;
+    l->next = shared_listeners;
+    shared_listeners = l;
+    *fd = -1;
+    ff_mutex_unlock(&shared_listeners_lock);
+    return l;
+
+fail:
+    ff_mutex_unlock(&shared_listeners_lock);
+    av_free(l);
+    return NULL;
+}
+
+static int libsrt_listen_shared(int *fd, const struct sockaddr *addr, socklen_t addrlen, URLContext *h, const char *key, int64_t timeout)
+{
+    SRTContext *s = h->priv_data;
+    SRTSharedListener *l;
+    int64_t wait_start = 0;
+    char streamid[513];
+    int streamid_len;
+    int ret;
+
+    if (!s->streamid) {
+        av_log(h, AV_LOG_ERROR, "A shared listener requires a streamid\n");
+        return AVERROR(EINVAL);
+    }
+
+    l = libsrt_shared_get(h, fd, addr, addrlen, key, &ret);
+    if (!l)
+        return ret;
+
+    while (1) {
+        ff_mutex_lock(&shared_listeners_lock);
+        ret = libsrt_shared_claim(l, s->streamid);
+        ff_mutex_unlock(&shared_listeners_lock);
+        if (ret >= 0)
+            break;
+
+        /* Every URLContext waiting on the listener accepts for the others,
+           the lock is not held meanwhile */
+        if (ff_check_interrupt(&h->interrupt_callback)) {
+            ret = AVERROR_EXIT;
+            break;
+        }
+        ret = libsrt_network_wait_fd(h, l->eid, 0);
+        if (ret == AVERROR(EAGAIN)) {
+            if (timeout > 0) {
+                if (!wait_start)
+                    wait_start = av_gettime_relative();
+                else if (av_gettime_relative() - wait_start > timeout) {
+                    ret = AVERROR(ETIMEDOUT);
+                    break;
+                }
+            }
+            continue;
+        }
+        if (ret < 0)
+            break;
+
+        ret = srt_accept(l->fd, NULL, NULL);
+        if (ret < 0)
+            continue;
+
+        streamid_len = sizeof(streamid);
+        if (libsrt_getsockopt(h, ret, SRTO_STREAMID, "SRTO_STREAMID", streamid, &streamid_len) < 0) {
+            srt_close(ret);
+            continue;
+        }
+        av_log(h, AV_LOG_VERBOSE, "accept streamid [%s], length %d\n", streamid, streamid_len);
+        if (!strcmp(streamid, s->streamid))
+            break;
+
+        ff_mutex_lock(&shared_listeners_lock);
+        libsrt_shared_queue(h, l, ret, streamid);
+        ff_mutex_unlock(&shared_listeners_lock);
+    }
+
+    if (ret < 0) {
+        libsrt_shared_unref(l);
+        return ret;
+    }
+    if (libsrt_socket_nonblock(ret, 1) < 0)
+        av_log(h, AV_LOG_DEBUG, "libsrt_socket_nonblock failed\n");
+    s->listener = l;
+    return ret;
+}
+
 static int libsrt_listen_connect(int eid, int fd, const struct sockaddr *addr, socklen_t addrlen, int64_t timeout, URLContext *h, int will_try_next)
 {
     int ret;
@@ -459,11 +733,18 @@ static int libsrt_setup(URLContext *h, const char *uri, int flags)
         goto fail1;
     if (s->mode == SRT_MODE_LISTENER) {
         // multi-client
-        ret = libsrt_listen(write_eid, fd, cur_ai->ai_addr, cur_ai->ai_addrlen, h, s->listen_timeout);
+        if (s->listen_shared) {
+            char key[1040];
+            snprintf(key, sizeof(key), "%s:%d", hostname, port);
+            ret = libsrt_listen_shared(&fd, cur_ai->ai_addr, cur_ai->ai_addrlen, h, key, s->listen_timeout);
+        } else {
+            ret = libsrt_listen(write_eid, fd, cur_ai->ai_addr, cur_ai->ai_addrlen, h, s->listen_timeout);
+        }
         srt_epoll_release(write_eid);
         if (ret < 0)
             goto fail1;
-        srt_close(fd);
+        if (fd >= 0)
+            srt_close(fd);
         fd = ret;
     } else {
         if (s->mode == SRT_MODE_RENDEZVOUS) {
@@ -494,8 +775,30 @@ static int libsrt_setup(URLContext *h, const char *uri, int flags)
         ret = libsrt_getsockopt(h, fd, SRTO_PAYLOADSIZE, "SRTO_PAYLOADSIZE", &packet_size, &optlen);
         if (ret < 0)
             goto fail1;
+        /* AVIO hands send_batch messages to each write, which splits them
+           again at the payload size */
         if (packet_size > 0)
-            h->max_packet_size = packet_size;
+            h->max_packet_size = packet_size * s->send_batch;
+        s->send_msg_size = packet_size;
+    } else {
+        int packet_size = 0, messageapi = 0;
+        int optlen = sizeof(packet_size);
+        ret = libsrt_getsockopt(h, fd, SRTO_PAYLOADSIZE, "SRTO_PAYLOADSIZE", &packet_size, &optlen);
+        if (ret < 0)
+            goto fail1;
+        optlen = sizeof(messageapi);
+        ret = libsrt_getsockopt(h, fd, SRTO_MESSAGEAPI, "SRTO_MESSAGEAPI", &messageapi, &optlen);
+        if (ret < 0)
+            goto fail1;
+        /* Room a read needs before another message is appended to it. The
+           peer may use a larger payload size than ours in live mode, and a
+           file mode message has no bounded size, so it is never batched. */
+        if (!messageapi)
+            s->recv_msg_size = 1;
+        else if (packet_size > 0)
+            s->recv_msg_size = SRT_LIVE_MAX_PAYLOAD_SIZE;
+        else
+            s->recv_msg_size = INT_MAX;
     }
 
     ret = eid = libsrt_epoll_create(h, fd, flags & AVIO_FLAG_WRITE);
@@ -515,12 +818,14 @@ static int libsrt_setup(URLContext *h, const char *uri, int flags)
         cur_ai = cur_ai->ai_next;
         if (fd >= 0)
             srt_close(fd);
+        libsrt_shared_release(s);
         ret = 0;
         goto restart;
     }
  fail1:
     if (fd >= 0)
         srt_close(fd);
+    libsrt_shared_release(s);
     freeaddrinfo(ai);
     return ret;
 }
@@ -662,6 +967,18 @@ static int libsrt_open(URLContext *h, const char *uri, int flags)
         if (av_find_info_tag(buf, sizeof(buf), "linger", p)) {
             s->linger = strtol(buf, NULL, 10);
         }
+        if (av_find_info_tag(buf, sizeof(buf), "recv_batch", p)) {
+            s->recv_batch = strtol(buf, NULL, 10);
+        }
+        if (av_find_info_tag(buf, sizeof(buf), "send_batch", p)) {
+            s->send_batch = av_clip(strtol(buf, NULL, 10), 1, 1024);
+        }
+        if (av_find_info_tag(buf, sizeof(buf), "listen_shared", p)) {
+            s->listen_shared = strtol(buf, NULL, 10);
+        }
+        if (av_find_info_tag(buf, sizeof(buf), "stats_interval", p)) {
+            s->stats_interval = strtoll(buf, NULL, 10);
+        }
     }
     ret = libsrt_setup(h, uri, flags);
     if (ret < 0)
@@ -675,50 +992,135 @@ err:
     return ret;
 }
 
+static void libsrt_update_stats(URLContext *h)
+{
+    SRTContext *s = h->priv_data;
+    SRT_TRACEBSTATS perf;
+    char buf[256];
+    int64_t now;
+
+    if (s->stats_interval <= 0)
+        return;
+
+    now = av_gettime_relative();
+    if (!s->stats_time)
+        s->stats_time = now;
+    if (now - s->stats_time < s->stats_interval)
+        return;
+    s->stats_time = now;
+
+    if (srt_bstats(s->fd, &perf, 1) < 0)
+        return;
+
+    if (h->flags & AVIO_FLAG_WRITE)
+        snprintf(buf, sizeof(buf), "rate=%.3f rtt=%.3f bandwidth=%.3f pkts=%"PRId64" "
+                 "retrans=%d loss=%d drop=%d buffer_ms=%d msgs=%"PRId64" waits=%"PRId64,
+                 perf.mbpsSendRate, perf.msRTT, perf.mbpsBandwidth, perf.pktSent,
+                 perf.pktRetrans, perf.pktSndLoss, perf.pktSndDrop, perf.msSndBuf,
+                 s->tx_msgs, s->tx_waits);
+    else
+        snprintf(buf, sizeof(buf), "rate=%.3f rtt=%.3f bandwidth=%.3f pkts=%"PRId64" "
+                 "retrans=%d loss=%d drop=%d buffer_ms=%d msgs=%"PRId64" waits=%"PRId64,
+                 perf.mbpsRecvRate, perf.msRTT, perf.mbpsBandwidth, perf.pktRecv,
+                 perf.pktRcvRetrans, perf.pktRcvLoss, perf.pktRcvDrop, perf.msRcvBuf,
+                 s->rx_msgs, s->rx_waits);
+
+    av_log(h, AV_LOG_INFO, "%s\n", buf);
+    av_opt_set(s, "srt_stats", buf, 0);
+}
+
+/* Messages are received straight into the AVIOContext buffer. The socket
+   is drained before waiting on it again, so that one epoll wakeup delivers
+   all the messages SRT has ready instead of a single one. */
 static int libsrt_read(URLContext *h, uint8_t *buf, int size)
 {
     SRTContext *s = h->priv_data;
-    int ret;
+    int ret, len = 0, msgs = 0;
+
+    s->rx_reads++;
+    while (len < size) {
+        if (len && (size - len < s->recv_msg_size ||
+                    (s->recv_batch > 0 && msgs >= s->recv_batch)))
+            break;
+
+        ret = srt_recvmsg(s->fd, buf + len, size - len);
+        if (ret > 0) {
+            len += ret;
+            msgs++;
+            continue;
+        }
+        if (ret == 0)
+            break;
+
+        ret = libsrt_neterrno(h);
+        if (len)
+            break;
+        if (ret != AVERROR(EAGAIN) || (h->flags & AVIO_FLAG_NONBLOCK))
+            return ret;
 
-    if (!(h->flags & AVIO_FLAG_NONBLOCK)) {
         ret = libsrt_network_wait_fd_timeout(h, s->eid, 0, h->rw_timeout, &h->interrupt_callback);
         if (ret)
             return ret;
+        s->rx_waits++;
     }
 
-    ret = srt_recvmsg(s->fd, buf, size);
-    if (ret < 0) {
-        ret = libsrt_neterrno(h);
-    }
-
-    return ret;
+    s->rx_msgs += msgs;
+    libsrt_update_stats(h);
+    return len;
 }
 
+/* The buffer is split into payload sized messages which are submitted
+   back to back, the socket is only waited on once the send buffer is
+   full. */
 static int libsrt_write(URLContext *h, const uint8_t *buf, int size)
 {
     SRTContext *s = h->priv_data;
-    int ret;
+    int ret, len = 0;
+
+    while (len < size) {
+        int msg_size = size - len;
+        if (s->send_msg_size > 0)
+            msg_size = FFMIN(msg_size, s->send_msg_size);
+
+        ret = srt_sendmsg(s->fd, buf + len, msg_size, -1, 1);
+        if (ret > 0) {
+            len += ret;
+            s->tx_msgs++;
+            continue;
+        }
+        if (ret == 0)
+            break;
+
+        ret = libsrt_neterrno(h);
+        if (ret != AVERROR(EAGAIN) || (h->flags & AVIO_FLAG_NONBLOCK))
+            return len ? len : ret;
 
-    if (!(h->flags & AVIO_FLAG_NONBLOCK)) {
         ret = libsrt_network_wait_fd_timeout(h, s->eid, 1, h->rw_timeout, &h->interrupt_callback);
         if (ret)
-            return ret;
-    }
-
-    ret = srt_sendmsg(s->fd, buf, size, -1, 1);
-    if (ret < 0) {
-        ret = libsrt_neterrno(h);
+            return len ? len : ret;
+        s->tx_waits++;
     }
 
-    return ret;
+    libsrt_update_stats(h);
+    return len;
 }
 
 static int libsrt_close(URLContext *h)
 {
     SRTContext *s = h->priv_data;
 
+    if (s->rx_msgs)
+        av_log(h, AV_LOG_VERBOSE, "Received %"PRId64" messages in %"PRId64" reads, "
+               "%"PRId64" waits (%.1f messages per wakeup)\n",
+               s->rx_msgs, s->rx_reads, s->rx_waits,
+               (double)s->rx_msgs / FFMAX(s->rx_waits, 1));
+    if (s->tx_msgs)
+        av_log(h, AV_LOG_VERBOSE, "Sent %"PRId64" messages, %"PRId64" waits on a full send buffer\n",
+               s->tx_msgs, s->tx_waits);
+
     srt_epoll_release(s->eid);
     srt_close(s->fd);
+    libsrt_shared_release(s);
 
     srt_cleanup();
 
@@ -5337,8 +5337,15 @@ int ff_mov_write_packet(AVFormatContext *s, AVPacket *pkt)
 
     if (mov->ism_offset < 0)
     {
+        AVIrdetoEpoch epoch;
         long long epoch_time = -1LL;
-        av_wm_info_get_epoch_time(&epoch_time);
+
+        // Initial epoch time is carried by the encoder as packet side data,
+        // the value shared between components is kept as a fallback only
+        if (ff_ir_get_epoch_time(pkt, &epoch))
+            epoch_time = epoch.epoch_time;
+        else if (!av_wm_info_get_epoch_time(&epoch_time) && epoch_time >= 0LL)
+            epoch_time *= 1000;
 
         if (epoch_time < 0LL)
         {
@@ -5357,7 +5364,7 @@ int ff_mov_write_packet(AVFormatContext *s, AVPacket *pkt)
         }
         else
         {
-            av_log(s, AV_LOG_INFO, "Initial epoch time: %lld\n", epoch_time);
+            av_log(s, AV_LOG_INFO, "Initial epoch time: %lld\n", epoch_time / 1000);
 
             int i; for (i = 0; i < mov->nb_streams; i ++)
             {
@@ -5369,7 +5376,7 @@ int ff_mov_write_packet(AVFormatContext *s, AVPacket *pkt)
 
                 if (time_base_num > 0 && time_base_den > 0)
                 {
-                    uint64_t ism_offset = epoch_time * time_base_den / time_base_num;
+                    uint64_t ism_offset = av_rescale(epoch_time, time_base_den, 1000LL * time_base_num);
                     mov->tracks[i].frag_start += ism_offset;
 
                     switch (codec_params->codec_type)
@@ -5389,7 +5396,7 @@ int ff_mov_write_packet(AVFormatContext *s, AVPacket *pkt)
                 }
             }
 
-            mov->ism_offset = epoch_time;
+            mov->ism_offset = epoch_time / 1000;
         }
     }
 
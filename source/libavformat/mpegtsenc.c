@@ -24,6 +24,7 @@
 #include "libavutil/crc.h"
 #include "libavutil/dict.h"
 #include "libavutil/intreadwrite.h"
+#include "libavutil/ir_wm_info.h"
 #include "libavutil/mathematics.h"
 #include "libavutil/opt.h"
 
@@ -106,6 +107,7 @@ typedef struct MpegTSWrite {
 #define MPEGTS_FLAG_PAT_PMT_AT_FRAMES           0x04
 #define MPEGTS_FLAG_SYSTEM_B        0x08
 #define MPEGTS_FLAG_DISCONT         0x10
+#define MPEGTS_FLAG_IR_EPOCH        0x20
     int flags;
     int copyts;
     int tables_version;
@@ -115,8 +117,16 @@ typedef struct MpegTSWrite {
     int64_t last_sdt_ts;
 
     int omit_video_pes_length;
+
+    int64_t ir_epoch_offset; ///< Irdeto initial epoch time in 90 kHz units, -1 if unknown
+    AVPacketList *ir_epoch_queue;     ///< non-video packets waiting for the epoch
+    AVPacketList *ir_epoch_queue_end;
+    int ir_epoch_queue_size;
 } MpegTSWrite;
 
+/* Non-video packets queued at most while waiting for the epoch of the video */
+#define IR_EPOCH_MAX_QUEUE 500
+
 /* a PES packet header is generated every DEFAULT_PES_HEADER_FREQ packets */
 #define DEFAULT_PES_HEADER_FREQ  16
 #define DEFAULT_PES_PAYLOAD_SIZE ((DEFAULT_PES_HEADER_FREQ - 1) * 184 + 170)
@@ -777,6 +787,8 @@ static int mpegts_init(AVFormatContext *s)
     if (s->max_delay < 0) /* Not set by the caller */
         s->max_delay = 0;
 
+    ts->ir_epoch_offset = -1;
+
     // round up to a whole number of TS packets
     ts->pes_payload_size = (ts->pes_payload_size + 14 + 183) / 184 * 184 - 14;
 
@@ -1545,6 +1557,13 @@ static int mpegts_write_packet_internal(AVFormatContext *s, AVPacket *pkt)
         ts->flags           &= ~MPEGTS_FLAG_REEMIT_PAT_PMT;
     }
 
+    if (ts->flags & MPEGTS_FLAG_IR_EPOCH) {
+        if (pts != AV_NOPTS_VALUE)
+            pts += ts->ir_epoch_offset;
+        if (dts != AV_NOPTS_VALUE)
+            dts += ts->ir_epoch_offset;
+    }
+
     if (ts->copyts < 1) {
         if (pts != AV_NOPTS_VALUE)
             pts += delay;
@@ -1801,11 +1820,91 @@ static void mpegts_write_flush(AVFormatContext *s)
     }
 }
 
+static int mpegts_has_video(AVFormatContext *s)
+{
+    int i;
+
+    for (i = 0; i < s->nb_streams; i++)
+        if (s->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+            return 1;
+    return 0;
+}
+
+/* Set the Irdeto epoch offset and write the packets that were waiting for it */
+static int mpegts_set_epoch(AVFormatContext *s, long long epoch_time)
+{
+    MpegTSWrite *ts = s->priv_data;
+    AVPacket pkt;
+    int ret = 0;
+
+    if (epoch_time >= 0LL) {
+        av_log(s, AV_LOG_INFO, "Initial epoch time: %lld\n", epoch_time / 1000);
+        ts->ir_epoch_offset = av_rescale(epoch_time, 90000, 1000) & ((1LL << 33) - 1);
+    } else {
+        av_log(s, AV_LOG_WARNING, "Initial epoch time is not specified, timestamps will not be offset !!!\n");
+        ts->ir_epoch_offset = 0;
+    }
+
+    /* The PCR follows the same timeline, or CBR stuffing would wait for the offset */
+    ts->first_pcr += ts->ir_epoch_offset * 300;
+
+    while (ts->ir_epoch_queue) {
+        ff_packet_list_get(&ts->ir_epoch_queue, &ts->ir_epoch_queue_end, &pkt);
+        ret = mpegts_write_packet_internal(s, &pkt);
+        av_packet_unref(&pkt);
+        if (ret < 0)
+            break;
+    }
+    ts->ir_epoch_queue_size = 0;
+    ff_packet_list_free(&ts->ir_epoch_queue, &ts->ir_epoch_queue_end);
+
+    return ret;
+}
+
+static int mpegts_write_epoch_packet(AVFormatContext *s, AVPacket *pkt)
+{
+    MpegTSWrite *ts = s->priv_data;
+    AVStream *st = s->streams[pkt->stream_index];
+    AVIrdetoEpoch epoch;
+    long long epoch_time = -1LL;
+    int ret;
+
+    if (ff_ir_get_epoch_time(pkt, &epoch))
+        epoch_time = epoch.epoch_time;
+    else if (!av_wm_info_get_epoch_time(&epoch_time) && epoch_time >= 0LL)
+        epoch_time *= 1000;
+
+    /* The epoch comes with the first video packet, keep what precedes it */
+    if (epoch_time < 0LL && st->codecpar->codec_type != AVMEDIA_TYPE_VIDEO &&
+        ts->ir_epoch_queue_size < IR_EPOCH_MAX_QUEUE && mpegts_has_video(s)) {
+        ret = ff_packet_list_put(&ts->ir_epoch_queue, &ts->ir_epoch_queue_end,
+                                 pkt, FF_PACKETLIST_FLAG_REF_PACKET);
+        if (ret >= 0)
+            ts->ir_epoch_queue_size++;
+        return ret;
+    }
+
+    ret = mpegts_set_epoch(s, epoch_time);
+    if (ret < 0)
+        return ret;
+
+    return mpegts_write_packet_internal(s, pkt);
+}
+
 static int mpegts_write_packet(AVFormatContext *s, AVPacket *pkt)
 {
+    MpegTSWrite *ts = s->priv_data;
+
     if (!pkt) {
+        if (ts->flags & MPEGTS_FLAG_IR_EPOCH && ts->ir_epoch_queue) {
+            int ret = mpegts_set_epoch(s, -1LL);
+            if (ret < 0)
+                return ret;
+        }
         mpegts_write_flush(s);
         return 1;
+    } else if (ts->flags & MPEGTS_FLAG_IR_EPOCH && ts->ir_epoch_offset < 0) {
+        return mpegts_write_epoch_packet(s, pkt);
     } else {
         return mpegts_write_packet_internal(s, pkt);
     }
@@ -1813,6 +1912,14 @@ static int mpegts_write_packet(AVFormatContext *s, AVPacket *pkt)
 
 static int mpegts_write_end(AVFormatContext *s)
 {
+    MpegTSWrite *ts = s->priv_data;
+
+    if (s->pb && ts->flags & MPEGTS_FLAG_IR_EPOCH && ts->ir_epoch_queue) {
+        int ret = mpegts_set_epoch(s, -1LL);
+        if (ret < 0)
+            return ret;
+    }
+
     if (s->pb)
         mpegts_write_flush(s);
 
@@ -1825,6 +1932,8 @@ static void mpegts_deinit(AVFormatContext *s)
     MpegTSService *service;
     int i;
 
+    ff_packet_list_free(&ts->ir_epoch_queue, &ts->ir_epoch_queue_end);
+
     for (i = 0; i < s->nb_streams; i++) {
         AVStream *st = s->streams[i];
         MpegTSWriteStream *ts_st = st->priv_data;
@@ -1938,6 +2047,9 @@ static const AVOption options[] = {
     { "initial_discontinuity", "Mark initial packets as discontinuous",
       0, AV_OPT_TYPE_CONST, { .i64 = MPEGTS_FLAG_DISCONT }, 0, INT_MAX,
       AV_OPT_FLAG_ENCODING_PARAM, "mpegts_flags" },
+    { "epoch_time", "Offset timestamps by the Irdeto initial epoch time",
+      0, AV_OPT_TYPE_CONST, { .i64 = MPEGTS_FLAG_IR_EPOCH }, 0, INT_MAX,
+      AV_OPT_FLAG_ENCODING_PARAM, "mpegts_flags" },
     // backward compatibility
     { "resend_headers", "Reemit PAT/PMT before writing the next packet",
       offsetof(MpegTSWrite, reemit_pat_pmt), AV_OPT_TYPE_INT,
@@ -58,6 +58,9 @@
 #include "mxf.h"
 
 #define MXF_MAX_CHUNK_SIZE (32 << 20)
+#define MXF_MAX_READAHEAD_SIZE (256 << 20)
+/* packets smaller than this fraction of the read-ahead buffer get their own copy */
+#define MXF_READAHEAD_REF_RATIO 4
 
 typedef enum {
     Header,
@@ -276,6 +279,9 @@ typedef struct MXFContext {
     int essence_container_data_count;
     MXFMetadataSet **metadata_sets;
     int metadata_sets_count;
+    int metadata_sets_allocated;
+    int *metadata_sets_hash;    /* first set index per UID hash bucket, -1 if empty */
+    int *metadata_sets_next;    /* next set index in the same bucket, in insertion order */
     AVFormatContext *fc;
     struct AVAES *aesc;
     uint8_t *local_tags;
@@ -290,6 +296,15 @@ typedef struct MXFContext {
     int nb_index_tables;
     MXFIndexTable *index_tables;
     int eia608_extract;
+    int readahead_edit_units;   /* edit units to read ahead in one request, 0 = sequential reads */
+    AVBufferRef *readahead_buf; /* essence bytes starting at readahead_pos, pb is left at their end */
+    int64_t readahead_pos;
+    int readahead_size;
+    int64_t readahead_cur;      /* logical read position while readahead_buf is in use */
+    int readahead_seek_count;   /* pb->seek_count after the last fill, to spot outside seeks */
+    int readahead_flush_count;  /* internal->flush_count after the last fill, to spot generic seeks */
+    AVBufferPool *readahead_pool;
+    int readahead_pool_size;
 } MXFContext;
 
 /* NOTE: klv_offset is not set (-1) for local keys */
@@ -366,40 +381,56 @@ static void mxf_free_metadataset(MXFMetadataSet **ctx, int freectx)
     av_freep(ctx);
 }
 
-/**
-********************************************************************************
-* @author   Michael Verberne (michael.verberne@irdeto.com)
-* @author   David Lander (david.lander@irdeto.com)
-* @date     Jul 30, 2015
-********************************************************************************
-*/
-static int64_t klv_decode_ber_length_ex(AVIOContext *pb, int64_t *ber_size)
+static int64_t klv_decode_ber_length_buf(const uint8_t **buf, int64_t *ber_size)
 {
-    uint64_t size = avio_r8(pb);
+    const uint8_t *p = *buf;
+    uint64_t size = *p++;
     *ber_size = 1;
     if (size & 0x80) { /* long form */
         int bytes_num = size & 0x7f;
         /* SMPTE 379M 5.3.4 guarantee that bytes_num must not exceed 8 bytes */
-        if (bytes_num > 8)
+        if (bytes_num > 8) {
+            *buf = p;
             return AVERROR_INVALIDDATA;
+        }
         *ber_size += bytes_num;
         size = 0;
         while (bytes_num--)
-            size = size << 8 | avio_r8(pb);
+            size = size << 8 | *p++;
     }
+    *buf = p;
     if (size > INT64_MAX)
         return AVERROR_INVALIDDATA;
     return size;
 }
 
-static int64_t klv_decode_ber_length(AVIOContext *pb)
+/**
+********************************************************************************
+* @author   Michael Verberne (michael.verberne@irdeto.com)
+* @author   David Lander (david.lander@irdeto.com)
+* @date     Jul 30, 2015
+********************************************************************************
+*/
+static int64_t klv_decode_ber_length_ex(AVIOContext *pb, int64_t *ber_size)
 {
-    uint64_t size = avio_r8(pb);
+    uint64_t size;
+
+    if (pb->buf_end - pb->buf_ptr >= 9) {
+        /* the longest valid BER length is buffered, decode it in place */
+        const uint8_t *p = pb->buf_ptr;
+        int64_t ret = klv_decode_ber_length_buf(&p, ber_size);
+        pb->buf_ptr += p - pb->buf_ptr;
+        return ret;
+    }
+
+    size = avio_r8(pb);
+    *ber_size = 1;
     if (size & 0x80) { /* long form */
         int bytes_num = size & 0x7f;
         /* SMPTE 379M 5.3.4 guarantee that bytes_num must not exceed 8 bytes */
         if (bytes_num > 8)
             return AVERROR_INVALIDDATA;
+        *ber_size += bytes_num;
         size = 0;
         while (bytes_num--)
             size = size << 8 | avio_r8(pb);
@@ -409,15 +440,37 @@ static int64_t klv_decode_ber_length(AVIOContext *pb)
     return size;
 }
 
+static int64_t klv_decode_ber_length(AVIOContext *pb)
+{
+    int64_t ber_size;
+    return klv_decode_ber_length_ex(pb, &ber_size);
+}
+
 static int mxf_read_sync(AVIOContext *pb, const uint8_t *key, unsigned size)
 {
-    int i, b;
-    for (i = 0; i < size && !avio_feof(pb); i++) {
+    int i = 0, b;
+    while (i < size && !avio_feof(pb)) {
+        if (!i && pb->buf_end - pb->buf_ptr >= size) {
+            /* scan the buffered data for a complete key without per-byte reads */
+            uint8_t *p   = pb->buf_ptr;
+            uint8_t *end = pb->buf_end - size + 1;
+            while ((p = memchr(p, key[0], end - p)) && memcmp(p, key, size))
+                p++;
+            if (p) {
+                pb->buf_ptr = p + size;
+                return 1;
+            }
+            /* the last size - 1 bytes may start a key spanning the refill */
+            pb->buf_ptr = end;
+            continue;
+        }
         b = avio_r8(pb);
         if (b == key[0])
+            i = 1;
+        else if (b == key[i])
+            i++;
+        else
             i = 0;
-        else if (b != key[i])
-            i = -1;
     }
     return i == size;
 }
@@ -849,15 +902,66 @@ static int mxf_read_partition_pack(void *arg, AVIOContext *pb, int tag, int size
     return 0;
 }
 
+static unsigned mxf_uid_hash(const UID uid)
+{
+    /* FNV-1a, instance UIDs are often counters in a few trailing bytes */
+    unsigned h = 2166136261U;
+    int i;
+
+    for (i = 0; i < 16; i++)
+        h = (h ^ uid[i]) * 16777619U;
+    return h;
+}
+
+static void mxf_hash_metadata_set(MXFContext *mxf, int index)
+{
+    unsigned mask = mxf->metadata_sets_allocated - 1;
+    int *slot = &mxf->metadata_sets_hash[mxf_uid_hash(mxf->metadata_sets[index]->uid) & mask];
+
+    /* append, so lookups still return the first set added with a given UID */
+    while (*slot >= 0)
+        slot = &mxf->metadata_sets_next[*slot];
+    *slot = index;
+    mxf->metadata_sets_next[index] = -1;
+}
+
 static int mxf_add_metadata_set(MXFContext *mxf, void *metadata_set)
 {
-    MXFMetadataSet **tmp;
+    int i;
+
+    if (mxf->metadata_sets_count >= mxf->metadata_sets_allocated) {
+        /* power of two growth, the hash has one bucket per allocated set */
+        int size = FFMAX(2 * mxf->metadata_sets_allocated, 64);
+        MXFMetadataSet **tmp;
+        int *next, *hash;
+
+        if (mxf->metadata_sets_allocated > INT_MAX / 2)
+            return AVERROR(ENOMEM);
+
+        tmp = av_realloc_array(mxf->metadata_sets, size, sizeof(*mxf->metadata_sets));
+        if (!tmp)
+            return AVERROR(ENOMEM);
+        mxf->metadata_sets = tmp;
+
+        next = av_realloc_array(mxf->metadata_sets_next, size, sizeof(*mxf->metadata_sets_next));
+        if (!next)
+            return AVERROR(ENOMEM);
+        mxf->metadata_sets_next = next;
+
+        hash = av_malloc_array(size, sizeof(*mxf->metadata_sets_hash));
+        if (!hash)
+            return AVERROR(ENOMEM);
+        av_free(mxf->metadata_sets_hash);
+        mxf->metadata_sets_hash = hash;
+        mxf->metadata_sets_allocated = size;
+
+        memset(mxf->metadata_sets_hash, 0xFF, size * sizeof(*mxf->metadata_sets_hash));
+        for (i = 0; i < mxf->metadata_sets_count; i++)
+            mxf_hash_metadata_set(mxf, i);
+    }
 
-    tmp = av_realloc_array(mxf->metadata_sets, mxf->metadata_sets_count + 1, sizeof(*mxf->metadata_sets));
-    if (!tmp)
-        return AVERROR(ENOMEM);
-    mxf->metadata_sets = tmp;
     mxf->metadata_sets[mxf->metadata_sets_count] = metadata_set;
+    mxf_hash_metadata_set(mxf, mxf->metadata_sets_count);
     mxf->metadata_sets_count++;
     return 0;
 }
@@ -1336,9 +1440,10 @@ static void *mxf_resolve_strong_ref(MXFContext *mxf, UID *strong_ref, enum MXFMe
 {
     int i;
 
-    if (!strong_ref)
+    if (!strong_ref || !mxf->metadata_sets_count)
         return NULL;
-    for (i = 0; i < mxf->metadata_sets_count; i++) {
+    i = mxf->metadata_sets_hash[mxf_uid_hash(*strong_ref) & (mxf->metadata_sets_allocated - 1)];
+    for (; i >= 0; i = mxf->metadata_sets_next[i]) {
         if (!memcmp(*strong_ref, mxf->metadata_sets[i]->uid, 16) &&
             (type == AnyType || mxf->metadata_sets[i]->type == type)) {
             return mxf->metadata_sets[i];
@@ -3436,12 +3541,225 @@ static int mxf_set_pts(MXFContext *mxf, AVStream *st, AVPacket *pkt)
     return 0;
 }
 
+static void mxf_readahead_reset(MXFContext *mxf)
+{
+    av_buffer_unref(&mxf->readahead_buf);
+    mxf->readahead_size = 0;
+}
+
+/**
+ * Make sure [pos, pos + min_size) is buffered, reading up to the end of the
+ * edit unit readahead_edit_units ahead of the first indexed track in a single
+ * request. Bytes already buffered at and after pos are kept.
+ */
+static int mxf_readahead_fill(AVFormatContext *s, int64_t pos, int64_t min_size)
+{
+    MXFContext *mxf = s->priv_data;
+    int64_t end = -1, buf_end = mxf->readahead_pos + mxf->readahead_size;
+    int64_t keep = 0, size;
+    AVBufferRef *buf;
+    int i, ret;
+
+    for (i = 0; i < s->nb_streams && end < 0; i++) {
+        AVStream *st = s->streams[i];
+        MXFTrack *track = st->priv_data;
+        MXFIndexTable *t;
+        int64_t edit_unit;
+
+        if (!track || track->wrapping != FrameWrapped ||
+            !(t = mxf_find_index_table(mxf, track->index_sid)))
+            continue;
+        edit_unit = av_rescale_q(track->sample_count, st->time_base, av_inv_q(track->edit_rate));
+        if (mxf_edit_unit_absolute_offset(mxf, t, edit_unit + mxf->readahead_edit_units,
+                                          track->edit_rate, NULL, &end, NULL, 0) < 0 &&
+            (end = mxf_essence_container_end(mxf, t->body_sid)) <= 0)
+            end = -1;
+    }
+    if (end < 0)
+        return AVERROR(ENOSYS);
+
+    size = FFMIN(FFMAX(end - pos, min_size), MXF_MAX_READAHEAD_SIZE);
+    if (size < min_size)
+        return AVERROR(EAGAIN);
+
+    /* packets reference the buffer, so it is only recycled once they are all freed */
+    if (mxf->readahead_pool_size < size + AV_INPUT_BUFFER_PADDING_SIZE) {
+        av_buffer_pool_uninit(&mxf->readahead_pool);
+        mxf->readahead_pool_size = FFALIGN(size + AV_INPUT_BUFFER_PADDING_SIZE, 1 << 16);
+        mxf->readahead_pool = av_buffer_pool_init(mxf->readahead_pool_size, NULL);
+        if (!mxf->readahead_pool) {
+            mxf->readahead_pool_size = 0;
+            return AVERROR(ENOMEM);
+        }
+    }
+    buf = av_buffer_pool_get(mxf->readahead_pool);
+    if (!buf)
+        return AVERROR(ENOMEM);
+
+    if (mxf->readahead_buf && pos >= mxf->readahead_pos && pos < buf_end) {
+        keep = FFMIN(buf_end - pos, size);
+        memcpy(buf->data, mxf->readahead_buf->data + pos - mxf->readahead_pos, keep);
+    } else if (avio_seek(s->pb, pos, SEEK_SET) < 0) {
+        av_buffer_unref(&buf);
+        return AVERROR(EAGAIN);
+    }
+
+    ret = keep < size ? avio_read(s->pb, buf->data + keep, size - keep) : 0;
+    if (ret < 0 && !keep) {
+        av_buffer_unref(&buf);
+        mxf_readahead_reset(mxf);
+        return ret;
+    }
+    memset(buf->data + keep + FFMAX(ret, 0), 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+    av_buffer_unref(&mxf->readahead_buf);
+    mxf->readahead_buf  = buf;
+    mxf->readahead_pos  = pos;
+    mxf->readahead_size = keep + FFMAX(ret, 0);
+    mxf->readahead_cur  = pos;
+    mxf->readahead_seek_count  = s->pb->seek_count;
+    mxf->readahead_flush_count = s->internal->flush_count;
+    return 0;
+}
+
+/**
+ * Read the next frame wrapped essence element from the read-ahead buffer.
+ * Read-ahead is turned off for files it cannot handle (no index table, clip
+ * wrapping, encryption or essence needing special parsing).
+ *
+ * @return 0 on success, AVERROR(EAGAIN) if the packet has to be read by the
+ *         sequential path (pb is then positioned at the next KLV), another
+ *         negative error code on failure
+ */
+static int mxf_read_packet_readahead(AVFormatContext *s, AVPacket *pkt)
+{
+    MXFContext *mxf = s->priv_data;
+    int64_t pos;
+    int ret;
+
+    if (!(s->pb->seekable & AVIO_SEEKABLE_NORMAL))
+        return AVERROR(EAGAIN);
+
+    /* pb was moved by someone else (generic or byte seeks), its position wins */
+    if (mxf->readahead_buf &&
+        (s->pb->seek_count != mxf->readahead_seek_count ||
+         s->internal->flush_count != mxf->readahead_flush_count ||
+         avio_tell(s->pb) != mxf->readahead_pos + mxf->readahead_size))
+        mxf_readahead_reset(mxf);
+
+    pos = mxf->readahead_buf ? mxf->readahead_cur : avio_tell(s->pb);
+    /* the sequential path is in the middle of a clip wrapped KLV */
+    if (pos >= mxf->current_klv_data.next_klv - mxf->current_klv_data.length &&
+        pos < mxf->current_klv_data.next_klv)
+        return AVERROR(EAGAIN);
+
+    while (1) {
+        KLVPacket klv;
+        const uint8_t *p;
+        int64_t length;
+        int index;
+        AVStream *st;
+        MXFTrack *track;
+
+        if (!mxf->readahead_buf || pos < mxf->readahead_pos ||
+            mxf->readahead_pos + mxf->readahead_size - pos < 16 + 9) {
+            ret = mxf_readahead_fill(s, pos, 16 + 9);
+            if (ret == AVERROR(ENOSYS))
+                goto disable;
+            if (ret < 0 || mxf->readahead_size < 16 + 9)
+                goto fallback;
+        }
+
+        p = mxf->readahead_buf->data + pos - mxf->readahead_pos;
+        if (memcmp(p, mxf_klv_key, 4))
+            goto fallback;
+        klv.offset = pos;
+        memcpy(klv.key, p, 16);
+        p += 16;
+        length = klv_decode_ber_length_buf(&p, &klv.ber_size);
+        if (length < 0 || length > INT_MAX - AV_INPUT_BUFFER_PADDING_SIZE)
+            goto fallback;
+        klv.length   = length;
+        klv.next_klv = pos + 16 + klv.ber_size + length;
+
+        if (IS_KLV_KEY(klv.key, mxf_encrypted_triplet_key))
+            goto disable;
+        if (!IS_KLV_KEY(klv.key, mxf_essence_element_key) &&
+            !IS_KLV_KEY(klv.key, mxf_canopus_essence_element_key) &&
+            !IS_KLV_KEY(klv.key, mxf_avid_essence_element_key)) {
+            pos = klv.next_klv;
+            continue;
+        }
+
+        index = mxf_get_stream_index(s, &klv, find_body_sid_by_offset(mxf, klv.offset));
+        if (index < 0 || s->streams[index]->discard == AVDISCARD_ALL) {
+            pos = klv.next_klv;
+            continue;
+        }
+        st    = s->streams[index];
+        track = st->priv_data;
+        if (track->wrapping != FrameWrapped ||
+            (klv.key[12] == 0x06 && klv.key[13] == 0x01 && klv.key[14] == 0x10) ||
+            (mxf->eia608_extract && st->codecpar->codec_id == AV_CODEC_ID_EIA_608))
+            goto disable;
+
+        if (klv.next_klv > mxf->readahead_pos + mxf->readahead_size) {
+            ret = mxf_readahead_fill(s, pos, klv.next_klv - pos);
+            if (ret < 0 || klv.next_klv > mxf->readahead_pos + mxf->readahead_size)
+                goto fallback;
+        }
+
+        mxf_set_current_edit_unit(mxf, st, klv.next_klv - klv.length, 1);
+
+        p = mxf->readahead_buf->data + (klv.next_klv - klv.length - mxf->readahead_pos);
+        if (klv.length < mxf->readahead_size / MXF_READAHEAD_REF_RATIO) {
+            /* a packet referencing the buffer keeps all of it alive, small ones are copied */
+            ret = av_new_packet(pkt, klv.length);
+            if (ret < 0)
+                return ret;
+            memcpy(pkt->data, p, klv.length);
+        } else {
+            /* the packet references the essence in place, the buffer is padded after its end */
+            pkt->buf = av_buffer_ref(mxf->readahead_buf);
+            if (!pkt->buf)
+                return AVERROR(ENOMEM);
+            pkt->data = (uint8_t *)p;
+            pkt->size = klv.length;
+        }
+        pkt->stream_index = index;
+        pkt->pos = klv.offset;
+        pkt->hdr_size = 16 + klv.ber_size;
+        ret = mxf_set_pts(mxf, st, pkt);
+        if (ret < 0) {
+            av_packet_unref(pkt);
+            return ret;
+        }
+
+        mxf->readahead_cur = klv.next_klv;
+        return 0;
+    }
+
+disable:
+    av_log(s, AV_LOG_VERBOSE, "essence at %"PRId64" can't be read ahead, using sequential reads\n", pos);
+    mxf->readahead_edit_units = 0;
+fallback:
+    mxf_readahead_reset(mxf);
+    avio_seek(s->pb, pos, SEEK_SET);
+    return AVERROR(EAGAIN);
+}
+
 static int mxf_read_packet(AVFormatContext *s, AVPacket *pkt)
 {
     KLVPacket klv;
     MXFContext *mxf = s->priv_data;
     int ret;
 
+    if (mxf->readahead_edit_units > 0) {
+        ret = mxf_read_packet_readahead(s, pkt);
+        if (ret != AVERROR(EAGAIN))
+            return ret;
+    }
+
     while (1) {
         int64_t max_data_size;
         int64_t pos = avio_tell(s->pb);
@@ -3586,6 +3904,10 @@ static int mxf_read_close(AVFormatContext *s)
     }
     av_freep(&mxf->partitions);
     av_freep(&mxf->metadata_sets);
+    av_freep(&mxf->metadata_sets_hash);
+    av_freep(&mxf->metadata_sets_next);
+    av_buffer_unref(&mxf->readahead_buf);
+    av_buffer_pool_uninit(&mxf->readahead_pool);
     av_freep(&mxf->aesc);
     av_freep(&mxf->local_tags);
 
@@ -3642,6 +3964,8 @@ static int mxf_read_seek(AVFormatContext *s, int stream_index, int64_t sample_ti
     if (!source_track)
         return 0;
 
+    mxf_readahead_reset(mxf);
+
     /* if audio then truncate sample_time to EditRate */
     if (st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO)
         sample_time = av_rescale_q(sample_time, st->time_base,
@@ -3743,6 +4067,9 @@ static const AVOption options[] = {
     { "eia608_extract", "extract eia 608 captions from s436m track",
       offsetof(MXFContext, eia608_extract), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1,
       AV_OPT_FLAG_DECODING_PARAM },
+    { "readahead_edit_units", "read frame wrapped essence this many edit units ahead using the index table",
+      offsetof(MXFContext, readahead_edit_units), AV_OPT_TYPE_INT, {.i64 = 0}, 0, 1024,
+      AV_OPT_FLAG_DECODING_PARAM },
     { NULL },
 };
 
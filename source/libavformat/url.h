@@ -27,6 +27,7 @@
 #include "avio.h"
 #include "libavformat/version.h"
 
+#include "libavutil/buffer.h"
 #include "libavutil/dict.h"
 #include "libavutil/log.h"
 
@@ -49,6 +50,8 @@ typedef struct URLContext {
     const char *protocol_whitelist;
     const char *protocol_blacklist;
     int min_packet_size;        /**< if non zero, the stream is packetized with this min packet size */
+    int64_t readahead_size;     /**< if non zero, size of the read-ahead window kept ahead of the AVIOContext read position */
+    int readahead_threads;      /**< number of read-ahead workers for local files */
 } URLContext;
 
 typedef struct URLProtocol {
@@ -97,6 +100,11 @@ typedef struct URLProtocol {
     int (*url_delete)(URLContext *h);
     int (*url_move)(URLContext *h_src, URLContext *h_dst);
     const char *default_whitelist;
+    /**
+     * Return a reference to size bytes at pos that can be used as packet data
+     * without a copy. The data stays valid as long as the reference.
+     */
+    int (*url_map_range)(URLContext *h, int64_t pos, int size, AVBufferRef **buf, uint8_t **data);
 } URLProtocol;
 
 /**
@@ -257,6 +265,17 @@ int ffurl_get_multi_file_handle(URLContext *h, int **handles, int *numhandles);
  */
 int ffurl_get_short_seek(URLContext *h);
 
+/**
+ * Get a reference to size bytes of the resource starting at pos without
+ * copying them, for protocols which keep the whole resource in memory.
+ * The returned data is followed by at least AV_INPUT_BUFFER_PADDING_SIZE
+ * readable bytes and must not be modified.
+ *
+ * @return 0 on success, AVERROR(ENOSYS) if the protocol or the range does
+ * not support it, another negative value on error
+ */
+int ffurl_map_range(URLContext *h, int64_t pos, int size, AVBufferRef **buf, uint8_t **data);
+
 /**
  * Signal the URLContext that we are done reading or writing the stream.
  *
@@ -309,11 +309,22 @@ static int append_packet_chunked(AVIOContext *s, AVPacket *pkt, int size)
 
 int av_get_packet(AVIOContext *s, AVPacket *pkt, int size)
 {
+    URLContext *h;
+
     av_init_packet(pkt);
     pkt->data = NULL;
     pkt->size = 0;
     pkt->pos  = avio_tell(s);
 
+    /* reference memory mapped input instead of copying it, unless it has
+     * been copied into the AVIOContext buffer already */
+    if (size > s->buf_end - s->buf_ptr && !s->update_checksum && (h = ffio_geturlcontext(s)) &&
+        ffurl_map_range(h, pkt->pos, size, &pkt->buf, &pkt->data) >= 0) {
+        pkt->size = size;
+        avio_skip(s, size);
+        return size;
+    }
+
     return append_packet_chunked(s, pkt, size);
 }
 
@@ -1935,6 +1946,7 @@ void ff_read_frame_flush(AVFormatContext *s)
     int i, j;
 
     flush_packet_queue(s);
+    s->internal->flush_count++;
 
     /* Reset read state for each stream. */
     for (i = 0; i < s->nb_streams; i++) {
@@ -5852,3 +5864,15 @@ FF_DISABLE_DEPRECATION_WARNINGS
 FF_ENABLE_DEPRECATION_WARNINGS
 #endif
 }
+
+int ff_ir_get_epoch_time(const AVPacket *pkt, AVIrdetoEpoch *epoch)
+{
+    int size = 0;
+    const uint8_t *sd = av_packet_get_side_data(pkt, AV_PKT_IRDETO_EPOCH_TIME, &size);
+
+    if (!sd || size < sizeof(*epoch) || ((const AVIrdetoEpoch *)sd)->epoch_time < 0)
+        return 0;
+
+    memcpy(epoch, sd, sizeof(*epoch));
+    return 1;
+}
@@ -172,6 +172,12 @@ enum AVFrameSideDataType {
      * This payload is already prepared by the Encoder Plugin and should be inserted into SEI NALU as is
      */
     AV_FRAME_DATA_IR_SEI_PAYLOAD,
+
+    /**
+     * Irdeto initial epoch time
+     * The data is the AVIrdetoEpoch structure defined in libavutil/ir_wm_info.h
+     */
+    AV_FRAME_DATA_IR_EPOCH_TIME,
 };
 
 enum AVActiveFormatDescription {
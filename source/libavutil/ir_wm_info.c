@@ -20,6 +20,7 @@
 
 #include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 #include "error.h"
 #include "mem.h"
 #include "ir_wm_info.h"
@@ -27,32 +28,65 @@
 static pthread_mutex_t    shared_data_locker = PTHREAD_MUTEX_INITIALIZER;
 static volatile long long shared_epoch_time  = -1LL;
 
-static uint8_t uuid_irdeto[] =
+/*
+ * Pre-built SEI payloads: uuid and all constant fields are already in place,
+ * so only the bytes carrying bitlen/bitval/bitpos are patched per payload
+ */
+static const uint8_t sei_template_irdeto_v2[22] =
+{
+    /* 16 bytes: uuid */
+    0x40, 0x62, 0xB6, 0x99, 0x58, 0xC7, 0x44, 0x20, 0x81, 0xFA, 0x09, 0x10, 0x40, 0x88, 0x20, 0x77,
+    /* 1 byte: version (2) */
+    0x02,
+    /* 1 byte: encryption_flag (0), sync_info_present_flag (0), reserved_zero_bits */
+    0x00,
+    /* 4 bytes: bitpos, bitval */
+    0x00, 0x00, 0x00, 0x00
+};
+
+static const uint8_t sei_template_irdeto_v3[27] =
 {
-    0x40, 0x62, 0xB6, 0x99, 0x58, 0xC7, 0x44, 0x20, 0x81, 0xFA, 0x09, 0x10, 0x40, 0x88, 0x20, 0x77
+    /* 16 bytes: uuid */
+    0x40, 0x62, 0xB6, 0x99, 0x58, 0xC7, 0x44, 0x20, 0x81, 0xFA, 0x09, 0x10, 0x40, 0x88, 0x20, 0x77,
+    /* 1 byte: version (3) */
+    0x03,
+    /* 1 byte: tmid_length_div128, variant */
+    0x00,
+    /* 2 bytes: emulation_1 (1), sequence_id_0_14 */
+    0x80, 0x00,
+    /* 1 byte: emulation_2 (1), firstpart (1), lastpart (1), reserved (0), sequence_id_15_18 */
+    0xE0,
+    /* 2 bytes: emulation_3 (1), sequence_id_19_33 */
+    0x80, 0x00,
+    /* 2 bytes: emulation_4 (1), sequence_id_34_48 */
+    0x80, 0x00,
+    /* 2 bytes: emulation_5 (1), sequence_id_49_63 */
+    0x80, 0x00
 };
 
-static uint8_t uuid_dash_if[] =
+static const uint8_t sei_template_dash_if[21] =
 {
-    0xBE, 0xC4, 0xF8, 0x24, 0x17, 0x0D, 0x47, 0xCF, 0xA8, 0x26, 0xCE, 0x00, 0x80, 0x83, 0xE3, 0x55
+    /* 16 bytes: uuid */
+    0xBE, 0xC4, 0xF8, 0x24, 0x17, 0x0D, 0x47, 0xCF, 0xA8, 0x26, 0xCE, 0x00, 0x80, 0x83, 0xE3, 0x55,
+    /* 1 byte: version (1) */
+    0x01,
+    /* 1 byte: variant */
+    0x00,
+    /* 2 bytes: emulation_1 (1), position */
+    0x80, 0x00,
+    /* 1 byte: emulation_2 (1), firstpart (1), lastpart (1), reserved (0) */
+    0xE0
 };
 
 static int av_wm_info_alloc_sei_irdeto_v2(AVIrdetoWatermark* wm_info, void* sei_payload, size_t* payload_size)
 {
     uint8_t* payload = (uint8_t*) sei_payload;
-    size_t   size    = sizeof(uuid_irdeto) + 6; /* 22 bytes */
+    size_t   size    = sizeof(sei_template_irdeto_v2); /* 22 bytes */
 
     if (*payload_size < size)
         return AVERROR(EINVAL);
 
-    /* 16 bytes: uuid */
-    memcpy(payload, uuid_irdeto, sizeof(uuid_irdeto));
-
-    /* 1 byte: version (2) */
-    payload[16] = 0x02;
-
-    /* 1 byte: encryption_flag (0), sync_info_present_flag (0), reserved_zero_bits */
-    payload[17] = 0x00;
+    memcpy(payload, sei_template_irdeto_v2, size);
 
     /* 4 bytes: bitpos, bitval */
     payload[18]  = (wm_info->bitpos >> 23) & 0xFF;
@@ -68,42 +102,33 @@ static int av_wm_info_alloc_sei_irdeto_v2(AVIrdetoWatermark* wm_info, void* sei_
 static int av_wm_info_alloc_sei_irdeto_v3(AVIrdetoWatermark* wm_info, void* sei_payload, size_t* payload_size)
 {
     uint8_t* payload = (uint8_t*) sei_payload;
-    size_t   size    = sizeof(uuid_irdeto) + 11; /* 27 bytes */
+    size_t   size    = sizeof(sei_template_irdeto_v3); /* 27 bytes */
 
     if ((*payload_size < size) || (wm_info->bitlen < 128) || (wm_info->bitlen > 8192) || ((wm_info->bitlen & 0x7F) != 0))
         return AVERROR(EINVAL);
 
-    /* 16 bytes: uuid */
-    memcpy(payload, uuid_irdeto, sizeof(uuid_irdeto));
-
-    /* 1 byte: version (3) */
-    payload[16] = 0x03;
+    memcpy(payload, sei_template_irdeto_v3, size);
 
-    /* 1 byte: tmid_length_div128 (bitlen / 128), variant (bitval) */
+    /* tmid_length_div128 (bitlen / 128), variant (bitval) */
     payload[17]  = (wm_info->bitlen / 128) << 1;
     payload[17] |=  wm_info->bitval & 1;
 
-    /* 2 bytes: emulation_1 (1), sequence_id_0_14 (bitpos & 0x7FFF) */
-    payload[18]  = 0x80;
+    /* sequence_id_0_14 (bitpos & 0x7FFF) */
     payload[18] |= (wm_info->bitpos >> 8) & 0x7F;
     payload[19]  =  wm_info->bitpos       & 0xFF;
 
-    /* 1 byte: emulation_2 (1), firstpart (1), lastpart (1), reserved (0), sequence_id_15_18 ((bitpos >> 15) & 0x0F) */
-    payload[20]  = 0xE0;
+    /* sequence_id_15_18 ((bitpos >> 15) & 0x0F) */
     payload[20] |= (wm_info->bitpos >> 15) & 0x0F;
 
-    /* 2 bytes: emulation_3 (1), sequence_id_19_33 ((bitpos >> 19) & 0x7FFF) */
-    payload[21]  = 0x80;
+    /* sequence_id_19_33 ((bitpos >> 19) & 0x7FFF) */
     payload[21] |= (wm_info->bitpos >> 27) & 0x7F;
     payload[22]  = (wm_info->bitpos >> 19) & 0xFF;
 
-    /* 2 bytes: emulation_4 (1), sequence_id_34_48 ((bitpos >> 34) & 0x7FFF) */
-    payload[23]  = 0x80;
+    /* sequence_id_34_48 ((bitpos >> 34) & 0x7FFF) */
     payload[23] |= (wm_info->bitpos >> 42) & 0x7F;
     payload[24]  = (wm_info->bitpos >> 34) & 0xFF;
 
-    /* 2 bytes: emulation_5 (1), sequence_id_49_63 ((bitpos >> 49) & 0x7FFF) */
-    payload[25]  = 0x80;
+    /* sequence_id_49_63 ((bitpos >> 49) & 0x7FFF) */
     payload[25] |= (wm_info->bitpos >> 57) & 0x7F;
     payload[26]  = (wm_info->bitpos >> 49) & 0xFF;
 
@@ -117,28 +142,20 @@ static int av_wm_info_alloc_sei_dash_if(AVIrdetoWatermark* wm_info, void* sei_pa
        and WM-info SEI only when bitposition is changed, so firstpart and lastpart are always equal to 1 */
 
     uint8_t* payload = (uint8_t*) sei_payload;
-    size_t   size    = sizeof(uuid_dash_if) + 5; /* 21 bytes */
+    size_t   size    = sizeof(sei_template_dash_if); /* 21 bytes */
 
     if (*payload_size < size)
         return AVERROR(EINVAL);
 
-    /* 16 bytes: uuid */
-    memcpy(payload, uuid_dash_if, sizeof(uuid_dash_if));
-
-    /* 1 byte: version (1) */
-    payload[16] = 0x01;
+    memcpy(payload, sei_template_dash_if, size);
 
-    /* 1 byte: variant (bitval) */
+    /* variant (bitval) */
     payload[17] = wm_info->bitval & 0xFF;
 
-    /* 2 bytes: emulation_1 (1), position (bitpos) */
-    payload[18]  = 0x80;
+    /* position (bitpos) */
     payload[18] |= (wm_info->bitpos >> 8) & 0x7F;
     payload[19]  =  wm_info->bitpos       & 0xFF;
 
-    /* 1 byte: emulation_2 (1), firstpart (1), lastpart (1), reserved (0) */
-    payload[20] = 0xE0;
-
     *payload_size = size;
     return 0;
 }
@@ -200,6 +217,53 @@ int av_wm_info_alloc_sei(AVIrdetoWatermark* wm_info, AVIrdetoSeiType type, void*
     return AVERROR(EINVAL);
 }
 
+int av_wm_info_parse_sei(const void* sei_payload, size_t payload_size, AVIrdetoWatermark* wm_info, AVIrdetoSeiType* type)
+{
+    const uint8_t* payload = (const uint8_t*) sei_payload;
+    AVIrdetoWatermark info = { 0 };
+    AVIrdetoSeiType   kind = AV_WM_SEI_NONE;
+
+    if ((NULL == sei_payload) || (payload_size < 17))
+        return AVERROR(EINVAL);
+
+    if (!memcmp(payload, sei_template_irdeto_v2, 16) && (payload[16] == 2) && (payload_size >= sizeof(sei_template_irdeto_v2)))
+    {
+        kind        = AV_WM_SEI_IRDETO_V2;
+        info.bitval =  payload[21] & 0x01;
+        info.bitpos = ((unsigned long long) payload[18] << 23) | ((unsigned long long) payload[19] << 15) |
+                      ((unsigned long long) payload[20] <<  7) | (payload[21] >> 1);
+    }
+    else if (!memcmp(payload, sei_template_irdeto_v3, 16) && (payload[16] == 3) && (payload_size >= sizeof(sei_template_irdeto_v3)))
+    {
+        kind        = AV_WM_SEI_IRDETO_V3;
+        info.bitlen = (payload[17] >> 1) * 128;
+        info.bitval =  payload[17] & 0x01;
+        info.bitpos = ((unsigned long long) (((payload[18] & 0x7F) << 8) | payload[19]))       |
+                      ((unsigned long long)   (payload[20] & 0x0F)                      << 15) |
+                      ((unsigned long long) (((payload[21] & 0x7F) << 8) | payload[22]) << 19) |
+                      ((unsigned long long) (((payload[23] & 0x7F) << 8) | payload[24]) << 34) |
+                      ((unsigned long long) (((payload[25] & 0x7F) << 8) | payload[26]) << 49);
+    }
+    else if (!memcmp(payload, sei_template_dash_if, 16) && (payload[16] == 1) && (payload_size >= sizeof(sei_template_dash_if)))
+    {
+        kind        = AV_WM_SEI_DASH_IF;
+        info.bitval = payload[17];
+        info.bitpos = ((payload[18] & 0x7F) << 8) | payload[19];
+    }
+    else
+        return AVERROR(EINVAL);
+
+    info.watermarked = 1;
+
+    if (wm_info != NULL)
+        *wm_info = info;
+
+    if (type != NULL)
+        *type = kind;
+
+    return 0;
+}
+
 int av_wm_info_atoi(const char* in, unsigned int* out)
 {
     char* end = NULL;
@@ -251,6 +315,15 @@ int av_wm_info_set_epoch_time(long long epoch_time)
     return result;
 }
 
+long long av_wm_info_get_msn(long long epoch_time, long long elapsed, long long seglen)
+{
+    if (seglen <= 0LL)
+        return 1LL;
+
+    return 1LL + (epoch_time > 0LL ? epoch_time / seglen : 0LL)
+               + (elapsed    > 0LL ? elapsed    / seglen : 0LL);
+}
+
 int av_wm_info_get_epoch_time(long long* p_epoch_time)
 {
     if (! p_epoch_time)
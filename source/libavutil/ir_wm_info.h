@@ -21,6 +21,7 @@
 #ifndef _IR_WM_INFO_H_
 #define _IR_WM_INFO_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 /**
@@ -53,6 +54,20 @@ typedef struct AVIrdetoWatermark
 
 } AVIrdetoWatermark;
 
+/**
+********************************************************************************
+* @struct AVIrdetoEpoch
+* @brief  Initial epoch time carried as AV_FRAME_DATA_IR_EPOCH_TIME frame side
+*         data and AV_PKT_IRDETO_EPOCH_TIME packet side data
+********************************************************************************
+*/
+typedef struct AVIrdetoEpoch
+{
+    int64_t            epoch_time;  ///< Initial epoch time (in ms)
+    int64_t            seglen;      ///< WM segment duration (in ms), 0 if unknown
+
+} AVIrdetoEpoch;
+
 /**
 ********************************************************************************
 * @brief  Routine to generate H264/H265 SEI with Irdeto watermark info inside
@@ -61,6 +76,15 @@ typedef struct AVIrdetoWatermark
 */
 int av_wm_info_alloc_sei(AVIrdetoWatermark* wm_info, AVIrdetoSeiType type, void* sei_payload, size_t* payload_size);
 
+/**
+********************************************************************************
+* @brief  Routine to recognize H264/H265 SEI (or AV1 WM_INFO metadata) payload
+*         with Irdeto watermark info inside, inverse of av_wm_info_alloc_sei()
+* @note   Returns 0 on success, negative value if the payload is not WM info
+********************************************************************************
+*/
+int av_wm_info_parse_sei(const void* sei_payload, size_t payload_size, AVIrdetoWatermark* wm_info, AVIrdetoSeiType* type);
+
 /**
 ********************************************************************************
 * @brief  Simple wrapper for routine of conversion from text to int
@@ -81,10 +105,24 @@ int av_wm_info_atoll(const char* in, unsigned long long* out);
 ********************************************************************************
 * @brief  A group of calls to share Initial Epoch Time value between components
 * @note   Returns 0 on success, negative value on failure
+* @note   Muxers take the value from AV_PKT_IRDETO_EPOCH_TIME side data first,
+*         the shared value is only used as a fallback
 ********************************************************************************
 */
 int av_wm_info_reset_epoch_time(void);
 int av_wm_info_set_epoch_time(long long epoch_time);
 int av_wm_info_get_epoch_time(long long* p_epoch_time);
 
+/**
+********************************************************************************
+* @brief  Media Sequence Number of a WM segment, as embedded by the WM filter
+*         and used by the segmenters: 1 + epoch_time / seglen + elapsed / seglen
+* @param  epoch_time Initial epoch time (in ms), negative if unknown
+* @param  elapsed    Time since the first frame (in ms)
+* @param  seglen     WM segment duration (in ms)
+* @note   Returns the MSN, 1 if seglen is not positive
+********************************************************************************
+*/
+long long av_wm_info_get_msn(long long epoch_time, long long elapsed, long long seglen);
+
 #endif /* !_IR_WM_INFO_H_ */
@@ -0,0 +1,225 @@
+/**
+ * @brief Header-open benchmark for the MXF demuxer
+ *
+ * Generates a synthetic OP1a file whose header metadata holds a large number
+ * of sets (source clips referenced from material track sequences) and times
+ * avformat_open_input() on it.
+ *
+ * Usage: bench_mxf_open [number of sets] [iterations] [file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavformat/avformat.h"
+#include "libavutil/time.h"
+
+#define MAX_REFS_PER_SET 4000
+
+static const uint8_t key_header_partition[16] = { 0x06,0x0e,0x2b,0x34,0x02,0x05,0x01,0x01,0x0d,0x01,0x02,0x01,0x01,0x02,0x04,0x00 };
+static const uint8_t key_primer_pack[16]      = { 0x06,0x0e,0x2b,0x34,0x02,0x05,0x01,0x01,0x0d,0x01,0x02,0x01,0x01,0x05,0x01,0x00 };
+static const uint8_t key_content_storage[16]  = { 0x06,0x0e,0x2b,0x34,0x02,0x53,0x01,0x01,0x0d,0x01,0x01,0x01,0x01,0x01,0x18,0x00 };
+static const uint8_t key_material_package[16] = { 0x06,0x0e,0x2b,0x34,0x02,0x53,0x01,0x01,0x0d,0x01,0x01,0x01,0x01,0x01,0x36,0x00 };
+static const uint8_t key_track[16]            = { 0x06,0x0e,0x2b,0x34,0x02,0x53,0x01,0x01,0x0d,0x01,0x01,0x01,0x01,0x01,0x3b,0x00 };
+static const uint8_t key_sequence[16]         = { 0x06,0x0e,0x2b,0x34,0x02,0x53,0x01,0x01,0x0d,0x01,0x01,0x01,0x01,0x01,0x0f,0x00 };
+static const uint8_t key_source_clip[16]      = { 0x06,0x0e,0x2b,0x34,0x02,0x53,0x01,0x01,0x0d,0x01,0x01,0x01,0x01,0x01,0x11,0x00 };
+static const uint8_t key_essence_element[16]  = { 0x06,0x0e,0x2b,0x34,0x01,0x02,0x01,0x01,0x0d,0x01,0x03,0x01,0x15,0x01,0x05,0x00 };
+static const uint8_t ul_op1a[16]              = { 0x06,0x0e,0x2b,0x34,0x04,0x01,0x01,0x01,0x0d,0x01,0x02,0x01,0x01,0x01,0x09,0x00 };
+static const uint8_t ul_picture_def[16]       = { 0x06,0x0e,0x2b,0x34,0x04,0x01,0x01,0x01,0x01,0x03,0x02,0x02,0x01,0x00,0x00,0x00 };
+
+typedef struct Buffer {
+    uint8_t *data;
+    size_t   size;
+    size_t   allocated;
+} Buffer;
+
+static void put_bytes(Buffer *b, const void *data, size_t size)
+{
+    if (b->size + size > b->allocated) {
+        b->allocated = 2 * (b->size + size);
+        b->data = realloc(b->data, b->allocated);
+        if (!b->data)
+            exit(1);
+    }
+    memcpy(b->data + b->size, data, size);
+    b->size += size;
+}
+
+static void put_be(Buffer *b, uint64_t value, int bytes)
+{
+    uint8_t tmp[8];
+    int i;
+
+    for (i = 0; i < bytes; i++)
+        tmp[i] = value >> (8 * (bytes - 1 - i));
+    put_bytes(b, tmp, bytes);
+}
+
+static void put_zeros(Buffer *b, int bytes)
+{
+    while (bytes-- > 0)
+        put_be(b, 0, 1);
+}
+
+static void make_uid(uint8_t uid[16], uint32_t kind, uint32_t index)
+{
+    /* UUID-like instance UIDs: constant prefix, kind and counter at the end */
+    static const uint8_t prefix[8] = { 0xad, 0xab, 0x44, 0x24, 0x2f, 0x25, 0x4d, 0xc7 };
+
+    memcpy(uid, prefix, 8);
+    uid[8]  = kind >> 24; uid[9]  = kind >> 16; uid[10] = kind >> 8; uid[11] = kind;
+    uid[12] = index >> 24; uid[13] = index >> 16; uid[14] = index >> 8; uid[15] = index;
+}
+
+static void put_klv(Buffer *b, const uint8_t key[16], const Buffer *value)
+{
+    put_bytes(b, key, 16);
+    put_be(b, 0x83, 1);
+    put_be(b, value->size, 3);
+    put_bytes(b, value->data, value->size);
+}
+
+static void put_tag(Buffer *b, int tag, const void *data, size_t size)
+{
+    put_be(b, tag, 2);
+    put_be(b, size, 2);
+    put_bytes(b, data, size);
+}
+
+static void put_ref_array(Buffer *b, int tag, uint32_t kind, uint32_t first, uint32_t count)
+{
+    uint8_t uid[16];
+    uint32_t i;
+
+    put_be(b, tag, 2);
+    put_be(b, 8 + 16 * count, 2);
+    put_be(b, count, 4);
+    put_be(b, 16, 4);
+    for (i = 0; i < count; i++) {
+        make_uid(uid, kind, first + i);
+        put_bytes(b, uid, 16);
+    }
+}
+
+static Buffer build_file(uint32_t nb_sets)
+{
+    Buffer file = { 0 }, set = { 0 };
+    uint32_t nb_tracks = (nb_sets + MAX_REFS_PER_SET - 1) / MAX_REFS_PER_SET;
+    uint8_t uid[16], umid[32] = { 0 };
+    uint32_t i;
+
+    /* header partition pack */
+    put_be(&set, 1, 2);                 /* major version */
+    put_be(&set, 3, 2);                 /* minor version */
+    put_be(&set, 1, 4);                 /* KAG size */
+    put_zeros(&set, 8 * 6);             /* this/previous/footer partition, header/index byte count */
+    put_be(&set, 0, 4);                 /* index SID */
+    put_be(&set, 0, 8);                 /* body offset */
+    put_be(&set, 1, 4);                 /* body SID */
+    put_bytes(&set, ul_op1a, 16);
+    put_be(&set, 0, 4);                 /* essence containers batch */
+    put_be(&set, 16, 4);
+    put_klv(&file, key_header_partition, &set);
+    set.size = 0;
+
+    put_be(&set, 0, 4);
+    put_be(&set, 18, 4);
+    put_klv(&file, key_primer_pack, &set);
+    set.size = 0;
+
+    /* source clips first so a linear lookup has to walk past all of them */
+    for (i = 0; i < nb_sets; i++) {
+        make_uid(uid, 4, i);
+        put_tag(&set, 0x3C0A, uid, 16);
+        put_tag(&set, 0x1101, umid, 32);
+        put_tag(&set, 0x1102, "\0\0\0\1", 4);
+        put_klv(&file, key_source_clip, &set);
+        set.size = 0;
+    }
+
+    for (i = 0; i < nb_tracks; i++) {
+        uint32_t first = i * MAX_REFS_PER_SET;
+        uint32_t count = nb_sets - first < MAX_REFS_PER_SET ? nb_sets - first : MAX_REFS_PER_SET;
+
+        make_uid(uid, 3, i);
+        put_tag(&set, 0x3C0A, uid, 16);
+        put_tag(&set, 0x0201, ul_picture_def, 16);
+        put_ref_array(&set, 0x1001, 4, first, count);
+        put_klv(&file, key_sequence, &set);
+        set.size = 0;
+
+        make_uid(uid, 2, i);
+        put_tag(&set, 0x3C0A, uid, 16);
+        put_be(&set, 0x4801, 2);
+        put_be(&set, 4, 2);
+        put_be(&set, i + 1, 4);
+        make_uid(uid, 3, i);
+        put_tag(&set, 0x4803, uid, 16);
+        put_klv(&file, key_track, &set);
+        set.size = 0;
+    }
+
+    make_uid(uid, 1, 0);
+    put_tag(&set, 0x3C0A, uid, 16);
+    put_ref_array(&set, 0x4403, 2, 0, nb_tracks);
+    put_klv(&file, key_material_package, &set);
+    set.size = 0;
+
+    make_uid(uid, 0, 0);
+    put_tag(&set, 0x3C0A, uid, 16);
+    put_ref_array(&set, 0x1901, 1, 0, 1);
+    put_klv(&file, key_content_storage, &set);
+    set.size = 0;
+
+    put_zeros(&set, 16);
+    put_klv(&file, key_essence_element, &set);
+
+    free(set.data);
+    return file;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t nb_sets  = argc > 1 ? strtoul(argv[1], NULL, 0) : 100000;
+    int iterations    = argc > 2 ? atoi(argv[2]) : 3;
+    const char *path  = argc > 3 ? argv[3] : "bench_mxf_open.mxf";
+    Buffer file = build_file(nb_sets);
+    int64_t best = INT64_MAX;
+    int nb_streams = 0;
+    FILE *f;
+    int i;
+
+    f = fopen(path, "wb");
+    if (!f || fwrite(file.data, 1, file.size, f) != file.size) {
+        fprintf(stderr, "Can't write %s\n", path);
+        return 1;
+    }
+    fclose(f);
+    free(file.data);
+
+    av_log_set_level(AV_LOG_QUIET);
+
+    for (i = 0; i < iterations; i++) {
+        AVFormatContext *s = NULL;
+        int64_t start = av_gettime_relative();
+        int ret = avformat_open_input(&s, path, NULL, NULL);
+        int64_t elapsed = av_gettime_relative() - start;
+
+        if (ret < 0) {
+            fprintf(stderr, "Can't open %s: %s\n", path, av_err2str(ret));
+            return 1;
+        }
+        nb_streams = s->nb_streams;
+        avformat_close_input(&s);
+
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    printf("mxf header open: %u sets, %zu bytes, %d streams, best of %d: %.3f ms\n",
+           nb_sets, file.size, nb_streams, iterations, best / 1000.0);
+
+    remove(path);
+    return 0;
+}
@@ -0,0 +1,223 @@
+/**
+ * @brief Loopback benchmark for the SRT protocol
+ *
+ * A sender and a receiver thread exchange timestamped TS sized packets over
+ * srt:// on 127.0.0.1 through the libavformat wrapper, and the sustained
+ * throughput, the end-to-end latency percentiles and the CPU time per Mbps
+ * of the whole process are reported.
+ *
+ * Usage: bench_srt_loopback [live|file] [Mbps, 0 unpaced] [seconds] [port]
+ *                           [extra URL options, e.g. "&latency=20000"]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "libavformat/avformat.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/time.h"
+
+#define TS_PACKET_SIZE 188
+#define TS_PER_MESSAGE 7
+
+typedef struct Bench {
+    char send_url[1024];
+    char recv_url[1024];
+    double mbps;
+    int seconds;
+
+    int recv_ret;
+    int send_ret;
+
+    uint64_t sent_packets;
+    uint64_t recv_packets;
+    uint64_t lost_packets;
+    int64_t first_recv;
+    int64_t last_recv;
+
+    int32_t *latency;
+    size_t nb_latency;
+    size_t latency_allocated;
+} Bench;
+
+static void add_latency(Bench *b, int64_t latency)
+{
+    if (b->nb_latency == b->latency_allocated) {
+        b->latency_allocated = b->latency_allocated ? 2 * b->latency_allocated : 65536;
+        b->latency = realloc(b->latency, b->latency_allocated * sizeof(*b->latency));
+        if (!b->latency)
+            exit(1);
+    }
+    b->latency[b->nb_latency++] = latency;
+}
+
+static void *receiver(void *arg)
+{
+    Bench *b = arg;
+    AVIOContext *pb = NULL;
+    uint8_t buf[32768 + TS_PACKET_SIZE];
+    uint64_t expected = 0;
+    int carry = 0;
+    int ret;
+
+    ret = avio_open2(&pb, b->recv_url, AVIO_FLAG_READ, NULL, NULL);
+    if (ret < 0) {
+        fprintf(stderr, "Can't open %s: %s\n", b->recv_url, av_err2str(ret));
+        b->recv_ret = ret;
+        return NULL;
+    }
+
+    while (1) {
+        int len, i;
+
+        len = avio_read_partial(pb, buf + carry, sizeof(buf) - TS_PACKET_SIZE);
+        if (len <= 0)
+            break;
+        len += carry;
+
+        for (i = 0; i + TS_PACKET_SIZE <= len; i += TS_PACKET_SIZE) {
+            int64_t now = av_gettime_relative();
+            uint64_t seq;
+
+            if (buf[i] != 0x47) {
+                fprintf(stderr, "Lost TS packet alignment\n");
+                b->recv_ret = AVERROR_INVALIDDATA;
+                goto end;
+            }
+            seq = AV_RB64(buf + i + 9);
+            if (seq > expected)
+                b->lost_packets += seq - expected;
+            expected = seq + 1;
+
+            if (!b->first_recv)
+                b->first_recv = now;
+            b->last_recv = now;
+            b->recv_packets++;
+            add_latency(b, now - (int64_t)AV_RB64(buf + i + 1));
+        }
+        carry = len - i;
+        memmove(buf, buf + i, carry);
+    }
+
+end:
+    avio_closep(&pb);
+    return NULL;
+}
+
+static void *sender(void *arg)
+{
+    Bench *b = arg;
+    AVIOContext *pb = NULL;
+    uint8_t msg[TS_PACKET_SIZE * TS_PER_MESSAGE] = { 0 };
+    int64_t start, duration = b->seconds * INT64_C(1000000);
+    uint64_t bytes = 0;
+    int ret, i;
+
+    /* The listener may not be up yet */
+    for (i = 0; i < 50; i++) {
+        ret = avio_open2(&pb, b->send_url, AVIO_FLAG_WRITE, NULL, NULL);
+        if (ret >= 0)
+            break;
+        av_usleep(100000);
+    }
+    if (ret < 0) {
+        fprintf(stderr, "Can't open %s: %s\n", b->send_url, av_err2str(ret));
+        b->send_ret = ret;
+        return NULL;
+    }
+
+    start = av_gettime_relative();
+    while (av_gettime_relative() - start < duration) {
+        if (b->mbps > 0) {
+            int64_t due = start + bytes * 8 / b->mbps;
+            int64_t now = av_gettime_relative();
+            if (due > now)
+                av_usleep(due - now);
+        }
+
+        for (i = 0; i < TS_PER_MESSAGE; i++) {
+            uint8_t *p = msg + i * TS_PACKET_SIZE;
+            p[0] = 0x47;
+            AV_WB64(p + 1, av_gettime_relative());
+            AV_WB64(p + 9, b->sent_packets++);
+        }
+        avio_write(pb, msg, sizeof(msg));
+        bytes += sizeof(msg);
+
+        if (pb->error) {
+            b->send_ret = pb->error;
+            break;
+        }
+    }
+
+    avio_closep(&pb);
+    return NULL;
+}
+
+static int cmp_latency(const void *a, const void *b)
+{
+    return *(const int32_t *)a - *(const int32_t *)b;
+}
+
+static double percentile(const Bench *b, double p)
+{
+    size_t i = (size_t)(p / 100 * (b->nb_latency - 1));
+    return b->latency[i] / 1000.0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *transtype = argc > 1 ? argv[1] : "live";
+    const char *extra     = argc > 5 ? argv[5] : "";
+    int port              = argc > 4 ? atoi(argv[4]) : 9710;
+    Bench b = { 0 };
+    pthread_t recv_thread, send_thread;
+    struct rusage usage;
+    double wall, cpu, mbps;
+
+    b.mbps    = argc > 2 ? atof(argv[2]) : (strcmp(transtype, "file") ? 50 : 0);
+    b.seconds = argc > 3 ? atoi(argv[3]) : 10;
+
+    snprintf(b.recv_url, sizeof(b.recv_url),
+             "srt://127.0.0.1:%d?mode=listener&transtype=%s&timeout=2000000&listen_timeout=5000000%s",
+             port, transtype, extra);
+    snprintf(b.send_url, sizeof(b.send_url),
+             "srt://127.0.0.1:%d?mode=caller&transtype=%s%s",
+             port, transtype, extra);
+
+    av_log_set_level(getenv("LOG") ? atoi(getenv("LOG")) : AV_LOG_ERROR);
+    avformat_network_init();
+
+    pthread_create(&recv_thread, NULL, receiver, &b);
+    pthread_create(&send_thread, NULL, sender, &b);
+    pthread_join(send_thread, NULL);
+    pthread_join(recv_thread, NULL);
+
+    avformat_network_deinit();
+
+    if (b.send_ret < 0 || b.recv_ret < 0 || !b.nb_latency) {
+        fprintf(stderr, "srt loopback failed\n");
+        return 1;
+    }
+
+    getrusage(RUSAGE_SELF, &usage);
+    cpu  = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    wall = (b.last_recv - b.first_recv) / 1e6;
+    mbps = wall > 0 ? b.recv_packets * TS_PACKET_SIZE * 8 / wall / 1e6 : 0;
+
+    qsort(b.latency, b.nb_latency, sizeof(*b.latency), cmp_latency);
+
+    printf("srt loopback %s: %.2f Mbps over %.2f s, %"PRIu64"/%"PRIu64" packets, %"PRIu64" lost\n",
+           transtype, mbps, wall, b.recv_packets, b.sent_packets, b.lost_packets);
+    printf("latency ms: p50 %.3f p90 %.3f p99 %.3f max %.3f\n",
+           percentile(&b, 50), percentile(&b, 90), percentile(&b, 99), percentile(&b, 100));
+    printf("cpu: %.3f s, %.3f %% of a core per Mbps\n",
+           cpu, mbps > 0 && wall > 0 ? cpu / wall * 100 / mbps : 0);
+
+    free(b.latency);
+    return 0;
+}
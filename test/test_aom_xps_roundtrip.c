@@ -0,0 +1,322 @@
+#include <check.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libavcodec/avcodec.h"
+#include "libavutil/frame.h"
+#include "irxps/ir_xps_common.h"
+
+#define NB_FRAMES 40
+#define WIDTH     176
+#define HEIGHT    144
+
+#define OBU_FRAME_HEADER 3
+#define OBU_TILE_GROUP   4
+#define OBU_FRAME        6
+
+/**
+ * @brief Encode moving content with key frames and hidden alternate references
+ * @return number of packets in pkts
+ */
+static int encode_source(AVPacket *pkts)
+{
+    AVCodecContext *enc = avcodec_alloc_context3(avcodec_find_encoder_by_name("libaom-av1"));
+    AVDictionary *opts = NULL;
+    AVFrame *frame = av_frame_alloc();
+    AVPacket pkt;
+    int i, n = 0, ret;
+
+    fail_unless(enc != NULL);
+    av_init_packet(&pkt);
+    enc->width        = WIDTH;
+    enc->height       = HEIGHT;
+    enc->pix_fmt      = AV_PIX_FMT_YUV420P;
+    enc->time_base    = (AVRational){ 1, 25 };
+    enc->gop_size     = 16;
+    enc->bit_rate     = 300000;
+    enc->thread_count = 1;
+    av_dict_set(&opts, "cpu-used", "6", 0);
+    fail_unless(0 == avcodec_open2(enc, enc->codec, &opts));
+    av_dict_free(&opts);
+
+    frame->format = enc->pix_fmt;
+    frame->width  = enc->width;
+    frame->height = enc->height;
+    fail_unless(0 == av_frame_get_buffer(frame, 32));
+
+    for (i = 0; i <= NB_FRAMES; i++) {
+        if (i < NB_FRAMES) {
+            int x, y;
+
+            fail_unless(0 == av_frame_make_writable(frame));
+            for (y = 0; y < HEIGHT; y++)
+                for (x = 0; x < WIDTH; x++) {
+                    int v = (x * 2 + y + i * 3) & 255;
+                    if (x > 20 + i * 3 && x < 60 + i * 3 && y > 30 + i && y < 80 + i)
+                        v = 200 - ((x ^ y) & 15);
+                    frame->data[0][y * frame->linesize[0] + x] = v ^ ((x * y * 7 + i) >> 5 & 3);
+                }
+            for (y = 0; y < HEIGHT / 2; y++)
+                for (x = 0; x < WIDTH / 2; x++) {
+                    frame->data[1][y * frame->linesize[1] + x] = 128 + ((x + i) & 31);
+                    frame->data[2][y * frame->linesize[2] + x] = 100 + ((y * 3 + i) & 63);
+                }
+            frame->pts = i;
+            fail_unless(0 == avcodec_send_frame(enc, frame));
+        } else {
+            fail_unless(0 == avcodec_send_frame(enc, NULL));
+        }
+
+        while ((ret = avcodec_receive_packet(enc, &pkt)) == 0)
+            av_packet_move_ref(&pkts[n++], &pkt);
+        fail_unless(ret == AVERROR(EAGAIN) || ret == AVERROR_EOF);
+    }
+
+    avcodec_free_context(&enc);
+    av_frame_free(&frame);
+
+    return n;
+}
+
+static AVCodecContext *open_decoder(int exports)
+{
+    AVCodecContext *dec = avcodec_alloc_context3(avcodec_find_decoder_by_name("libaom-av1"));
+    AVDictionary *opts = NULL;
+
+    fail_unless(dec != NULL);
+    dec->thread_count = 1;
+    if (exports)
+        av_dict_set(&opts, "irdeto_exports", "1", 0);
+    fail_unless(0 == avcodec_open2(dec, dec->codec, &opts));
+    av_dict_free(&opts);
+
+    return dec;
+}
+
+/**
+ * @brief Open the encoder all pictures are re-encoded with, one after another
+ */
+static AVCodecContext *open_reencoder(void)
+{
+    AVCodecContext *enc = avcodec_alloc_context3(avcodec_find_encoder_by_name("libaom-av1"));
+    AVDictionary *opts = NULL;
+
+    enc->width        = WIDTH;
+    enc->height       = HEIGHT;
+    enc->pix_fmt      = AV_PIX_FMT_YUV420P;
+    enc->time_base    = (AVRational){ 1, 25 };
+    enc->thread_count = 1;
+    av_dict_set(&opts, "cpu-used", "6", 0);
+    av_dict_set(&opts, "crf", "20", 0);
+    av_dict_set(&opts, "irdeto_exports", "1", 0);
+    fail_unless(0 == avcodec_open2(enc, enc->codec, &opts));
+    av_dict_free(&opts);
+
+    return enc;
+}
+
+/**
+ * @brief Walk the OBUs of a temporal unit, all carry a size field
+ * @return number of OBUs
+ */
+static int parse_obus(const AVPacket *pkt, int *type, int *offset, int *size)
+{
+    int pos = 0, n = 0;
+
+    while (pos < pkt->size) {
+        const uint8_t *obu = pkt->data + pos;
+        int header = 1 + !!(obu[0] & 0x04), len = 0, i = 0;
+
+        fail_unless(obu[0] & 0x02);
+        do {
+            len |= (obu[header + i] & 0x7f) << (7 * i);
+        } while (obu[header + i++] & 0x80);
+
+        type[n]   = (obu[0] >> 3) & 15;
+        offset[n] = pos;
+        size[n]   = header + i + len;
+        pos += size[n++];
+    }
+    fail_unless(pos == pkt->size);
+
+    return n;
+}
+
+/**
+ * @brief Replace the shown frame of a temporal unit by the re-encoded one,
+ *        frames hidden before it in the unit are kept
+ */
+static void splice(const AVPacket *tu, const AVPacket *reencoded, AVPacket *dst)
+{
+    int type[64], offset[64], size[64], n, i, last = -1, pos;
+
+    n = parse_obus(tu, type, offset, size);
+    for (i = 0; i < n; i++)
+        if (type[i] == OBU_FRAME || type[i] == OBU_FRAME_HEADER)
+            last = i;
+    fail_unless(last >= 0);
+
+    fail_unless(0 == av_new_packet(dst, offset[last] + reencoded->size));
+    memcpy(dst->data, tu->data, offset[last]);
+    pos = offset[last];
+
+    n = parse_obus(reencoded, type, offset, size);
+    for (i = 0; i < n; i++) {
+        if (type[i] != OBU_FRAME && type[i] != OBU_FRAME_HEADER &&
+            type[i] != OBU_TILE_GROUP)
+            continue;
+        memcpy(dst->data + pos, reencoded->data + offset[i], size[i]);
+        pos += size[i];
+    }
+    av_shrink_packet(dst, pos);
+}
+
+static double psnr(const AVFrame *a, const AVFrame *b)
+{
+    double sse = 0;
+    int x, y;
+
+    for (y = 0; y < HEIGHT; y++)
+        for (x = 0; x < WIDTH; x++) {
+            int d = a->data[0][y * a->linesize[0] + x] - b->data[0][y * b->linesize[0] + x];
+            sse += d * d;
+        }
+
+    return sse ? 10 * log10(255.0 * 255 * WIDTH * HEIGHT / sse) : 99;
+}
+
+static int same_picture(const AVFrame *a, const AVFrame *b)
+{
+    int i, y;
+
+    for (i = 0; i < 3; i++)
+        for (y = 0; y < (i ? HEIGHT / 2 : HEIGHT); y++)
+            if (memcmp(a->data[i] + y * a->linesize[i], b->data[i] + y * b->linesize[i],
+                       i ? WIDTH / 2 : WIDTH))
+                return 0;
+    return 1;
+}
+
+/**
+ * @brief Decode the source with one temporal unit replaced, the pictures
+ *        decoded after it must be the ones of the source
+ * @return the picture of the replaced unit
+ */
+static AVFrame *decode_spliced(AVPacket *pkts, int nb, int replaced,
+                               const AVPacket *tu, AVFrame **source)
+{
+    AVCodecContext *dec = open_decoder(0);
+    AVFrame *frame = av_frame_alloc(), *out = NULL;
+    int i;
+
+    for (i = 0; i < nb; i++) {
+        fail_unless(0 == avcodec_send_packet(dec, i == replaced ? tu : &pkts[i]));
+        fail_unless(0 == avcodec_receive_frame(dec, frame));
+        if (i == replaced)
+            out = av_frame_clone(frame);
+        else if (i > replaced)
+            fail_unless(same_picture(frame, source[i]));
+        av_frame_unref(frame);
+    }
+
+    avcodec_free_context(&dec);
+    av_frame_free(&frame);
+
+    return out;
+}
+
+START_TEST(test_reencode_against_imported_refs)
+{
+    AVPacket pkts[2 * NB_FRAMES];
+    AVFrame *source[2 * NB_FRAMES];
+    AVCodecContext *dec, *enc;
+    AVFrame *frame = av_frame_alloc();
+    AVPacket pkt;
+    int nb_pkts, i, ret, nb_spliced = 0, nb_refused = 0, nb_altref = 0;
+
+    nb_pkts = encode_source(pkts);
+    fail_unless(nb_pkts >= NB_FRAMES);
+
+    dec = open_decoder(0);
+    for (i = 0; i < nb_pkts; i++) {
+        source[i] = av_frame_alloc();
+        fail_unless(0 == avcodec_send_packet(dec, &pkts[i]));
+        fail_unless(0 == avcodec_receive_frame(dec, source[i]));
+    }
+    avcodec_free_context(&dec);
+
+    dec = open_decoder(1);
+    enc = open_reencoder();
+    av_init_packet(&pkt);
+
+    for (i = 0; i < nb_pkts; i++) {
+        ir_xps_context *ctx;
+
+        fail_unless(0 == avcodec_send_packet(dec, &pkts[i]));
+        fail_unless(0 == avcodec_receive_frame(dec, frame));
+
+        ctx = frame->opaque;
+        if (ctx && ctx->av1_meta.fh.show_frame) {
+            AVPacket spliced;
+            AVFrame *out;
+
+            // Reference frames, key frames included, are refused: the frames
+            // decoded after them use the state saved with them in the slots
+            ret = avcodec_send_frame(enc, frame);
+            if (ctx->av1_meta.fh.refresh_frame_flags) {
+                fail_unless(ret == AVERROR(EINVAL));
+                nb_refused++;
+                ir_xps_context_destroy(ctx);
+                av_frame_unref(frame);
+                continue;
+            }
+            fail_unless(ret == 0);
+
+            if (ctx->av1_meta.ref_slot[1] >= 0 &&
+                ctx->av1_meta.ref_slot[1] != ctx->av1_meta.ref_slot[0])
+                nb_altref++;
+
+            // Each picture comes out right away as an inter frame
+            fail_unless(0 == avcodec_receive_packet(enc, &pkt));
+            fail_unless(!(pkt.flags & AV_PKT_FLAG_KEY));
+
+            // and decodes in place of the source picture to the same content,
+            // leaving the rest of the stream unchanged
+            splice(&pkts[i], &pkt, &spliced);
+            out = decode_spliced(pkts, nb_pkts, i, &spliced, source);
+            fail_unless(psnr(out, frame) > 35);
+            nb_spliced++;
+
+            av_frame_free(&out);
+            av_packet_unref(&spliced);
+            av_packet_unref(&pkt);
+        }
+        if (ctx)
+            ir_xps_context_destroy(ctx);
+        av_frame_unref(frame);
+    }
+    fail_unless(nb_spliced >= 3);
+    fail_unless(nb_refused >= NB_FRAMES / 2);
+    fail_unless(nb_altref >= 2);
+
+    for (i = 0; i < nb_pkts; i++) {
+        av_packet_unref(&pkts[i]);
+        av_frame_free(&source[i]);
+    }
+    avcodec_free_context(&dec);
+    avcodec_free_context(&enc);
+    av_frame_free(&frame);
+}
+END_TEST
+
+Suite *test_suite(void)
+{
+    Suite *s = suite_create("Irdeto patches: libaom AV1 XPS round trip");
+    TCase *tc = tcase_create("Round trip tests");
+    tcase_set_timeout(tc, 60);
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_reencode_against_imported_refs);
+
+    return s;
+}
@@ -0,0 +1,244 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <check.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "libavformat/avformat.h"
+#include "libavformat/avio_internal.h"
+#include "libavformat/url.h"
+#include "libavutil/time.h"
+
+#define TEST_FILE      "test_avio_readahead.bin"
+#define READAHEAD_SIZE "262144"
+
+static void write_pattern(const char *mode, int offset, int size)
+{
+    FILE *f = fopen(TEST_FILE, mode);
+    int i;
+
+    fail_unless(f != NULL);
+    for (i = offset; i < offset + size; i++)
+        fputc(i * 7 + (i >> 8), f);
+    fclose(f);
+}
+
+static int check_pattern(const uint8_t *buf, int offset, int size)
+{
+    int i;
+
+    for (i = offset; i < offset + size; i++)
+        if (buf[i - offset] != (uint8_t)(i * 7 + (i >> 8)))
+            return 0;
+    return 1;
+}
+
+static AVIOContext *open_readahead(const char *url, const AVIOInterruptCB *cb, const char *extra)
+{
+    AVIOContext *pb = NULL;
+    AVDictionary *opts = NULL;
+
+    av_dict_set(&opts, "readahead_size", READAHEAD_SIZE, 0);
+    if (extra)
+        av_dict_parse_string(&opts, extra, "=", ":", 0);
+    fail_unless(0 <= avio_open2(&pb, url, AVIO_FLAG_READ, cb, &opts));
+    av_dict_free(&opts);
+
+    return pb;
+}
+
+START_TEST(test_urlcontext_behind_readahead)
+{
+    AVIOContext *pb;
+    AVPacket pkt;
+    AVDictionary *opts = NULL;
+    uint8_t buf[1000];
+
+    write_pattern("wb", 0, 1 << 20);
+
+    // Zero copy packets are refused for files which can still be truncated
+    av_dict_set(&opts, "zerocopy", "1", 0);
+    fail_unless(AVERROR(EPERM) == avio_open2(&pb, "mmap:" TEST_FILE, AVIO_FLAG_READ, NULL, &opts));
+    av_dict_free(&opts);
+    fail_unless(0 == chmod(TEST_FILE, 0444));
+
+    // Memory mapped zero copy packets still work with read-ahead
+    pb = open_readahead("mmap:" TEST_FILE, NULL, "zerocopy=1");
+    fail_unless(ffio_geturlcontext(pb) != NULL);
+    fail_unless(0 <= avio_seek(pb, 4096, SEEK_SET));
+    fail_unless(100000 == av_get_packet(pb, &pkt, 100000));
+    fail_unless(pkt.pos == 4096);
+    fail_unless(pkt.buf->size == 100000);
+    fail_unless(check_pattern(pkt.data, 4096, 100000));
+    av_packet_unref(&pkt);
+    fail_unless(avio_tell(pb) == 4096 + 100000);
+
+    // Handing the URLContext back continues at the read position
+    fail_unless(sizeof(buf) == avio_read(pb, buf, sizeof(buf)));
+    fail_unless(check_pattern(buf, 104096, sizeof(buf)));
+    ffio_stop_readahead(pb);
+    fail_unless(ffio_geturlcontext(pb) != NULL);
+    fail_unless(sizeof(buf) == avio_read(pb, buf, sizeof(buf)));
+    fail_unless(check_pattern(buf, 105096, sizeof(buf)));
+    fail_unless(0 <= ffio_start_readahead(pb));
+    fail_unless(0 <= avio_seek(pb, 700000, SEEK_SET));
+    fail_unless(sizeof(buf) == avio_read(pb, buf, sizeof(buf)));
+    fail_unless(check_pattern(buf, 700000, sizeof(buf)));
+    avio_closep(&pb);
+
+    remove(TEST_FILE);
+}
+END_TEST
+
+START_TEST(test_eof_not_sticky)
+{
+    AVIOContext *pb;
+    static uint8_t buf[100000];
+
+    write_pattern("wb", 0, 100000);
+    pb = open_readahead("file:" TEST_FILE, NULL, NULL);
+
+    fail_unless(100000 == avio_read(pb, buf, 50000) + avio_read(pb, buf + 50000, 50000));
+    fail_unless(AVERROR_EOF == avio_read(pb, buf, 1000));
+    fail_unless(avio_feof(pb));
+
+    // Data appended to a growing file is found by another read
+    write_pattern("ab", 100000, 30000);
+    pb->eof_reached = 0;
+    fail_unless(30000 == avio_read(pb, buf, 30000));
+    fail_unless(check_pattern(buf, 100000, 30000));
+    fail_unless(AVERROR_EOF == avio_read(pb, buf, 1000));
+
+    // and by a seek to the old end
+    write_pattern("ab", 130000, 20000);
+    fail_unless(130000 == avio_seek(pb, 130000, SEEK_SET));
+    fail_unless(20000 == avio_read(pb, buf, 20000));
+    fail_unless(check_pattern(buf, 130000, 20000));
+
+    avio_closep(&pb);
+    remove(TEST_FILE);
+}
+END_TEST
+
+START_TEST(test_streamed_messages_gathered)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    socklen_t addr_len = sizeof(addr);
+    static uint8_t buf[40 * 1316];
+    char url[64];
+    AVIOContext *pb;
+    int fd, i, len = 0, ret;
+
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    fail_unless(fd >= 0);
+    fail_unless(0 == bind(fd, (struct sockaddr *)&addr, sizeof(addr)));
+    fail_unless(0 == getsockname(fd, (struct sockaddr *)&addr, &addr_len));
+    close(fd);
+    snprintf(url, sizeof(url), "udp://127.0.0.1:%d", ntohs(addr.sin_port));
+    pb = open_readahead(url, NULL, NULL);
+
+    // Each datagram is one read of the protocol, they are appended to the
+    // block being filled and come out in order
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    fail_unless(fd >= 0);
+    for (i = 0; i < 40; i++) {
+        uint8_t msg[1316];
+        int j;
+
+        for (j = 0; j < sizeof(msg); j++)
+            msg[j] = (i * 1316 + j) * 7 + ((i * 1316 + j) >> 8);
+        fail_unless(sizeof(msg) == sendto(fd, msg, sizeof(msg), 0, (struct sockaddr *)&addr, sizeof(addr)));
+        if (i % 8 == 7)
+            av_usleep(10000);
+    }
+    while (len < sizeof(buf)) {
+        ret = avio_read_partial(pb, buf + len, sizeof(buf) - len);
+        fail_unless(ret > 0);
+        len += ret;
+    }
+    fail_unless(check_pattern(buf, 0, sizeof(buf)));
+
+    avio_closep(&pb);
+    close(fd);
+}
+END_TEST
+
+typedef struct InterruptState {
+    pthread_t reader;
+    int nb_calls;
+    int nb_foreign_calls;
+    int interrupt;
+} InterruptState;
+
+static int interrupt_cb(void *opaque)
+{
+    InterruptState *state = opaque;
+
+    if (!pthread_equal(pthread_self(), state->reader))
+        state->nb_foreign_calls++;
+    state->nb_calls++;
+    return state->interrupt && state->nb_calls > 3;
+}
+
+START_TEST(test_interrupt_polled_by_reader)
+{
+    InterruptState state = { .reader = pthread_self(), .interrupt = 1 };
+    AVIOInterruptCB cb = { interrupt_cb, &state };
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    socklen_t addr_len = sizeof(addr);
+    char url[64];
+    uint8_t buf[16];
+    AVIOContext *pb;
+    int listen_fd, fd;
+
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    fail_unless(listen_fd >= 0);
+    fail_unless(0 == bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)));
+    fail_unless(0 == listen(listen_fd, 1));
+    fail_unless(0 == getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len));
+    snprintf(url, sizeof(url), "tcp://127.0.0.1:%d", ntohs(addr.sin_port));
+
+    // The worker blocked on the silent peer gives up with the reader
+    pb = open_readahead(url, &cb, NULL);
+    fail_unless(AVERROR_EXIT == avio_read(pb, buf, sizeof(buf)));
+
+    // and reads again once the reader continues
+    fd = accept(listen_fd, NULL, NULL);
+    fail_unless(fd >= 0);
+    fail_unless(sizeof(buf) == write(fd, "0123456789abcdef", sizeof(buf)));
+    state.interrupt  = 0;
+    pb->eof_reached  = 0;
+    pb->error        = 0;
+    fail_unless(sizeof(buf) == avio_read(pb, buf, sizeof(buf)));
+    fail_unless(!memcmp(buf, "0123456789abcdef", sizeof(buf)));
+
+    avio_closep(&pb);
+    close(fd);
+    close(listen_fd);
+
+    // The caller's callback is never run by the read-ahead workers
+    fail_unless(state.nb_calls > 3);
+    fail_unless(state.nb_foreign_calls == 0);
+}
+END_TEST
+
+Suite *test_suite(void)
+{
+    Suite *s = suite_create("Irdeto patches: AVIOContext read-ahead");
+    TCase *tc = tcase_create("Read-ahead tests");
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_urlcontext_behind_readahead);
+    tcase_add_test(tc, test_eof_not_sticky);
+    tcase_add_test(tc, test_streamed_messages_gathered);
+    tcase_add_test(tc, test_interrupt_polled_by_reader);
+
+    return s;
+}
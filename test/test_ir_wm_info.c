@@ -0,0 +1,112 @@
+#include <check.h>
+#include <string.h>
+
+#include "libavutil/ir_wm_info.h"
+
+/**
+ * @brief Generate a payload of the given type and parse it back
+ * @param in watermark info to be carried
+ * @param type SEI payload format
+ * @param out parsed watermark info
+ * @return detected SEI payload format
+ */
+static AVIrdetoSeiType roundtrip(AVIrdetoWatermark *in, AVIrdetoSeiType type, AVIrdetoWatermark *out)
+{
+    uint8_t payload[64];
+    size_t payload_size = sizeof(payload);
+    AVIrdetoSeiType parsed = AV_WM_SEI_NONE;
+
+    fail_unless(0 == av_wm_info_alloc_sei(in, type, payload, &payload_size));
+    fail_unless(0 == av_wm_info_parse_sei(payload, payload_size, out, &parsed));
+
+    return parsed;
+}
+
+
+START_TEST(test_parse_irdeto_v2)
+{
+    AVIrdetoWatermark in = { .bitval = 1, .bitpos = 0x5A5A5A5 };
+    AVIrdetoWatermark out;
+
+    fail_unless(AV_WM_SEI_IRDETO_V2 == roundtrip(&in, AV_WM_SEI_IRDETO_V2, &out));
+    fail_unless(in.bitval == out.bitval);
+    fail_unless(in.bitpos == out.bitpos);
+    fail_unless(1 == out.watermarked);
+}
+END_TEST
+
+START_TEST(test_parse_irdeto_v3)
+{
+    AVIrdetoWatermark in = { .bitlen = 256, .bitval = 1, .bitpos = 0xFEDCBA9876543210ULL };
+    AVIrdetoWatermark out;
+
+    fail_unless(AV_WM_SEI_IRDETO_V3 == roundtrip(&in, AV_WM_SEI_IRDETO_V3, &out));
+    fail_unless(in.bitlen == out.bitlen);
+    fail_unless(in.bitval == out.bitval);
+    fail_unless(in.bitpos == out.bitpos);
+}
+END_TEST
+
+START_TEST(test_parse_dash_if)
+{
+    AVIrdetoWatermark in = { .bitval = 0xA5, .bitpos = 0x1234 };
+    AVIrdetoWatermark out;
+
+    fail_unless(AV_WM_SEI_DASH_IF == roundtrip(&in, AV_WM_SEI_DASH_IF, &out));
+    fail_unless(in.bitval == out.bitval);
+    fail_unless(in.bitpos == out.bitpos);
+}
+END_TEST
+
+START_TEST(test_parse_invalid)
+{
+    uint8_t payload[64];
+    size_t payload_size = sizeof(payload);
+    AVIrdetoWatermark in = { .bitval = 1, .bitpos = 7 };
+
+    fail_unless(0 == av_wm_info_alloc_sei(&in, AV_WM_SEI_IRDETO_V2, payload, &payload_size));
+
+    // Truncated payload
+    fail_unless(0 > av_wm_info_parse_sei(payload, payload_size - 1, NULL, NULL));
+
+    // Unknown version
+    payload[16] = 4;
+    fail_unless(0 > av_wm_info_parse_sei(payload, payload_size, NULL, NULL));
+
+    // Unknown uuid
+    memset(payload, 0, payload_size);
+    fail_unless(0 > av_wm_info_parse_sei(payload, payload_size, NULL, NULL));
+}
+END_TEST
+
+START_TEST(test_msn)
+{
+    // 1 + epoch_time / seglen + elapsed / seglen, each term rounded down
+    fail_unless(1 == av_wm_info_get_msn(-1LL, 0LL, 2000LL));
+    fail_unless(1 == av_wm_info_get_msn(1999LL, 0LL, 2000LL));
+    fail_unless(851 == av_wm_info_get_msn(1700000LL, 0LL, 2000LL));
+    fail_unless(851 == av_wm_info_get_msn(1700000LL, 1999LL, 2000LL));
+    fail_unless(852 == av_wm_info_get_msn(1700000LL, 2000LL, 2000LL));
+
+    // Epoch and elapsed time are not summed before the division
+    fail_unless(1 == av_wm_info_get_msn(1500LL, 1500LL, 2000LL));
+
+    // No WM segment duration
+    fail_unless(1 == av_wm_info_get_msn(1700000LL, 5000LL, 0LL));
+}
+END_TEST
+
+
+Suite *test_suite(void)
+{
+    Suite *s = suite_create("Irdeto patches: watermark info SEI payloads");
+    TCase *tc = tcase_create("SEI payload generation/parsing tests");
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_parse_irdeto_v2);
+    tcase_add_test(tc, test_parse_irdeto_v3);
+    tcase_add_test(tc, test_parse_dash_if);
+    tcase_add_test(tc, test_parse_invalid);
+    tcase_add_test(tc, test_msn);
+
+    return s;
+}
@@ -0,0 +1,395 @@
+#include <check.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+#include "libavutil/adler32.h"
+#include "libavutil/file.h"
+#include "libavutil/intreadwrite.h"
+
+#define NB_FRAMES      30
+#define KLV_FILL_MIN   17
+
+static const uint8_t klv_fill_key[16] = { 0x06,0x0E,0x2B,0x34,0x01,0x01,0x01,0x02,0x03,0x01,0x02,0x10,0x01,0x00,0x00,0x00 };
+
+typedef struct SourcePacket {
+    int64_t pos;
+    int64_t hdr_size;
+    int size;
+} SourcePacket;
+
+/**
+ * @brief Encode the same test pattern at a given quantizer
+ * @param qscale fixed quantizer, higher gives smaller packets
+ * @param pkts NB_FRAMES encoded packets in decoding order
+ * @param par codec parameters of the stream
+ */
+static void encode_mpeg2(int qscale, AVPacket *pkts, AVCodecParameters *par)
+{
+    AVCodecContext *enc = avcodec_alloc_context3(avcodec_find_encoder(AV_CODEC_ID_MPEG2VIDEO));
+    AVFrame *frame = av_frame_alloc();
+    AVPacket pkt;
+    int i, n = 0, ret;
+
+    av_init_packet(&pkt);
+    enc->width          = 352;
+    enc->height         = 288;
+    enc->pix_fmt        = AV_PIX_FMT_YUV420P;
+    enc->time_base      = (AVRational){ 1, 25 };
+    enc->gop_size       = 12;
+    enc->max_b_frames   = 0;
+    enc->flags         |= AV_CODEC_FLAG_QSCALE;
+    enc->global_quality = FF_QP2LAMBDA * qscale;
+    fail_unless(0 == avcodec_open2(enc, enc->codec, NULL));
+    fail_unless(0 <= avcodec_parameters_from_context(par, enc));
+
+    frame->format = enc->pix_fmt;
+    frame->width  = enc->width;
+    frame->height = enc->height;
+    fail_unless(0 == av_frame_get_buffer(frame, 32));
+
+    for (i = 0; i <= NB_FRAMES; i++) {
+        if (i < NB_FRAMES) {
+            int x, y;
+
+            fail_unless(0 == av_frame_make_writable(frame));
+            for (y = 0; y < frame->height; y++)
+                for (x = 0; x < frame->width; x++)
+                    frame->data[0][y * frame->linesize[0] + x] = (x * y + i * 7) ^ (x >> 2);
+            for (y = 0; y < frame->height / 2; y++) {
+                memset(frame->data[1] + y * frame->linesize[1], 96 + i, frame->width / 2);
+                memset(frame->data[2] + y * frame->linesize[2], 160 - y / 4, frame->width / 2);
+            }
+            frame->pts = i;
+            fail_unless(0 == avcodec_send_frame(enc, frame));
+        } else {
+            fail_unless(0 == avcodec_send_frame(enc, NULL));
+        }
+        while ((ret = avcodec_receive_packet(enc, &pkt)) == 0) {
+            fail_unless(n < NB_FRAMES);
+            av_packet_move_ref(&pkts[n++], &pkt);
+        }
+        fail_unless(ret == AVERROR(EAGAIN) || ret == AVERROR_EOF);
+    }
+    fail_unless(n == NB_FRAMES);
+
+    avcodec_free_context(&enc);
+    av_frame_free(&frame);
+}
+
+static void write_source(const char *format, const char *file, AVPacket *pkts, int nb,
+                         const AVCodecParameters *par)
+{
+    AVFormatContext *oc = NULL;
+    AVStream *st;
+    int i;
+
+    fail_unless(0 <= avformat_alloc_output_context2(&oc, NULL, format, file));
+    fail_unless(0 <= avio_open(&oc->pb, file, AVIO_FLAG_WRITE));
+    st = avformat_new_stream(oc, NULL);
+    fail_unless(0 <= avcodec_parameters_copy(st->codecpar, par));
+    st->time_base = (AVRational){ 1, 25 };
+    fail_unless(0 <= avformat_write_header(oc, NULL));
+
+    for (i = 0; i < nb; i++) {
+        AVPacket pkt;
+
+        fail_unless(0 == av_packet_ref(&pkt, &pkts[i]));
+        pkt.stream_index = 0;
+        pkt.duration     = 1;
+        av_packet_rescale_ts(&pkt, (AVRational){ 1, 25 }, st->time_base);
+        fail_unless(0 == av_interleaved_write_frame(oc, &pkt));
+    }
+
+    fail_unless(0 == av_write_trailer(oc));
+    avio_closep(&oc->pb);
+    avformat_free_context(oc);
+}
+
+/**
+ * @brief Demux the video packets of a file
+ * @param src position information of each packet, may be NULL
+ * @param pkts packet copies, may be NULL
+ * @return number of video packets
+ */
+static int read_source(const char *file, SourcePacket *src, AVPacket *pkts)
+{
+    AVFormatContext *ic = NULL;
+    AVPacket pkt;
+    int n = 0;
+
+    fail_unless(0 == avformat_open_input(&ic, file, NULL, NULL));
+    fail_unless(0 <= avformat_find_stream_info(ic, NULL));
+    while (av_read_frame(ic, &pkt) >= 0) {
+        if (ic->streams[pkt.stream_index]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+            if (src)
+                src[n] = (SourcePacket){ pkt.pos, pkt.hdr_size, pkt.size };
+            if (pkts)
+                fail_unless(0 == av_packet_ref(&pkts[n], &pkt));
+            n++;
+        }
+        av_packet_unref(&pkt);
+    }
+    avformat_close_input(&ic);
+
+    return n;
+}
+
+/**
+ * @brief Patch file in place with the given packets
+ * @param keep_hdr_size pass the demuxer hdr_size on, otherwise leave it unset
+ */
+static void patch(const char *file, const AVCodecParameters *par, AVPacket *repl,
+                  const SourcePacket *src, int nb, int keep_hdr_size)
+{
+    AVFormatContext *oc = NULL;
+    AVStream *st;
+    int i;
+
+    fail_unless(0 <= avformat_alloc_output_context2(&oc, NULL, "irdeto_patch", file));
+    st = avformat_new_stream(oc, NULL);
+    fail_unless(0 <= avcodec_parameters_copy(st->codecpar, par));
+    st->time_base = (AVRational){ 1, 25 };
+    fail_unless(0 <= avformat_write_header(oc, NULL));
+
+    for (i = 0; i < nb; i++) {
+        AVPacket pkt;
+
+        fail_unless(0 == av_packet_ref(&pkt, &repl[i]));
+        pkt.stream_index = 0;
+        pkt.pos          = src[i].pos;
+        pkt.hdr_size     = keep_hdr_size ? src[i].hdr_size : 0;
+        fail_unless(0 == av_write_frame(oc, &pkt));
+        av_packet_unref(&pkt);
+    }
+
+    fail_unless(0 == av_write_trailer(oc));
+    avformat_free_context(oc);
+}
+
+/**
+ * @brief Decode packets and checksum the luma plane of every picture
+ * @return number of decoded pictures
+ */
+static int decode(enum AVCodecID codec_id, const AVCodecParameters *par, AVPacket *pkts, int nb, unsigned long *sums)
+{
+    AVCodecContext *dec = avcodec_alloc_context3(avcodec_find_decoder(codec_id));
+    AVFrame *frame = av_frame_alloc();
+    int i, y, n = 0;
+
+    if (par)
+        fail_unless(0 <= avcodec_parameters_to_context(dec, par));
+    fail_unless(0 == avcodec_open2(dec, dec->codec, NULL));
+
+    for (i = 0; i <= nb; i++) {
+        fail_unless(0 == avcodec_send_packet(dec, i < nb ? &pkts[i] : NULL));
+        while (avcodec_receive_frame(dec, frame) == 0) {
+            sums[n] = 1;
+            for (y = 0; y < frame->height; y++)
+                sums[n] = av_adler32_update(sums[n], frame->data[0] + y * frame->linesize[0], frame->width);
+            n++;
+            av_frame_unref(frame);
+        }
+    }
+
+    avcodec_free_context(&dec);
+    av_frame_free(&frame);
+    return n;
+}
+
+static int64_t file_size(const char *file)
+{
+    uint8_t *buf;
+    size_t size;
+
+    fail_unless(0 == av_file_map(file, &buf, &size, 0, NULL));
+    av_file_unmap(buf, size);
+    return size;
+}
+
+static int is_zero(const uint8_t *p, int64_t size)
+{
+    while (size-- > 0)
+        if (*p++)
+            return 0;
+    return 1;
+}
+
+static void free_packets(AVPacket *pkts, int nb)
+{
+    int i;
+
+    for (i = 0; i < nb; i++)
+        av_packet_unref(&pkts[i]);
+}
+
+/**
+ * @brief Patch an MPEG-2 file with a lower quality encode and compare the
+ *        decoded result with a decode of the replacement packets
+ */
+static void patch_and_compare(const char *format, const char *file, int keep_hdr_size)
+{
+    AVPacket orig[NB_FRAMES], repl[NB_FRAMES], patched[NB_FRAMES];
+    AVCodecParameters *par = avcodec_parameters_alloc();
+    SourcePacket src[NB_FRAMES];
+    unsigned long repl_sums[NB_FRAMES], patched_sums[NB_FRAMES];
+    int64_t size;
+    uint8_t *buf;
+    size_t buf_size;
+    int i;
+
+    encode_mpeg2(2, orig, par);
+    encode_mpeg2(31, repl, par);
+    write_source(format, file, orig, NB_FRAMES, par);
+    size = file_size(file);
+
+    fail_unless(NB_FRAMES == read_source(file, src, NULL));
+    for (i = 0; i < NB_FRAMES; i++)
+        fail_unless(repl[i].size <= orig[i].size);
+    patch(file, par, repl, src, NB_FRAMES, keep_hdr_size);
+
+    // Same size, replacement essence at the original places
+    fail_unless(file_size(file) == size);
+    fail_unless(NB_FRAMES == read_source(file, NULL, patched));
+    for (i = 0; i < NB_FRAMES; i++) {
+        fail_unless(patched[i].size >= repl[i].size);
+        fail_unless(!memcmp(patched[i].data, repl[i].data, repl[i].size));
+        fail_unless(is_zero(patched[i].data + repl[i].size, patched[i].size - repl[i].size));
+    }
+
+    // Nothing of the original essence is left in KLV fill items
+    if (src[0].hdr_size > 0) {
+        fail_unless(0 == av_file_map(file, &buf, &buf_size, 0, NULL));
+        for (i = 0; i < NB_FRAMES; i++) {
+            const uint8_t *p = buf + src[i].pos + src[i].hdr_size + repl[i].size;
+            int gap = src[i].size - repl[i].size;
+            int fill_hdr_size = gap - KLV_FILL_MIN < 0x80 ? KLV_FILL_MIN : KLV_FILL_MIN + 4;
+
+            if (gap >= KLV_FILL_MIN) {
+                fail_unless(!memcmp(p, klv_fill_key, 16));
+                fail_unless(is_zero(p + fill_hdr_size, gap - fill_hdr_size));
+            } else {
+                fail_unless(is_zero(p, gap));
+            }
+        }
+        av_file_unmap(buf, buf_size);
+    }
+
+    // Decodes to the same pictures as the replacement stream
+    fail_unless(NB_FRAMES == decode(AV_CODEC_ID_MPEG2VIDEO, NULL, repl, NB_FRAMES, repl_sums));
+    fail_unless(NB_FRAMES == decode(AV_CODEC_ID_MPEG2VIDEO, NULL, patched, NB_FRAMES, patched_sums));
+    fail_unless(!memcmp(repl_sums, patched_sums, sizeof(repl_sums)));
+
+    free_packets(orig, NB_FRAMES);
+    free_packets(repl, NB_FRAMES);
+    free_packets(patched, NB_FRAMES);
+    avcodec_parameters_free(&par);
+    remove(file);
+}
+
+START_TEST(test_patch_mxf)
+{
+    patch_and_compare("mxf", "test_irdeto_patch.mxf", 1);
+}
+END_TEST
+
+START_TEST(test_patch_mxf_without_hdr_size)
+{
+    patch_and_compare("mxf", "test_irdeto_patch_nohdr.mxf", 0);
+}
+END_TEST
+
+START_TEST(test_patch_ts)
+{
+    patch_and_compare("mpegts", "test_irdeto_patch.ts", 0);
+}
+END_TEST
+
+START_TEST(test_patch_mp4_filler_nal)
+{
+    const char *file = "test_irdeto_patch.mp4";
+    AVCodecParameters *par = avcodec_parameters_alloc();
+    AVPacket src_pkts[3], orig[3], patched[3];
+    SourcePacket src[3];
+    unsigned long orig_sums[3], patched_sums[3];
+    uint8_t *extradata, *sample;
+    size_t extradata_size, sample_size;
+    int64_t size;
+    int i, sei_size, gap;
+    AVPacket repl;
+
+    fail_unless(0 == av_file_map(AVC_ANNEXB_EXTRDADA_BIN_FILE, &extradata, &extradata_size, 0, NULL));
+    fail_unless(0 == av_file_map(AVC_ANNEXB_SAMPLE1_BIN_FILE, &sample, &sample_size, 0, NULL));
+
+    par->codec_type     = AVMEDIA_TYPE_VIDEO;
+    par->codec_id       = AV_CODEC_ID_H264;
+    par->width          = 1280;
+    par->height         = 720;
+    par->extradata      = av_mallocz(extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+    par->extradata_size = extradata_size;
+    memcpy(par->extradata, extradata, extradata_size);
+    for (i = 0; i < 3; i++) {
+        fail_unless(0 == av_new_packet(&src_pkts[i], sample_size));
+        memcpy(src_pkts[i].data, sample, sample_size);
+        src_pkts[i].pts = src_pkts[i].dts = i;
+        src_pkts[i].flags = AV_PKT_FLAG_KEY;
+    }
+    av_file_unmap(extradata, extradata_size);
+    av_file_unmap(sample, sample_size);
+    write_source("mp4", file, src_pkts, 3, par);
+    free_packets(src_pkts, 3);
+    size = file_size(file);
+
+    // Replace the middle sample by itself without its leading SEI NAL unit
+    fail_unless(3 == read_source(file, src, orig));
+    sei_size = 4 + AV_RB32(orig[1].data);
+    gap = sei_size;
+    fail_unless(0 == av_new_packet(&repl, orig[1].size - sei_size));
+    memcpy(repl.data, orig[1].data + sei_size, repl.size);
+    avcodec_parameters_free(&par);
+    {
+        AVFormatContext *ic = NULL;
+        fail_unless(0 == avformat_open_input(&ic, file, NULL, NULL));
+        par = avcodec_parameters_alloc();
+        fail_unless(0 <= avcodec_parameters_copy(par, ic->streams[0]->codecpar));
+        avformat_close_input(&ic);
+    }
+    patch(file, par, &repl, &src[1], 1, 0);
+
+    // Padded with one filler data NAL unit, other samples untouched
+    fail_unless(file_size(file) == size);
+    fail_unless(3 == read_source(file, NULL, patched));
+    fail_unless(patched[1].size == orig[1].size);
+    fail_unless(!memcmp(patched[1].data, repl.data, repl.size));
+    fail_unless(AV_RB32(patched[1].data + repl.size) == (uint32_t)gap - 4);
+    fail_unless(patched[1].data[repl.size + 4] == 12);
+    fail_unless(patched[1].data[patched[1].size - 1] == 0x80);
+    for (i = 0; i < 3; i += 2)
+        fail_unless(!memcmp(patched[i].data, orig[i].data, orig[i].size));
+
+    // The filler NAL unit is transparent to the decoder
+    fail_unless(3 == decode(AV_CODEC_ID_H264, par, orig, 3, orig_sums));
+    fail_unless(3 == decode(AV_CODEC_ID_H264, par, patched, 3, patched_sums));
+    fail_unless(!memcmp(orig_sums, patched_sums, sizeof(orig_sums)));
+
+    av_packet_unref(&repl);
+    free_packets(orig, 3);
+    free_packets(patched, 3);
+    avcodec_parameters_free(&par);
+    remove(file);
+}
+END_TEST
+
+Suite *test_suite(void)
+{
+    Suite *s = suite_create("Irdeto patches: in-place essence patching");
+    TCase *tc = tcase_create("Patch and compare tests");
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_patch_mxf);
+    tcase_add_test(tc, test_patch_mxf_without_hdr_size);
+    tcase_add_test(tc, test_patch_ts);
+    tcase_add_test(tc, test_patch_mp4_filler_nal);
+
+    return s;
+}
@@ -0,0 +1,191 @@
+#include <check.h>
+#include <string.h>
+
+#include "libavformat/avformat.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/ir_wm_info.h"
+
+#define TS_PACKET_SIZE 188
+#define PTS_MASK       ((1LL << 33) - 1)
+#define AUDIO_PID      0x100
+#define VIDEO_PID      0x101
+
+/* 2023-11-14T22:13:20.123Z */
+#define EPOCH_TIME_MS  1700000000123LL
+
+/* The muxer shifts the timestamps by twice max_delay */
+#define MAX_DELAY      100000
+#define FIRST_PTS      ((EPOCH_TIME_MS * 90 + 2 * MAX_DELAY * 9 / 100) & PTS_MASK)
+
+typedef struct TSInfo {
+    int64_t first_pcr;      ///< in 90 kHz units, -1 if none
+    int64_t audio_pts;      ///< first audio PES PTS, -1 if none
+    int64_t video_pts;      ///< first video PES PTS, -1 if none
+    int nb_packets;
+} TSInfo;
+
+static int64_t read_pts(const uint8_t *p)
+{
+    return (int64_t)(p[0] >> 1 & 0x07) << 30 | (p[1] << 8 | p[2]) >> 1 << 15 | (p[3] << 8 | p[4]) >> 1;
+}
+
+/**
+ * @brief Get the first PCR and the first PTS of both streams of a TS
+ * @param buf TS data
+ * @param size TS data size
+ * @param info parsed values
+ */
+static void parse_ts(const uint8_t *buf, int size, TSInfo *info)
+{
+    int i;
+
+    info->first_pcr = info->audio_pts = info->video_pts = -1;
+    info->nb_packets = size / TS_PACKET_SIZE;
+
+    for (i = 0; i + TS_PACKET_SIZE <= size; i += TS_PACKET_SIZE) {
+        const uint8_t *p = buf + i;
+        int pid = (p[1] & 0x1f) << 8 | p[2];
+        int afc = p[3] >> 4 & 3;
+        const uint8_t *payload = p + 4;
+
+        fail_unless(p[0] == 0x47);
+
+        if (afc & 2) {
+            if (p[4] > 0 && p[5] & 0x10 && info->first_pcr < 0)
+                info->first_pcr = (int64_t)p[6] << 25 | p[7] << 17 | p[8] << 9 | p[9] << 1 | p[10] >> 7;
+            payload += 1 + p[4];
+        }
+
+        if (!(afc & 1) || !(p[1] & 0x40) || AV_RB24(payload) != 1 || !(payload[7] & 0x80))
+            continue;
+        if (pid == AUDIO_PID && info->audio_pts < 0)
+            info->audio_pts = read_pts(payload + 9);
+        if (pid == VIDEO_PID && info->video_pts < 0)
+            info->video_pts = read_pts(payload + 9);
+    }
+}
+
+static void write_packet(AVFormatContext *oc, int stream_index, int64_t ts, int size, const AVIrdetoEpoch *epoch)
+{
+    AVPacket pkt;
+
+    fail_unless(0 == av_new_packet(&pkt, size));
+    memset(pkt.data, 0, size);
+    if (stream_index == 1)
+        AV_WB32(pkt.data, 0x1B3);
+    pkt.stream_index = stream_index;
+    pkt.pts = pkt.dts = ts;
+    pkt.flags = AV_PKT_FLAG_KEY;
+    if (epoch)
+        memcpy(av_packet_new_side_data(&pkt, AV_PKT_IRDETO_EPOCH_TIME, sizeof(*epoch)), epoch, sizeof(*epoch));
+
+    fail_unless(0 <= av_write_frame(oc, &pkt));
+    av_packet_unref(&pkt);
+}
+
+/**
+ * @brief Mux audio then video with the epoch carried by the first video
+ *        packet, and return the resulting TS
+ * @param muxrate mpegts muxrate option
+ * @param size output size
+ * @return TS data, to be freed with av_free()
+ */
+static uint8_t *mux_with_epoch(const char *muxrate, int *size)
+{
+    AVFormatContext *oc = NULL;
+    AVDictionary *opts = NULL;
+    AVIrdetoEpoch epoch = { .epoch_time = EPOCH_TIME_MS, .seglen = 2000 };
+    AVStream *ast, *vst;
+    uint8_t *buf = NULL;
+    int i;
+
+    fail_unless(0 <= avformat_alloc_output_context2(&oc, NULL, "mpegts", NULL));
+    fail_unless(0 <= avio_open_dyn_buf(&oc->pb));
+    oc->max_delay = MAX_DELAY;
+
+    ast = avformat_new_stream(oc, NULL);
+    ast->codecpar->codec_type  = AVMEDIA_TYPE_AUDIO;
+    ast->codecpar->codec_id    = AV_CODEC_ID_MP2;
+    ast->codecpar->sample_rate = 48000;
+    ast->codecpar->channels    = 2;
+    ast->codecpar->frame_size  = 1152;
+    ast->time_base = (AVRational){ 1, 90000 };
+
+    vst = avformat_new_stream(oc, NULL);
+    vst->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    vst->codecpar->codec_id   = AV_CODEC_ID_MPEG2VIDEO;
+    vst->codecpar->width      = 352;
+    vst->codecpar->height     = 288;
+    vst->time_base = (AVRational){ 1, 90000 };
+
+    av_dict_set(&opts, "mpegts_flags", "epoch_time", 0);
+    av_dict_set(&opts, "muxrate", muxrate, 0);
+    fail_unless(0 <= avformat_write_header(oc, &opts));
+    av_dict_free(&opts);
+
+    /* Audio ahead of the first video packet carrying the epoch */
+    write_packet(oc, 0, 0, 384, NULL);
+    write_packet(oc, 0, 2160, 384, NULL);
+    write_packet(oc, 1, 0, 4000, &epoch);
+    for (i = 1; i < 10; i++) {
+        write_packet(oc, 0, 2160 * (i + 1), 384, NULL);
+        write_packet(oc, 1, 3600 * i, 4000, NULL);
+    }
+
+    fail_unless(0 == av_write_trailer(oc));
+    *size = avio_close_dyn_buf(oc->pb, &buf);
+    oc->pb = NULL;
+    avformat_free_context(oc);
+
+    return buf;
+}
+
+START_TEST(test_epoch_cbr_pcr)
+{
+    TSInfo info;
+    int size;
+    uint8_t *buf = mux_with_epoch("2000000", &size);
+
+    parse_ts(buf, size, &info);
+
+    // No stuffing towards the offset PTS: 10 frames at 2 Mbps fit in 100 kB
+    fail_unless(size < 100000);
+    fail_unless(info.first_pcr >= 0);
+    fail_unless(info.video_pts == FIRST_PTS);
+
+    // Leading audio is kept, on the same timeline
+    fail_unless(info.audio_pts == FIRST_PTS);
+
+    // PCR and PTS in the same timeline, PTS ahead by less than a second
+    fail_unless(((info.video_pts - info.first_pcr) & PTS_MASK) < 90000);
+
+    av_free(buf);
+}
+END_TEST
+
+START_TEST(test_epoch_vbr)
+{
+    TSInfo info;
+    int size;
+    uint8_t *buf = mux_with_epoch("1", &size);
+
+    parse_ts(buf, size, &info);
+
+    fail_unless(info.video_pts == FIRST_PTS);
+    fail_unless(info.audio_pts == FIRST_PTS);
+    fail_unless(((info.video_pts - info.first_pcr) & PTS_MASK) < 90000);
+
+    av_free(buf);
+}
+END_TEST
+
+Suite *test_suite(void)
+{
+    Suite *s = suite_create("Irdeto patches: MPEG-TS epoch time offset");
+    TCase *tc = tcase_create("Epoch time offset of PTS and PCR tests");
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_epoch_cbr_pcr);
+    tcase_add_test(tc, test_epoch_vbr);
+
+    return s;
+}
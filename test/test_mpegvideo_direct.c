@@ -0,0 +1,213 @@
+#include <check.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libavcodec/avcodec.h"
+#include "libavutil/adler32.h"
+#include "libavutil/imgutils.h"
+#include "irxps/ir_xps_common.h"
+
+#define NB_FRAMES      24
+#define WIDTH          352
+#define HEIGHT         288
+
+/* a multiple of any STRIDE_ALIGN, but not what get_buffer() would pick */
+#define OTHER_LINESIZE 512
+/* not a multiple of any STRIDE_ALIGN, so that the encoder copies */
+#define COPY_LINESIZE  (WIDTH + 8)
+
+/**
+ * @brief Encode a GOP structure with B-frames
+ * @return number of packets in pkts
+ */
+static int encode_source(AVPacket *pkts)
+{
+    AVCodecContext *enc = avcodec_alloc_context3(avcodec_find_encoder(AV_CODEC_ID_MPEG2VIDEO));
+    AVFrame *frame = av_frame_alloc();
+    AVPacket pkt;
+    int i, n = 0, ret;
+
+    av_init_packet(&pkt);
+    enc->width        = WIDTH;
+    enc->height       = HEIGHT;
+    enc->pix_fmt      = AV_PIX_FMT_YUV420P;
+    enc->time_base    = (AVRational){ 1, 25 };
+    enc->gop_size     = 12;
+    enc->max_b_frames = 2;
+    enc->bit_rate     = 1500000;
+    fail_unless(0 == avcodec_open2(enc, enc->codec, NULL));
+
+    frame->format = enc->pix_fmt;
+    frame->width  = enc->width;
+    frame->height = enc->height;
+    fail_unless(0 == av_frame_get_buffer(frame, 32));
+
+    for (i = 0; i <= NB_FRAMES; i++) {
+        if (i < NB_FRAMES) {
+            int x, y;
+
+            fail_unless(0 == av_frame_make_writable(frame));
+            for (y = 0; y < HEIGHT; y++)
+                for (x = 0; x < WIDTH; x++)
+                    frame->data[0][y * frame->linesize[0] + x] = (x * 3 + y * 2 + i * 5) ^ (x * y >> 6);
+            for (y = 0; y < HEIGHT / 2; y++)
+                for (x = 0; x < WIDTH / 2; x++) {
+                    frame->data[1][y * frame->linesize[1] + x] = 128 + ((x + i) & 31);
+                    frame->data[2][y * frame->linesize[2] + x] = 128 + ((y + 2 * i) & 31);
+                }
+            frame->pts = i;
+            fail_unless(0 == avcodec_send_frame(enc, frame));
+        } else {
+            fail_unless(0 == avcodec_send_frame(enc, NULL));
+        }
+
+        /* elementary stream without timestamps, as the re-encode loads the
+         * references of a B picture before it */
+        while ((ret = avcodec_receive_packet(enc, &pkt)) == 0) {
+            pkt.pts = pkt.dts = AV_NOPTS_VALUE;
+            av_packet_move_ref(&pkts[n++], &pkt);
+        }
+        fail_unless(ret == AVERROR(EAGAIN) || ret == AVERROR_EOF);
+    }
+
+    avcodec_free_context(&enc);
+    av_frame_free(&frame);
+
+    return n;
+}
+
+/**
+ * @brief Copy a frame into planes with the given luma stride
+ */
+static AVFrame *copy_frame(const AVFrame *src, int stride)
+{
+    AVFrame *dst = av_frame_alloc();
+    int linesize[4] = { stride, stride / 2, stride / 2, 0 };
+    int size = av_image_fill_pointers(dst->data, AV_PIX_FMT_YUV420P, HEIGHT, NULL, linesize);
+
+    fail_unless(size > 0);
+    dst->buf[0] = av_buffer_alloc(size);
+    fail_unless(dst->buf[0] != NULL);
+    av_image_fill_pointers(dst->data, AV_PIX_FMT_YUV420P, HEIGHT, dst->buf[0]->data, linesize);
+    memcpy(dst->linesize, linesize, sizeof(linesize));
+    dst->format = src->format;
+    dst->width  = src->width;
+    dst->height = src->height;
+    fail_unless(0 == av_frame_copy(dst, src));
+    fail_unless(0 == av_frame_copy_props(dst, src));
+
+    return dst;
+}
+
+/**
+ * @brief Re-encode one picture with a fresh irdeto mode encoder
+ * @param referenced set if the encoder holds a reference to the input frame
+ * @return checksum of the packet
+ */
+static unsigned long reencode(AVFrame *frame, int *referenced)
+{
+    AVCodecContext *enc = avcodec_alloc_context3(avcodec_find_encoder(AV_CODEC_ID_MPEG2VIDEO));
+    AVDictionary *opts = NULL;
+    AVPacket pkt;
+    unsigned long checksum;
+    int refs = av_buffer_get_ref_count(frame->buf[0]);
+
+    av_init_packet(&pkt);
+    enc->width          = WIDTH;
+    enc->height         = HEIGHT;
+    enc->pix_fmt        = AV_PIX_FMT_YUV420P;
+    enc->time_base      = (AVRational){ 1, 25 };
+    enc->thread_count   = 1;
+    enc->global_quality = 4;
+    av_dict_set(&opts, "irdeto_exports", "1", 0);
+    fail_unless(0 == avcodec_open2(enc, enc->codec, &opts));
+    av_dict_free(&opts);
+
+    fail_unless(0 == avcodec_send_frame(enc, frame));
+    *referenced = av_buffer_get_ref_count(frame->buf[0]) > refs;
+    fail_unless(0 == avcodec_receive_packet(enc, &pkt));
+    fail_unless(pkt.size > 0);
+    checksum = av_adler32_update(1, pkt.data, pkt.size);
+
+    av_packet_unref(&pkt);
+    avcodec_free_context(&enc);
+
+    return checksum;
+}
+
+START_TEST(test_irdeto_input_referenced)
+{
+    AVPacket pkts[NB_FRAMES];
+    AVCodecContext *dec;
+    AVDictionary *opts = NULL;
+    AVFrame *frame = av_frame_alloc();
+    int nb_pkts, i, ret, nb_intra = 0, nb_bidir = 0;
+
+    nb_pkts = encode_source(pkts);
+    fail_unless(nb_pkts == NB_FRAMES);
+
+    dec = avcodec_alloc_context3(avcodec_find_decoder(AV_CODEC_ID_MPEG2VIDEO));
+    dec->thread_count = 1;
+    av_dict_set(&opts, "irdeto_exports", "1", 0);
+    fail_unless(0 == avcodec_open2(dec, dec->codec, &opts));
+    av_dict_free(&opts);
+
+    for (i = 0; i <= nb_pkts; i++) {
+        fail_unless(0 == avcodec_send_packet(dec, i < nb_pkts ? &pkts[i] : NULL));
+        while ((ret = avcodec_receive_frame(dec, frame)) == 0) {
+            ir_xps_context *ctx = frame->opaque;
+
+            fail_unless(ctx != NULL);
+            if (frame->pict_type == AV_PICTURE_TYPE_I ||
+                frame->pict_type == AV_PICTURE_TYPE_B) {
+                AVFrame *other = copy_frame(frame, OTHER_LINESIZE);
+                AVFrame *copy  = copy_frame(frame, COPY_LINESIZE);
+                unsigned long direct, checksum;
+                int referenced;
+
+                // Decoder frames are referenced by the encoder, not copied
+                direct = reencode(frame, &referenced);
+                fail_unless(referenced);
+
+                // as are frames from other allocators with aligned strides,
+                // unless the references of a B picture came with other ones
+                checksum = reencode(other, &referenced);
+                fail_unless(referenced == (frame->pict_type == AV_PICTURE_TYPE_I));
+                fail_unless(checksum == direct);
+
+                // and encode the same as a copy into the encoder's own picture
+                checksum = reencode(copy, &referenced);
+                fail_unless(!referenced);
+                fail_unless(checksum == direct);
+
+                if (frame->pict_type == AV_PICTURE_TYPE_I)
+                    nb_intra++;
+                else
+                    nb_bidir++;
+                av_frame_free(&other);
+                av_frame_free(&copy);
+            }
+            ir_xps_context_destroy(ctx);
+            av_frame_unref(frame);
+        }
+        fail_unless(ret == AVERROR(EAGAIN) || ret == AVERROR_EOF);
+    }
+    fail_unless(nb_intra >= 2);
+    fail_unless(nb_bidir >= 4);
+
+    for (i = 0; i < nb_pkts; i++)
+        av_packet_unref(&pkts[i]);
+    avcodec_free_context(&dec);
+    av_frame_free(&frame);
+}
+END_TEST
+
+Suite *test_suite(void)
+{
+    Suite *s = suite_create("Irdeto patches: mpegvideo encoder direct input");
+    TCase *tc = tcase_create("Direct input tests");
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_irdeto_input_referenced);
+
+    return s;
+}
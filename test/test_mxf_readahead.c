@@ -0,0 +1,260 @@
+#include <check.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+#include "libavutil/adler32.h"
+
+#define MXF_FILE       "test_mxf_readahead.mxf"
+#define NB_FRAMES      60
+#define SAMPLE_RATE    48000
+#define MAX_PACKETS    256
+
+typedef struct PacketInfo {
+    int stream_index;
+    int64_t pts;
+    int64_t dts;
+    int64_t pos;
+    int size;
+    unsigned long checksum;
+} PacketInfo;
+
+/**
+ * @brief Write an OP1a MXF with MPEG-2 video and PCM audio
+ */
+static void write_mxf(void)
+{
+    AVFormatContext *oc = NULL;
+    AVCodecContext *enc;
+    AVStream *vst, *ast;
+    AVFrame *frame = av_frame_alloc();
+    AVPacket pkt;
+    int i, ret;
+
+    enc = avcodec_alloc_context3(avcodec_find_encoder(AV_CODEC_ID_MPEG2VIDEO));
+    enc->width     = 352;
+    enc->height    = 288;
+    enc->pix_fmt   = AV_PIX_FMT_YUV420P;
+    enc->time_base = (AVRational){ 1, 25 };
+    enc->gop_size  = 12;
+    enc->bit_rate  = 2000000;
+    fail_unless(0 == avcodec_open2(enc, enc->codec, NULL));
+
+    fail_unless(0 <= avformat_alloc_output_context2(&oc, NULL, "mxf", MXF_FILE));
+    fail_unless(0 <= avio_open(&oc->pb, MXF_FILE, AVIO_FLAG_WRITE));
+
+    vst = avformat_new_stream(oc, NULL);
+    avcodec_parameters_from_context(vst->codecpar, enc);
+    vst->time_base = enc->time_base;
+
+    ast = avformat_new_stream(oc, NULL);
+    ast->codecpar->codec_type     = AVMEDIA_TYPE_AUDIO;
+    ast->codecpar->codec_id       = AV_CODEC_ID_PCM_S16LE;
+    ast->codecpar->sample_rate    = SAMPLE_RATE;
+    ast->codecpar->channels       = 2;
+    ast->codecpar->channel_layout = AV_CH_LAYOUT_STEREO;
+    ast->codecpar->bits_per_coded_sample = 16;
+    ast->time_base = (AVRational){ 1, SAMPLE_RATE };
+    fail_unless(0 <= avformat_write_header(oc, NULL));
+
+    frame->format = enc->pix_fmt;
+    frame->width  = enc->width;
+    frame->height = enc->height;
+    fail_unless(0 == av_frame_get_buffer(frame, 32));
+
+    av_init_packet(&pkt);
+    for (i = 0; i <= NB_FRAMES; i++) {
+        if (i < NB_FRAMES) {
+            int y, x;
+
+            fail_unless(0 == av_frame_make_writable(frame));
+            for (y = 0; y < frame->height; y++)
+                for (x = 0; x < frame->width; x++)
+                    frame->data[0][y * frame->linesize[0] + x] = x + y + i * 3;
+            for (y = 0; y < frame->height / 2; y++) {
+                memset(frame->data[1] + y * frame->linesize[1], 128 + i, frame->width / 2);
+                memset(frame->data[2] + y * frame->linesize[2], 64 + y, frame->width / 2);
+            }
+            frame->pts = i;
+            fail_unless(0 == avcodec_send_frame(enc, frame));
+        } else {
+            fail_unless(0 == avcodec_send_frame(enc, NULL));
+        }
+
+        while ((ret = avcodec_receive_packet(enc, &pkt)) == 0) {
+            AVPacket apkt;
+            int64_t n = pkt.pts;
+
+            pkt.stream_index = 0;
+            av_packet_rescale_ts(&pkt, enc->time_base, vst->time_base);
+            fail_unless(0 == av_interleaved_write_frame(oc, &pkt));
+
+            /* one edit unit of audio per video frame */
+            fail_unless(0 == av_new_packet(&apkt, SAMPLE_RATE / 25 * 4));
+            memset(apkt.data, n & 0xff, apkt.size);
+            apkt.stream_index = 1;
+            apkt.pts = apkt.dts = av_rescale_q(n, enc->time_base, ast->time_base);
+            fail_unless(0 == av_interleaved_write_frame(oc, &apkt));
+        }
+        fail_unless(ret == AVERROR(EAGAIN) || ret == AVERROR_EOF);
+    }
+
+    fail_unless(0 == av_write_trailer(oc));
+    avio_closep(&oc->pb);
+    avformat_free_context(oc);
+    avcodec_free_context(&enc);
+    av_frame_free(&frame);
+}
+
+static AVFormatContext *open_mxf(int readahead)
+{
+    AVFormatContext *ic = NULL;
+    AVDictionary *opts = NULL;
+
+    av_dict_set_int(&opts, "readahead_edit_units", readahead, 0);
+    fail_unless(0 == avformat_open_input(&ic, MXF_FILE, NULL, &opts));
+    av_dict_free(&opts);
+    fail_unless(ic->nb_streams == 2);
+
+    return ic;
+}
+
+/**
+ * @brief Read up to max packets and record them
+ * @return number of packets read
+ */
+static int read_packets(AVFormatContext *ic, PacketInfo *info, int max)
+{
+    AVPacket pkt;
+    int n;
+
+    for (n = 0; n < max && av_read_frame(ic, &pkt) >= 0; n++) {
+        info[n].stream_index = pkt.stream_index;
+        info[n].pts          = pkt.pts;
+        info[n].dts          = pkt.dts;
+        info[n].pos          = pkt.pos;
+        info[n].size         = pkt.size;
+        info[n].checksum     = av_adler32_update(1, pkt.data, pkt.size);
+        av_packet_unref(&pkt);
+    }
+
+    return n;
+}
+
+/**
+ * @brief Demux with the given readahead, running through several kinds of seeks
+ * @return number of packets recorded in info
+ */
+static int demux(int readahead, PacketInfo *info, int64_t *byte_pos)
+{
+    AVFormatContext *ic = open_mxf(readahead);
+    int n = 0;
+
+    // Linear read of everything
+    n += read_packets(ic, info + n, MAX_PACKETS);
+    fail_unless(n >= 2 * NB_FRAMES);
+
+    // Timestamp seek back into the file
+    fail_unless(0 <= av_seek_frame(ic, 0, 30, AVSEEK_FLAG_BACKWARD));
+    n += read_packets(ic, info + n, 10);
+
+    // Byte seek to a packet seen in the first pass
+    fail_unless(0 <= av_seek_frame(ic, -1, *byte_pos, AVSEEK_FLAG_BYTE));
+    n += read_packets(ic, info + n, 10);
+
+    // Byte seek to the start of the next packet, where pb may already be
+    fail_unless(0 <= av_seek_frame(ic, -1, info[n - 1].pos + 16 + 4 + info[n - 1].size, AVSEEK_FLAG_BYTE));
+    n += read_packets(ic, info + n, 4);
+
+    // Seek done on pb behind the demuxer's back
+    fail_unless(0 <= avio_seek(ic->pb, *byte_pos, SEEK_SET));
+    n += read_packets(ic, info + n, 6);
+
+    avformat_close_input(&ic);
+
+    return n;
+}
+
+START_TEST(test_readahead_checksums)
+{
+    PacketInfo ref[MAX_PACKETS * 2], ra[MAX_PACKETS * 2];
+    int64_t byte_pos;
+    int nb_ref, nb_ra, i;
+    unsigned j, readahead[] = { 1, 8, 1024 };
+
+    write_mxf();
+
+    // A video packet in the middle of the file, found by a plain read
+    {
+        AVFormatContext *ic = open_mxf(0);
+        PacketInfo first[MAX_PACKETS];
+        int n = read_packets(ic, first, MAX_PACKETS);
+
+        fail_unless(n > NB_FRAMES);
+        for (i = n / 2; first[i].stream_index != 0; i++)
+            ;
+        byte_pos = first[i].pos;
+        avformat_close_input(&ic);
+    }
+
+    nb_ref = demux(0, ref, &byte_pos);
+    for (j = 0; j < sizeof(readahead) / sizeof(readahead[0]); j++) {
+        nb_ra = demux(readahead[j], ra, &byte_pos);
+        fail_unless(nb_ra == nb_ref);
+        for (i = 0; i < nb_ref; i++) {
+            fail_unless(ra[i].stream_index == ref[i].stream_index);
+            fail_unless(ra[i].pts          == ref[i].pts);
+            fail_unless(ra[i].dts          == ref[i].dts);
+            fail_unless(ra[i].pos          == ref[i].pos);
+            fail_unless(ra[i].size         == ref[i].size);
+            fail_unless(ra[i].checksum     == ref[i].checksum);
+        }
+    }
+
+    remove(MXF_FILE);
+}
+END_TEST
+
+START_TEST(test_readahead_packet_lifetime)
+{
+    AVFormatContext *ic;
+    AVPacket pkt[4];
+    unsigned long checksum[4];
+    int i;
+
+    write_mxf();
+    ic = open_mxf(8);
+
+    // Packets stay valid after the buffer they reference has been replaced
+    for (i = 0; i < 4; i++) {
+        fail_unless(0 == av_read_frame(ic, &pkt[i]));
+        fail_unless(pkt[i].buf != NULL);
+        checksum[i] = av_adler32_update(1, pkt[i].data, pkt[i].size);
+    }
+    fail_unless(0 <= av_seek_frame(ic, 0, 40, AVSEEK_FLAG_BACKWARD));
+    for (i = 0; i < 20; i++) {
+        AVPacket tmp;
+        fail_unless(0 == av_read_frame(ic, &tmp));
+        av_packet_unref(&tmp);
+    }
+    for (i = 0; i < 4; i++) {
+        fail_unless(checksum[i] == av_adler32_update(1, pkt[i].data, pkt[i].size));
+        av_packet_unref(&pkt[i]);
+    }
+
+    avformat_close_input(&ic);
+    remove(MXF_FILE);
+}
+END_TEST
+
+Suite *test_suite(void)
+{
+    Suite *s = suite_create("Irdeto patches: MXF demuxer read-ahead");
+    TCase *tc = tcase_create("MXF read-ahead demux checksum tests");
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_readahead_checksums);
+    tcase_add_test(tc, test_readahead_packet_lifetime);
+
+    return s;
+}
@@ -0,0 +1,196 @@
+#include <check.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libavcodec/avcodec.h"
+#include "libavcodec/segment_thread_encoder.h"
+#include "libavutil/opt.h"
+
+#define NB_FRAMES      62
+#define WIDTH          352
+#define HEIGHT         288
+#define SEGMENTS       3
+#define SEGMENT_FRAMES 12
+
+static AVCodecContext *alloc_encoder(const char *name)
+{
+    const AVCodec *codec = avcodec_find_encoder_by_name(name);
+    AVCodecContext *enc;
+
+    fail_unless(codec != NULL);
+    enc = avcodec_alloc_context3(codec);
+    fail_unless(enc != NULL);
+    enc->width        = WIDTH;
+    enc->height       = HEIGHT;
+    enc->pix_fmt      = AV_PIX_FMT_YUV420P;
+    enc->time_base    = (AVRational){ 1, 25 };
+    enc->gop_size     = SEGMENT_FRAMES;
+    enc->max_b_frames = 2;
+    enc->bit_rate     = 800000;
+
+    return enc;
+}
+
+/**
+ * @brief Feed moving content through an encode callback and check the
+ *        stitched stream: every frame comes out once, in decoding order with
+ *        increasing dts, and each segment starts on a key frame
+ */
+static void check_encode(void *opaque,
+                         int (*encode)(void *opaque, AVPacket *pkt, const AVFrame *frame))
+{
+    AVFrame *frame = av_frame_alloc();
+    AVPacket pkt;
+    int64_t last_dts = INT64_MIN;
+    int seen[NB_FRAMES] = { 0 };
+    int i, n = 0, segment = -1, ret;
+
+    av_init_packet(&pkt);
+    frame->format = AV_PIX_FMT_YUV420P;
+    frame->width  = WIDTH;
+    frame->height = HEIGHT;
+    fail_unless(0 == av_frame_get_buffer(frame, 32));
+
+    for (i = 0; i <= NB_FRAMES; i++) {
+        const AVFrame *in = NULL;
+
+        if (i < NB_FRAMES) {
+            int x, y;
+
+            fail_unless(0 == av_frame_make_writable(frame));
+            for (y = 0; y < HEIGHT; y++)
+                for (x = 0; x < WIDTH; x++)
+                    frame->data[0][y * frame->linesize[0] + x] = (x * 3 + y * 2 + i * 5) ^ (x * y >> 6);
+            for (y = 0; y < HEIGHT / 2; y++)
+                for (x = 0; x < WIDTH / 2; x++) {
+                    frame->data[1][y * frame->linesize[1] + x] = 128 + ((x + i) & 31);
+                    frame->data[2][y * frame->linesize[2] + x] = 128 + ((y + 2 * i) & 31);
+                }
+            frame->pts = i;
+            in = frame;
+        }
+
+        while ((ret = encode(opaque, &pkt, in)) > 0) {
+            fail_unless(pkt.pts >= 0 && pkt.pts < NB_FRAMES);
+            fail_unless(!seen[pkt.pts]);
+            seen[pkt.pts] = 1;
+
+            // Packets come segment after segment, each one opened by a key
+            // frame
+            fail_unless(pkt.pts / SEGMENT_FRAMES >= segment);
+            if (pkt.pts / SEGMENT_FRAMES > segment) {
+                segment = pkt.pts / SEGMENT_FRAMES;
+                fail_unless(pkt.pts % SEGMENT_FRAMES == 0);
+                fail_unless(pkt.flags & AV_PKT_FLAG_KEY);
+            }
+
+            // with dts carried on across the boundaries
+            fail_unless(pkt.dts > last_dts);
+            fail_unless(pkt.dts <= pkt.pts);
+            last_dts = pkt.dts;
+
+            n++;
+            av_packet_unref(&pkt);
+            if (in)
+                break;
+        }
+        fail_unless(ret >= 0);
+    }
+    fail_unless(n == NB_FRAMES);
+    fail_unless(segment == (NB_FRAMES - 1) / SEGMENT_FRAMES);
+
+    av_frame_free(&frame);
+}
+
+/* one frame in, at most one packet out, as the encode2 callbacks do */
+static int segment_encode(void *opaque, AVPacket *pkt, const AVFrame *frame)
+{
+    int got_packet, ret;
+
+    ret = ff_segment_thread_encode_frame(opaque, pkt, frame, &got_packet);
+
+    return ret < 0 ? ret : got_packet;
+}
+
+static int codec_encode(void *opaque, AVPacket *pkt, const AVFrame *frame)
+{
+    int ret;
+
+    if (frame) {
+        ret = avcodec_send_frame(opaque, frame);
+        if (ret < 0)
+            return ret;
+    } else if ((ret = avcodec_send_frame(opaque, NULL)) < 0 && ret != AVERROR_EOF) {
+        return ret;
+    }
+    ret = avcodec_receive_packet(opaque, pkt);
+
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret < 0 ? ret : 1;
+}
+
+START_TEST(test_segment_thread_encoder)
+{
+    AVCodecContext *enc = alloc_encoder("mpeg4");
+    SegmentThreadContext *s = NULL;
+
+    fail_unless(0 == avcodec_open2(enc, enc->codec, NULL));
+    fail_unless(0 == ff_segment_thread_encoder_init(enc, &s, SEGMENTS, SEGMENT_FRAMES));
+
+    check_encode(s, segment_encode);
+
+    ff_segment_thread_encoder_free(&s);
+    fail_unless(s == NULL);
+    avcodec_free_context(&enc);
+}
+END_TEST
+
+START_TEST(test_segment_thread_encoder_single)
+{
+    AVCodecContext *enc = alloc_encoder("mpeg4");
+    SegmentThreadContext *s = NULL;
+
+    // A single segment at a time is no segment encoding
+    fail_unless(0 == avcodec_open2(enc, enc->codec, NULL));
+    fail_unless(AVERROR(EINVAL) == ff_segment_thread_encoder_init(enc, &s, 1, SEGMENT_FRAMES));
+    fail_unless(s == NULL);
+
+    avcodec_free_context(&enc);
+}
+END_TEST
+
+START_TEST(test_libx264_segments)
+{
+    AVCodecContext *enc = alloc_encoder("libx264");
+    AVDictionary *opts = NULL;
+
+    // segments=1 is refused rather than ignored
+    av_dict_set(&opts, "segments", "1", 0);
+    fail_unless(avcodec_open2(enc, enc->codec, &opts) < 0);
+    av_dict_free(&opts);
+    avcodec_free_context(&enc);
+
+    enc = alloc_encoder("libx264");
+    av_dict_set_int(&opts, "segments", SEGMENTS, 0);
+    av_dict_set(&opts, "preset", "veryfast", 0);
+    fail_unless(0 == avcodec_open2(enc, enc->codec, &opts));
+    fail_unless(av_dict_count(opts) == 0);
+    av_dict_free(&opts);
+
+    check_encode(enc, codec_encode);
+
+    avcodec_free_context(&enc);
+}
+END_TEST
+
+Suite *test_suite(void)
+{
+    Suite *s = suite_create("Irdeto patches: segment thread encoder");
+    TCase *tc = tcase_create("Segment encoding tests");
+    tcase_set_timeout(tc, 30);
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_segment_thread_encoder);
+    tcase_add_test(tc, test_segment_thread_encoder_single);
+    tcase_add_test(tc, test_libx264_segments);
+
+    return s;
+}